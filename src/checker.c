@@ -15,7 +15,7 @@ typedef struct _TOKEN_LINK
   struct _TOKEN_LINK* previous;
 } TokenLink;
 
-static struct
+static THREAD_LOCAL struct
 {
   ArrayStmt statements;
 
@@ -292,6 +292,11 @@ static void error_imported_functions_cannot_have_bodies(Token token)
   error(token, "An imported function cannot have a body.");
 }
 
+static void error_only_imported_functions_can_be_pure(Token token)
+{
+  error(token, "Only imported functions can be pure.");
+}
+
 static void error_no_return(Token token)
 {
   error(token, "Non-void function must return a value.");
@@ -411,6 +416,8 @@ const char* data_type_to_string(DataType data_type)
     return "float";
   case TYPE_STRING:
     return "string";
+  case TYPE_STRING_BUILDER:
+    return "StringBuilder";
   case TYPE_ALIAS:
     return data_type_to_string(*data_type.alias.data_type);
   case TYPE_OBJECT:
@@ -647,7 +654,8 @@ bool boolable_data_type(DataType data_type)
 bool assignable_data_type(bool permissive, DataType destination, DataType source)
 {
   if (destination.type == TYPE_ANY && permissive)
-    return source.type == TYPE_OBJECT || source.type == TYPE_STRING || source.type == TYPE_ARRAY ||
+    return source.type == TYPE_OBJECT || source.type == TYPE_STRING ||
+           source.type == TYPE_STRING_BUILDER || source.type == TYPE_ARRAY ||
            source.type == TYPE_NULL || source.type == TYPE_ANY;
 
   if (destination.type == TYPE_FLOAT && permissive)
@@ -680,6 +688,7 @@ int size_data_type(DataType data_type)
   case TYPE_FLOAT:
     return sizeof(float);
   case TYPE_STRING:
+  case TYPE_STRING_BUILDER:
   case TYPE_OBJECT:
   case TYPE_ARRAY:
   case TYPE_ANY:
@@ -746,9 +755,7 @@ static void data_type_inference(Expr** source_expression, DataType* source, Data
   {
     *source->null_function = true;
   }
-  else if (target->type == TYPE_ANY &&
-           (source->type == TYPE_OBJECT || source->type == TYPE_STRING ||
-            source->type == TYPE_ARRAY || source->type == TYPE_NULL || source->type == TYPE_ANY))
+  else if (target->type == TYPE_ANY && assignable_data_type(true, *target, *source))
   {
     autocast(source_expression, source, target);
   }
@@ -1338,6 +1345,17 @@ static bool upcast_boolable_to_bool(BinaryExpr* expression, DataType* left, Data
   return upcast(expression, left, right, from, DATA_TYPE(TYPE_BOOL));
 }
 
+static int function_group_offset(DataType data_type)
+{
+  if (data_type.type == TYPE_FUNCTION_MEMBER)
+    return 1;
+
+  if (data_type.type == TYPE_FUNCTION_INTERNAL && data_type.function_internal.this)
+    return 1;
+
+  return 0;
+}
+
 static void expand_function_group(DataType* data_type, DataType* argument_data_types,
                                   unsigned int number_of_arguments)
 {
@@ -1349,21 +1367,22 @@ static void expand_function_group(DataType* data_type, DataType* argument_data_t
     array_foreach(&function_group, function_data_type)
     {
       if (function_data_type.type == TYPE_FUNCTION ||
-          function_data_type.type == TYPE_FUNCTION_MEMBER)
+          function_data_type.type == TYPE_FUNCTION_MEMBER ||
+          function_data_type.type == TYPE_FUNCTION_INTERNAL)
       {
-        FuncStmt* function = function_data_type.type == TYPE_FUNCTION
-                               ? function_data_type.function
-                               : function_data_type.function_member.function;
+        DataType return_data_type;
+        ArrayDataType parameter_types;
+        expand_function_data_type(function_data_type, &return_data_type, &parameter_types);
 
-        int offset = function_data_type.type == TYPE_FUNCTION_MEMBER ? 1 : 0;
+        int offset = function_group_offset(function_data_type);
         bool match = true;
 
-        if (function->parameters.size - offset == number_of_arguments)
+        if (parameter_types.size - offset == number_of_arguments)
         {
-          for (unsigned int i = offset; i < function->parameters.size; i++)
+          for (unsigned int i = offset; i < parameter_types.size; i++)
           {
             DataType argument_data_type = argument_data_types[i - offset];
-            DataType parameter_data_type = function->parameters.elems[i]->data_type;
+            DataType parameter_data_type = parameter_types.elems[i];
 
             if (argument_data_type.type == TYPE_ARRAY &&
                 argument_data_type.array.data_type->type == TYPE_VOID)
@@ -1393,21 +1412,22 @@ static void expand_function_group(DataType* data_type, DataType* argument_data_t
     array_foreach(&function_group, function_data_type)
     {
       if (function_data_type.type == TYPE_FUNCTION ||
-          function_data_type.type == TYPE_FUNCTION_MEMBER)
+          function_data_type.type == TYPE_FUNCTION_MEMBER ||
+          function_data_type.type == TYPE_FUNCTION_INTERNAL)
       {
-        FuncStmt* function = function_data_type.type == TYPE_FUNCTION
-                               ? function_data_type.function
-                               : function_data_type.function_member.function;
+        DataType return_data_type;
+        ArrayDataType parameter_types;
+        expand_function_data_type(function_data_type, &return_data_type, &parameter_types);
 
-        int offset = function_data_type.type == TYPE_FUNCTION_MEMBER ? 1 : 0;
+        int offset = function_group_offset(function_data_type);
         bool match = true;
 
-        if (function->parameters.size - offset == number_of_arguments)
+        if (parameter_types.size - offset == number_of_arguments)
         {
-          for (unsigned int i = offset; i < function->parameters.size; i++)
+          for (unsigned int i = offset; i < parameter_types.size; i++)
           {
             DataType argument_data_type = argument_data_types[i - offset];
-            DataType parameter_data_type = function->parameters.elems[i]->data_type;
+            DataType parameter_data_type = parameter_types.elems[i];
 
             if (!equal_data_type(parameter_data_type, argument_data_type))
             {
@@ -2061,6 +2081,20 @@ static DataType check_cast_expression(CastExpr* expression)
         break;
       }
 
+      break;
+    case TYPE_STRING_BUILDER:
+      switch (expression->to_data_type.type)
+      {
+      case TYPE_STRING_BUILDER:
+      case TYPE_STRING:
+      case TYPE_ANY:
+        valid = true;
+        break;
+
+      default:
+        break;
+      }
+
       break;
     case TYPE_ARRAY:
       switch (expression->to_data_type.type)
@@ -2099,6 +2133,7 @@ static DataType check_cast_expression(CastExpr* expression)
       {
       case TYPE_ANY:
       case TYPE_STRING:
+      case TYPE_STRING_BUILDER:
       case TYPE_ARRAY:
       case TYPE_OBJECT:
         valid = true;
@@ -2425,6 +2460,8 @@ skip:
         !upcast(expression, &left, &right, DATA_TYPE(TYPE_FLOAT), DATA_TYPE(TYPE_STRING)) &&
         !upcast(expression, &left, &right, DATA_TYPE(TYPE_BOOL), DATA_TYPE(TYPE_STRING)) &&
         !upcast(expression, &left, &right, DATA_TYPE(TYPE_ARRAY), DATA_TYPE(TYPE_STRING)) &&
+        !upcast(expression, &left, &right, DATA_TYPE(TYPE_STRING_BUILDER),
+                DATA_TYPE(TYPE_STRING)) &&
         !upcast(expression, &left, &right, DATA_TYPE(TYPE_OBJECT), DATA_TYPE(TYPE_STRING)) &&
         !upcast(expression, &left, &right, DATA_TYPE(TYPE_ALIAS), DATA_TYPE(TYPE_STRING)) &&
         !upcast(expression, &left, &right, DATA_TYPE(TYPE_FUNCTION), DATA_TYPE(TYPE_STRING)) &&
@@ -3406,6 +3443,92 @@ static DataType check_access_expression(AccessExpr* expression)
     error_cannot_find_member_name(expression->name, name, data_type);
     return DATA_TYPE(TYPE_VOID);
   }
+  else if (data_type.type == TYPE_STRING_BUILDER)
+  {
+    const char* name = expression->name.lexeme;
+    if (strcmp("length", name) == 0)
+    {
+      expression->data_type = DATA_TYPE(TYPE_INTEGER);
+      expression->expr_data_type = data_type;
+      expression->variable = NULL;
+
+      return expression->data_type;
+    }
+    else if (strcmp("append", name) == 0)
+    {
+      DataType value_data_types[] = {
+        DATA_TYPE(TYPE_STRING),
+        DATA_TYPE(TYPE_INTEGER),
+        DATA_TYPE(TYPE_FLOAT),
+        DATA_TYPE(TYPE_CHAR),
+      };
+
+      const char* function_names[] = {
+        "string_builder.append_string",
+        "string_builder.append_int",
+        "string_builder.append_float",
+        "string_builder.append_char",
+      };
+
+      expression->data_type = DATA_TYPE(TYPE_FUNCTION_GROUP);
+      array_init(&expression->data_type.function_group);
+
+      for (unsigned int i = 0; i < sizeof(function_names) / sizeof(function_names[0]); i++)
+      {
+        DataType function_data_type = DATA_TYPE(TYPE_FUNCTION_INTERNAL);
+        function_data_type.function_internal.name = function_names[i];
+        function_data_type.function_internal.this = expression->expr;
+        function_data_type.function_internal.return_type = ALLOC(DataType);
+        function_data_type.function_internal.return_type->type = TYPE_VOID;
+
+        array_init(&function_data_type.function_internal.parameter_types);
+        array_add(&function_data_type.function_internal.parameter_types, data_type);
+        array_add(&function_data_type.function_internal.parameter_types, value_data_types[i]);
+
+        array_add(&expression->data_type.function_group, function_data_type);
+      }
+
+      expression->variable = NULL;
+      expression->expr_data_type = data_type;
+
+      return expression->data_type;
+    }
+    else if (strcmp("toString", name) == 0)
+    {
+      expression->data_type = DATA_TYPE(TYPE_FUNCTION_INTERNAL);
+      expression->data_type.function_internal.name = "string_builder.to_string";
+      expression->data_type.function_internal.this = expression->expr;
+      expression->data_type.function_internal.return_type = ALLOC(DataType);
+      expression->data_type.function_internal.return_type->type = TYPE_STRING;
+
+      array_init(&expression->data_type.function_internal.parameter_types);
+      array_add(&expression->data_type.function_internal.parameter_types, data_type);
+
+      expression->variable = NULL;
+      expression->expr_data_type = data_type;
+
+      return expression->data_type;
+    }
+    else if (strcmp("clear", name) == 0)
+    {
+      expression->data_type = DATA_TYPE(TYPE_FUNCTION_INTERNAL);
+      expression->data_type.function_internal.name = "string_builder.clear";
+      expression->data_type.function_internal.this = expression->expr;
+      expression->data_type.function_internal.return_type = ALLOC(DataType);
+      expression->data_type.function_internal.return_type->type = TYPE_VOID;
+
+      array_init(&expression->data_type.function_internal.parameter_types);
+      array_add(&expression->data_type.function_internal.parameter_types, data_type);
+
+      expression->variable = NULL;
+      expression->expr_data_type = data_type;
+
+      return expression->data_type;
+    }
+
+    error_cannot_find_member_name(expression->name, name, data_type);
+    return DATA_TYPE(TYPE_VOID);
+  }
   else if (data_type.type == TYPE_INTEGER || data_type.type == TYPE_FLOAT ||
            data_type.type == TYPE_CHAR || data_type.type == TYPE_BOOL)
   {
@@ -3968,6 +4091,12 @@ static void check_function_declaration(FuncStmt* statement)
     return;
   }
 
+  if (statement->pure && !statement->import)
+  {
+    error_only_imported_functions_can_be_pure(statement->name);
+    return;
+  }
+
   FuncStmt* previous_function = checker.function;
   checker.function = statement;
 
@@ -4178,6 +4307,36 @@ static bool analyze_statements(ArrayStmt statements)
   return false;
 }
 
+static void init_builtin_type(Environment* environment, const char* name, DataType data_type)
+{
+  Token token = { .type = TOKEN_IDENTIFIER, .lexeme = name, .length = strlen(name) };
+
+  VarStmt* variable = ALLOC(VarStmt);
+  variable->name = token;
+  variable->type = DATA_TYPE_TOKEN_EMPTY();
+  variable->function = NULL;
+  variable->initializer = NULL;
+  variable->scope = SCOPE_GLOBAL;
+  variable->index = -1;
+  variable->data_type.type = TYPE_ALIAS;
+  variable->data_type.alias.token =
+    (DataTypeToken){ .type = DATA_TYPE_TOKEN_PRIMITIVE, .token = token };
+  variable->data_type.alias.data_type = ALLOC(DataType);
+  *variable->data_type.alias.data_type = data_type;
+
+  environment_set_variable(environment, name, variable);
+}
+
+// Built-in types live in an environment around the global one, so that programs can still declare
+// globals and classes with the same names, which hide them.
+static Environment* init_builtin_types(void)
+{
+  Environment* environment = environment_init(NULL);
+  init_builtin_type(environment, "StringBuilder", DATA_TYPE(TYPE_STRING_BUILDER));
+
+  return environment;
+}
+
 void checker_init(ArrayStmt statements,
                   void (*error_callback)(int start_line, int start_column, int end_line,
                                          int end_column, const char* message),
@@ -4198,7 +4357,7 @@ void checker_init(ArrayStmt statements,
   checker.error_callback = error_callback;
   checker.link_callback = link_callback;
 
-  checker.environment = environment_init(NULL);
+  checker.environment = environment_init(init_builtin_types());
   checker.global_environment = checker.environment;
 
   array_init(&checker.global_locals);
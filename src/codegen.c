@@ -53,6 +53,7 @@ static BinaryenExpressionRef generate_class_declaration(ClassStmt* statement,
 static const char* generate_string_concat_function(int count);
 static const char* generate_string_equals_function(void);
 static const char* generate_array_push_function(DataType this_data_type, DataType value_data_type);
+static const char* generate_array_to_string_function(DataType this_data_type);
 
 static BinaryenExpressionRef generate_default_initialization(DataType data_type);
 static BinaryenExpressionRef generate_string_cast_function(DataType data_type,
@@ -68,7 +69,7 @@ static BinaryenType data_type_to_temporary_binaryen_type(TypeBuilderRef type_bui
                                                          ArrayTypeBuilderSubtype* subtypes,
                                                          DataType data_type);
 
-static struct
+static THREAD_LOCAL struct
 {
   ArrayStmt statements;
 
@@ -77,6 +78,7 @@ static struct
   ArrayBinaryenType global_local_types;
   MapStringBinaryenHeapType heap_types;
   BinaryenHeapType string_heap_type;
+  BinaryenHeapType string_builder_heap_type;
   BinaryenType string_type;
   MapSInt string_constants;
   ArrayDebugInfo debug_info;
@@ -102,6 +104,19 @@ static const char* get_function_member(DataType data_type, const char* name)
   return function->name.lexeme;
 }
 
+// String builders are represented as a subtype of "char[]", so that they share its functions but
+// can still be told apart from it in values of type "any".
+static DataType string_builder_data_type(void)
+{
+  DataType data_type = DATA_TYPE(TYPE_ARRAY);
+  data_type.array.data_type = ALLOC(DataType);
+  data_type.array.count = ALLOC(unsigned char);
+  *data_type.array.data_type = DATA_TYPE(TYPE_CHAR);
+  *data_type.array.count = 1;
+
+  return data_type;
+}
+
 static void generate_debug_info(Token token, BinaryenExpressionRef expression, const char* function)
 {
   DebugInfo debug_info = { .expression = expression, .token = token, .function = function };
@@ -2136,6 +2151,10 @@ static BinaryenExpressionRef generate_string_cast_function(DataType data_type,
                         codegen.string_type);
   case TYPE_CHAR:
     return BinaryenArrayNewFixed(codegen.module, codegen.string_heap_type, &value, 1);
+  case TYPE_STRING_BUILDER:
+    return BinaryenCall(codegen.module,
+                        generate_array_to_string_function(string_builder_data_type()), &value, 1,
+                        codegen.string_type);
   case TYPE_ARRAY:
     return BinaryenCall(codegen.module,
                         generate_string_array_cast_function(data_type, list_data_type),
@@ -2419,6 +2438,9 @@ static BinaryenHeapType generate_array_heap_binaryen_type(TypeBuilderRef type_bu
     TypeBuilderSetStructType(type_builder, offset + 1, field_types, field_packed_types,
                              field_mutables, sizeof(field_types) / sizeof_ptr(field_types));
 
+    if (equal_data_type(data_type, string_builder_data_type()))
+      TypeBuilderSetOpen(type_builder, offset + 1);
+
     if (type_builder_ref)
     {
       TypeBuilderSubtype subtype = { .type = SUBTYPE_ARRAY, .index = offset + 1, .key = key };
@@ -2440,6 +2462,28 @@ static BinaryenHeapType generate_array_heap_binaryen_type(TypeBuilderRef type_bu
   return array_binaryen_type;
 }
 
+static BinaryenHeapType generate_string_builder_heap_binaryen_type(void)
+{
+  BinaryenHeapType array_heap_type =
+    generate_array_heap_binaryen_type(NULL, NULL, string_builder_data_type());
+
+  BinaryenType field_types[] = { BinaryenStructTypeGetFieldType(array_heap_type, 0),
+                                 BinaryenTypeInt32() };
+  BinaryenPackedType field_packed_types[] = { BinaryenPackedTypeNotPacked(),
+                                              BinaryenPackedTypeNotPacked() };
+  bool field_mutables[] = { true, true };
+
+  TypeBuilderRef type_builder = TypeBuilderCreate(1);
+  TypeBuilderSetStructType(type_builder, 0, field_types, field_packed_types, field_mutables,
+                           sizeof(field_types) / sizeof_ptr(field_types));
+  TypeBuilderSetSubType(type_builder, 0, array_heap_type);
+
+  BinaryenHeapType heap_type;
+  TypeBuilderBuildAndDispose(type_builder, &heap_type, 0, 0);
+
+  return heap_type;
+}
+
 static BinaryenHeapType generate_function_heap_binaryen_type(TypeBuilderRef type_builder_ref,
                                                              ArrayTypeBuilderSubtype* subtypes,
                                                              DataType data_type)
@@ -2550,6 +2594,8 @@ static BinaryenType data_type_to_binaryen_type(DataType data_type)
     return data_type.class->ref;
   case TYPE_ARRAY:
     return BinaryenTypeFromHeapType(generate_array_heap_binaryen_type(NULL, NULL, data_type), true);
+  case TYPE_STRING_BUILDER:
+    return BinaryenTypeFromHeapType(codegen.string_builder_heap_type, true);
   default:
     UNREACHABLE("Unhandled data type");
   }
@@ -2635,6 +2681,8 @@ static BinaryenExpressionRef generate_default_initialization(DataType data_type)
   case TYPE_ARRAY:
     return BinaryenStructNew(codegen.module, NULL, 0,
                              generate_array_heap_binaryen_type(NULL, NULL, data_type));
+  case TYPE_STRING_BUILDER:
+    return BinaryenStructNew(codegen.module, NULL, 0, codegen.string_builder_heap_type);
   default:
     UNREACHABLE("Unexpected default initializer");
   }
@@ -3326,6 +3374,45 @@ static const char* generate_string_to_array_function(DataType return_data_type)
 #undef CONSTANT
 }
 
+static const char* generate_string_builder_append_function(DataType value_data_type)
+{
+#define THIS() (BinaryenLocalGet(codegen.module, 0, this_type))
+#define VALUE() (BinaryenLocalGet(codegen.module, 1, value_type))
+
+  DataType this_data_type = string_builder_data_type();
+
+  BinaryenType this_type = data_type_to_binaryen_type(this_data_type);
+  BinaryenType value_type = data_type_to_binaryen_type(value_data_type);
+
+  const char* name =
+    memory_sprintf("string_builder.append.%s", data_type_to_string(value_data_type));
+
+  if (!BinaryenGetFunction(codegen.module, name))
+  {
+    const char* push_string = generate_array_push_string_function(this_data_type);
+
+    BinaryenExpressionRef operands[] = {
+      THIS(),
+      generate_string_cast_function(value_data_type, this_data_type, VALUE(), NULL, NULL),
+    };
+
+    BinaryenExpressionRef body =
+      BinaryenCall(codegen.module, push_string, operands,
+                   sizeof(operands) / sizeof_ptr(operands), BinaryenTypeNone());
+
+    BinaryenType params_list[] = { this_type, value_type };
+    BinaryenType params =
+      BinaryenTypeCreate(params_list, sizeof(params_list) / sizeof_ptr(params_list));
+
+    BinaryenAddFunction(codegen.module, name, params, BinaryenTypeNone(), NULL, 0, body);
+  }
+
+  return name;
+
+#undef THIS
+#undef VALUE
+}
+
 static const char* generate_function_internal(DataType data_type)
 {
   assert(data_type.type == TYPE_FUNCTION_INTERNAL);
@@ -3379,6 +3466,18 @@ static const char* generate_function_internal(DataType data_type)
     return generate_string_join_function(array_at(&data_type.function_internal.parameter_types, 0));
   else if (strcmp(name, "string.to_array") == 0)
     return generate_string_to_array_function(*data_type.function_internal.return_type);
+  else if (strcmp(name, "string_builder.append_string") == 0)
+    return generate_array_push_string_function(string_builder_data_type());
+  else if (strcmp(name, "string_builder.append_char") == 0)
+    return generate_array_push_function(string_builder_data_type(), DATA_TYPE(TYPE_CHAR));
+  else if (strcmp(name, "string_builder.append_int") == 0 ||
+           strcmp(name, "string_builder.append_float") == 0)
+    return generate_string_builder_append_function(
+      array_at(&data_type.function_internal.parameter_types, 1));
+  else if (strcmp(name, "string_builder.to_string") == 0)
+    return generate_array_to_string_function(string_builder_data_type());
+  else if (strcmp(name, "string_builder.clear") == 0)
+    return generate_array_clear_function(string_builder_data_type());
   else
     UNREACHABLE("Unexpected internal function");
 }
@@ -3865,6 +3964,13 @@ static BinaryenExpressionRef generate_unary_expression(UnaryExpr* expression)
   }
 }
 
+// A "char[]" held in a value of type "any" can also be a string builder, which extends it.
+static BinaryenExpressionRef generate_string_builder_test(BinaryenExpressionRef ref)
+{
+  return BinaryenRefTest(codegen.module, BinaryenExpressionCopy(ref, codegen.module),
+                         BinaryenTypeFromHeapType(codegen.string_builder_heap_type, false));
+}
+
 static BinaryenExpressionRef generate_cast_expression(CastExpr* expression)
 {
   BinaryenExpressionRef value = generate_expression(expression->expr);
@@ -3882,6 +3988,7 @@ static BinaryenExpressionRef generate_cast_expression(CastExpr* expression)
     case TYPE_FLOAT:
     case TYPE_INTEGER:
     case TYPE_CHAR:
+    case TYPE_STRING_BUILDER:
     case TYPE_ARRAY:
     case TYPE_OBJECT:
     case TYPE_ALIAS:
@@ -3995,6 +4102,7 @@ static BinaryenExpressionRef generate_cast_expression(CastExpr* expression)
     {
     case TYPE_ARRAY:
     case TYPE_STRING:
+    case TYPE_STRING_BUILDER:
     case TYPE_OBJECT:
     case TYPE_NULL:
       return value;
@@ -4003,14 +4111,20 @@ static BinaryenExpressionRef generate_cast_expression(CastExpr* expression)
       break;
     }
   }
-  else if (expression->to_data_type.type == TYPE_ARRAY)
+  else if (expression->to_data_type.type == TYPE_ARRAY ||
+           expression->to_data_type.type == TYPE_STRING_BUILDER)
   {
     switch (expression->from_data_type.type)
     {
     case TYPE_ANY: {
+      BinaryenExpressionRef invalid = BinaryenRefIsNull(codegen.module, value);
+
+      if (equal_data_type(expression->to_data_type, string_builder_data_type()))
+        invalid = BinaryenBinary(codegen.module, BinaryenOrInt32(), invalid,
+                                 generate_string_builder_test(value));
+
       BinaryenExpressionRef result =
-        BinaryenIf(codegen.module, BinaryenRefIsNull(codegen.module, value),
-                   BinaryenUnreachable(codegen.module),
+        BinaryenIf(codegen.module, invalid, BinaryenUnreachable(codegen.module),
                    BinaryenRefCast(codegen.module, BinaryenExpressionCopy(value, codegen.module),
                                    data_type_to_binaryen_type(expression->to_data_type)));
 
@@ -4272,6 +4386,15 @@ static BinaryenExpressionRef generate_access_expression(AccessExpr* expression)
 
     UNREACHABLE("Unhandled array access name");
   }
+  else if (expression->expr_data_type.type == TYPE_STRING_BUILDER)
+  {
+    if (strcmp(expression->name.lexeme, "length") == 0)
+    {
+      return BinaryenStructGet(codegen.module, 1, ref, BinaryenTypeInt32(), false);
+    }
+
+    UNREACHABLE("Unhandled string builder access name");
+  }
   else
   {
     BinaryenType type = data_type_to_binaryen_type(expression->data_type);
@@ -4367,12 +4490,18 @@ static BinaryenExpressionRef generate_is_expression(IsExpr* expression)
 
   switch (expression->expr_data_type.type)
   {
-  case TYPE_ANY:
+  case TYPE_ANY: {
+    BinaryenExpressionRef test =
+      BinaryenRefTest(codegen.module, BinaryenExpressionCopy(ref, codegen.module),
+                      data_type_to_binaryen_type(expression->is_data_type));
+
+    if (equal_data_type(expression->is_data_type, string_builder_data_type()))
+      test = BinaryenSelect(codegen.module, generate_string_builder_test(ref),
+                            BinaryenConst(codegen.module, BinaryenLiteralInt32(0)), test);
+
     return BinaryenSelect(codegen.module, BinaryenRefIsNull(codegen.module, ref),
-                          BinaryenConst(codegen.module, BinaryenLiteralInt32(0)),
-                          BinaryenRefTest(codegen.module,
-                                          BinaryenExpressionCopy(ref, codegen.module),
-                                          data_type_to_binaryen_type(expression->is_data_type)));
+                          BinaryenConst(codegen.module, BinaryenLiteralInt32(0)), test);
+  }
   default:
     UNREACHABLE("Unexpected expression data type");
   }
@@ -4992,6 +5121,7 @@ int cyth_wasm_compile(int compile, int logging)
   codegen.string_type = BinaryenTypeFromHeapType(codegen.string_heap_type, false);
   map_init_sint(&codegen.string_constants, 0, 0);
   map_init_string_binaryen_heap_type(&codegen.heap_types, 0, 0);
+  codegen.string_builder_heap_type = generate_string_builder_heap_binaryen_type();
 
   BinaryenExpressionRef body = generate_statements(&codegen.statements);
 
@@ -64,6 +64,7 @@ typedef struct _DATA_TYPE
     TYPE_PROTOTYPE,
     TYPE_PROTOTYPE_TEMPLATE,
     TYPE_STRING,
+    TYPE_STRING_BUILDER,
     TYPE_ARRAY,
     TYPE_OBJECT,
   } type;
@@ -13,6 +13,9 @@ extern "C"
   typedef struct _CY_STRING
   {
     int size;
+    // The result of "hash()", or zero if it has not been computed yet. Code that changes the
+    // characters of a string after it was handed to Cyth must reset this to zero.
+    unsigned int hash;
     char data[];
   } CyString;
 
@@ -23,6 +26,95 @@ extern "C"
     void* data;
   } CyArray;
 
+  typedef struct _CY_COMPILE_PHASE
+  {
+    double time;
+    size_t memory;
+  } CyCompilePhase;
+
+  typedef struct _CY_FUNCTION_STATS
+  {
+    const char* name;
+    double time;
+    double emit_time;
+    size_t memory;
+    int instructions;
+    int code_size;
+  } CyFunctionStats;
+
+  typedef struct _CY_COMPILE_STATS
+  {
+    CyCompilePhase lex;
+    CyCompilePhase parse;
+    CyCompilePhase check;
+    CyCompilePhase emit;
+    CyCompilePhase generate;
+
+    int tokens;
+    int nodes;
+    int instructions;
+    int code_size;
+
+    int function_count;
+    const CyFunctionStats* functions;
+  } CyCompileStats;
+
+  typedef enum _CY_SYMBOL_TYPE
+  {
+    CY_SYMBOL_FUNCTION,
+    CY_SYMBOL_VARIABLE,
+  } CySymbolType;
+
+  typedef struct _CY_SYMBOL
+  {
+    const char* name;
+    CySymbolType type;
+    uintptr_t address;
+  } CySymbol;
+
+  typedef struct _CY_CALL CyCall;
+  typedef union _CY_VALUE
+  {
+    int64_t i;
+    float f;
+    void* p;
+  } CyValue;
+
+  typedef enum _CY_STATUS
+  {
+    CY_STATUS_OK,
+    CY_STATUS_PANIC,
+  } CyStatus;
+
+  typedef enum _CY_ALLOCATION_SITE
+  {
+    CY_ALLOCATION_OBJECT,
+    CY_ALLOCATION_ARRAY,
+    CY_ALLOCATION_STRING,
+    CY_ALLOCATION_HOST,
+    CY_ALLOCATION_SITE_COUNT,
+  } CyAllocationSite;
+
+  typedef struct _CY_ALLOCATION_STATS
+  {
+    size_t bytes;
+    size_t count;
+  } CyAllocationStats;
+
+  typedef struct _CY_HEAP_STATS
+  {
+    size_t bytes;
+    size_t count;
+    CyAllocationStats sites[CY_ALLOCATION_SITE_COUNT];
+  } CyHeapStats;
+
+  typedef struct _CY_JMP
+  {
+    jmp_buf buf;
+    CyVM* vm;
+    uintptr_t fp;
+  } CyJmp;
+
   // Creates a new VM instance.
   CyVM* cyth_init(void);
 
@@ -51,6 +143,139 @@ extern "C"
   // [logging] is 1, logging is enabled. When 0, logging is disabled.
   void cyth_set_logging(CyVM* vm, int logging);
 
+  // Enable/disable lazy compilation.
+  //
+  // You MUST call this before "cyth_compile".
+  //
+  // [lazy] is 1, functions are compiled to machine instructions the first time they are called.
+  // When 0 (the default), every function is compiled during "cyth_compile".
+  void cyth_set_lazy_compilation(CyVM* vm, int lazy);
+
+  // Enable/disable tiered compilation.
+  //
+  // You MUST call this before "cyth_compile".
+  //
+  // [threshold] is the number of calls and loop iterations after which a function is recompiled
+  // with full optimizations. Until then, functions are compiled with minimal optimizations the
+  // first time they are called. When 0 (the default), tiered compilation is disabled.
+  void cyth_set_tiered_compilation(CyVM* vm, int threshold);
+
+  // Sets the optimization level used to compile functions.
+  //
+  // You MUST call this before "cyth_compile".
+  //
+  // [level] is between 0 (fastest compilation) and 3 (the default, fastest code), other levels are
+  // clamped to this range. Functions annotated with "@optimize(level)" are always compiled at their
+  // own level. Tiered compilation has no effect below level 2.
+  void cyth_set_optimize_level(CyVM* vm, int level);
+
+  // Sets the number of threads used to compile functions.
+  //
+  // You MUST call this before "cyth_compile".
+  //
+  // [threads] is the number of worker threads that compile functions in parallel, each with its own
+  // code generator. All functions are compiled before "cyth_compile" returns. When 0 or 1 (the
+  // default), functions are compiled on the calling thread. Ignored when lazy or tiered compilation
+  // is enabled.
+  void cyth_set_compile_threads(CyVM* vm, int threads);
+
+  // Enable/disable incremental compilation.
+  //
+  // You MUST call this before "cyth_load_function" and "cyth_load_string".
+  //
+  // [incremental] is 1, the loaded strings and function signatures are kept after "cyth_compile" so
+  // that "cyth_update_string" can compile more code into the running program. Calls between Cyth
+  // functions always go through a jump that can be redirected, which makes them slightly slower.
+  // When 0 (the default), the program cannot be changed after "cyth_compile".
+  void cyth_set_incremental_compilation(CyVM* vm, int incremental);
+
+  // Limits how much code the VM runs before panicking with "Execution budget exceeded".
+  //
+  // The checks are only generated when this is called before "cyth_compile". Afterwards, calling
+  // it refills the budget and clears "cyth_interrupt", while no code is running in the VM.
+  //
+  // [budget] is the number of function calls and loop iterations the VM can run. When 0, the budget
+  // is unlimited but the VM can still be interrupted.
+  void cyth_set_execution_budget(CyVM* vm, int64_t budget);
+
+  // Makes the code running in the VM panic with "Execution interrupted" at its next function call
+  // or loop iteration, until "cyth_set_execution_budget" is called again.
+  //
+  // This can be called from any thread, but only has an effect when "cyth_set_execution_budget" was
+  // called before "cyth_compile".
+  void cyth_interrupt(CyVM* vm);
+
+  // Enable/disable cloning.
+  //
+  // You MUST call this before "cyth_compile".
+  //
+  // [cloning] is 1, the compiled program is kept in memory so that "cyth_clone" can create VMs
+  // running it without compiling it again. When 0 (the default), "cyth_clone" returns NULL.
+  void cyth_set_cloning(CyVM* vm, int cloning);
+
+  // Creates a new VM running the same program as [vm], whose global variables start as copies of
+  // the ones in [vm] and of everything reachable from them, so that "cyth_run" is not needed.
+  //
+  // You MUST call this after "cyth_run", while no code is running in [vm]. Several threads can
+  // clone the same VM at once.
+  //
+  // The new VM has the same options, functions and callbacks as [vm], except that its execution
+  // budget and heap limit are unlimited. Strings, arrays and objects are copied rather than shared,
+  // so changes made by either VM are not seen by the other. Values are copied by their types, so
+  // only strings, arrays, objects, values of type "any" and function pointers are followed.
+  //
+  // This function will return the new VM, or NULL, if cloning was not enabled before "cyth_compile"
+  // or the VM uses incremental compilation.
+  CyVM* cyth_clone(CyVM* vm);
+
+  // Limits how much memory the VM allocates before panicking with "Heap limit exceeded".
+  //
+  // VMs share one garbage collected heap, so the limit applies to the bytes allocated since this
+  // was last called rather than to the bytes that are still reachable. Calling it again starts a
+  // new count, which lets a long running program be given a fresh allowance between calls.
+  //
+  // [limit] is the number of bytes the VM can allocate. When 0 (the default), it is unlimited.
+  void cyth_set_heap_limit(CyVM* vm, size_t limit);
+
+  // Gets the number of bytes and allocations made by the VM since "cyth_init".
+  //
+  // [stats->sites] splits them into class constructors, array literals and growth, strings built
+  // by concatenation, casts and string methods, and "cyth_alloc" calls made by host functions
+  // while the VM is running.
+  void cyth_get_heap_stats(CyVM* vm, CyHeapStats* stats);
+
+  // Sets the directory used to cache compiled programs.
+  //
+  // You MUST call this before "cyth_load_function" and "cyth_load_string".
+  //
+  // [path] is a directory that already exists. Compiled programs are stored there keyed by a hash of
+  // the loaded strings and function signatures, and later VMs loading the same program skip
+  // straight to code generation. Loaded strings are only parsed in "cyth_compile", so syntax errors
+  // are reported there. When NULL (the default), caching is disabled.
+  void cyth_set_cache_directory(CyVM* vm, const char* path);
+
+  // Gets statistics about the compilation of the program.
+  //
+  // You MUST call this after "cyth_compile".
+  //
+  // [stats] is filled with the wall time in seconds and the compiler memory in bytes spent in each
+  // phase (lexing, parsing, type checking, emitting MIR instructions and generating machine
+  // instructions), the number of tokens, syntax tree nodes and MIR instructions, and the size in
+  // bytes of the machine instructions generated so far.
+  //
+  // [stats->functions] has one entry per function with the same numbers. Its "time" is spent
+  // generating machine instructions during "cyth_compile" (functions compiled lazily report 0), its
+  // "emit_time" and "memory" are spent emitting MIR instructions (functions read from a cache or a
+  // compiled file report 0). It is owned by the VM and valid until "cyth_destroy".
+  //
+  // After "cyth_update_string", the statistics only describe the most recent update.
+  void cyth_get_compile_stats(CyVM* vm, CyCompileStats* stats);
+
+  // Returns the number of functions that have been compiled to machine instructions so far.
+  //
+  // With lazy compilation enabled, this only counts functions that have been called at least once.
+  int cyth_get_generated_function_count(CyVM* vm);
+
   // Loads a string to compile.
   //
   // You MUST call this after "cyth_init" but before "cyth_compile".
@@ -71,6 +296,19 @@ extern "C"
   // or return 0, if an error has occurred (which will also call the error callback).
   int cyth_load_file(CyVM* vm, const char* filename);
 
+  // Loads a file written by "cyth_compile_to_file".
+  //
+  // You MUST call this after "cyth_load_function" but before "cyth_compile", and instead of
+  // "cyth_load_string" and "cyth_load_file". The same functions must be loaded with
+  // "cyth_load_function", in the same order, as when the file was written.
+  //
+  // [filename] is the path to the compiled file.
+  //
+  // This function will return 1 if the file was successfully loaded,
+  // or return 0, if the file could not be read, is damaged or was written for different functions.
+  // When a damaged file gets past the checks done before reading it, "cyth_compile" fails too.
+  int cyth_load_compiled_file(CyVM* vm, const char* filename);
+
   // Loads an external C function to compile.
   //
   // You MUST call this after "cyth_init" but before "cyth_compile".
@@ -91,6 +329,15 @@ extern "C"
   //
   // [func] must be the address to the external C function.
   //
+  // If the function has no side effects and always returns the same result for the same
+  // arguments, you can prefix the signature with the "@pure" annotation:
+  //
+  //    cyth_load_function(vm, "@pure\nint hash(int value)", (uintptr_t)hash);
+  //
+  // Calls to a pure function whose arguments do not change inside a loop are made once before
+  // the loop, and repeated calls with the same arguments share the result. A pure function may
+  // therefore be called even if the loop body never runs, so it must be safe to call at any time.
+  //
   // This function will return 1 if the function was successfully loaded,
   // or return 0, if an error has occurred (which will also call the error callback).
   int cyth_load_function(CyVM* vm, const char* signature, uintptr_t func);
@@ -103,6 +350,38 @@ extern "C"
   // or return 0, if an error has occurred (which will also call the error callback).
   int cyth_compile(CyVM* vm);
 
+  // Compiles the Cyth source code and writes it to a file instead of preparing it to run.
+  //
+  // [filename] is the path of the compiled file, which can later be loaded with
+  // "cyth_load_compiled_file" without parsing or type checking the source code again.
+  //
+  // This function will return 1 if the program was successfully compiled and written,
+  // or return 0, if an error has occurred (which will also call the error callback).
+  int cyth_compile_to_file(CyVM* vm, const char* filename);
+
+  // Compiles more source code into a program that has already been compiled.
+  //
+  // You MUST call "cyth_set_incremental_compilation" before loading the program, and call this
+  // after "cyth_compile".
+  //
+  // [string] is checked together with the program loaded so far (including earlier updates), so it
+  // can use the existing functions, classes and global variables, and declare new ones. A global
+  // function declared with the same name, parameter types and return type as an existing one
+  // replaces it: already compiled code, and addresses returned by "cyth_get_function", call the new
+  // version from then on. Classes and global variables cannot be redeclared.
+  //
+  // Only the functions declared in [string] (and templates it instantiates for the first time) are
+  // compiled, as a separate module linked against the program. Existing global variables and
+  // objects keep their values. The top-level scope of [string] is run by the next "cyth_run", which
+  // no longer runs the top-level scope of the program.
+  //
+  // Note: functions that are running during the update finish with their old version.
+  //
+  // This function will return 1 if the string was successfully compiled,
+  // or return 0, if an error has occurred (which will also call the error callback), in which case
+  // the program is left unchanged.
+  int cyth_update_string(CyVM* vm, char* string);
+
   // Runs the top-level scope of the program (which is called the <start> function).
   //
   // Note: calling Cyth code is not thread safe.
@@ -132,8 +411,32 @@ extern "C"
   // If you're confused, just pass 0 always.
   //
   // [size] is the size in bytes to allocate.
+  //
+  // The memory is always cleared. A string allocated with this only needs its "size" and "data"
+  // set, as a "hash" of zero means it has not been computed yet.
   void* cyth_alloc(int atomic, uintptr_t size);
 
+  // Allocates a string for the host to write [size] characters into, which saves copying data that
+  // can be read straight into it, like the contents of a file.
+  //
+  // The characters are uninitialized and followed by a null terminator. The same rules as for
+  // "cyth_alloc" apply to the returned pointer.
+  CyString* cyth_alloc_string(int size);
+
+  // Creates an array whose elements stay in a buffer owned by the host, instead of being copied
+  // into memory managed by the garbage collector.
+  //
+  // [data] holds [size] elements of [element_size] bytes each. They MUST NOT be strings, arrays or
+  // objects, as the garbage collector does not look for references in the buffer.
+  //
+  // [release] is called with [data] and [context] after the array is garbage collected, possibly on
+  // another thread that uses Cyth, and the buffer MUST stay valid until then. It can be NULL.
+  //
+  // Growing the array past [size] elements moves them into memory managed by the garbage
+  // collector. The same rules as for "cyth_alloc" apply to the returned pointer.
+  CyArray* cyth_external_array(void* data, int size, uintptr_t element_size,
+                               void (*release)(void* data, void* context), void* context);
+
   // Returns the address to a Cyth function.
   //
   // You MUST wrap all calls to Cyth functions with "cyth_try_catch" (see below).
@@ -178,12 +481,60 @@ extern "C"
   //
   uintptr_t cyth_get_variable(CyVM* vm, const char* name);
 
+  // Gets every function and global variable declared by the program.
+  //
+  // You MUST call this after "cyth_compile".
+  //
+  // [count] is set to the number of symbols. Each symbol has the name that "cyth_get_function" or
+  // "cyth_get_variable" expects, and the address that they return for it. The returned array is
+  // owned by the VM and valid until the next "cyth_update_string" or "cyth_destroy".
+  const CySymbol* cyth_get_symbols(CyVM* vm, int* count);
+
+  // Returns a handle to call a Cyth function without "cyth_try_catch", or NULL if there is no such
+  // function.
+  //
+  // You MUST call "cyth_run" before calling the function, otherwise global variables will be
+  // uninitialized.
+  //
+  // [name] must be in the same format as for "cyth_get_function". The handle is owned by the VM and
+  // valid until "cyth_destroy", getting the same function again returns the same handle.
+  CyCall* cyth_get_call(CyVM* vm, const char* name);
+
+  // Calls the function of a handle and returns whether it panicked instead of jumping.
+  //
+  // [arguments] holds one value for each parameter of the function. An int, bool or char is passed
+  // in "i", a float in "f" and anything else in "p".
+  //
+  // [result] is set to the returned value, unless the function returns void. It can be NULL.
+  //
+  //    CyCall* adder = cyth_get_call(vm, "adder.int(int, int)");
+  //
+  //    CyValue arguments[] = { { .i = 10 }, { .i = 10 } };
+  //    CyValue result;
+  //
+  //    if (cyth_call(adder, arguments, &result) != CY_STATUS_OK)
+  //      printf("error!");
+  //
+  CyStatus cyth_call(CyCall* call, const CyValue* arguments, CyValue* result);
+
+  // Calls the function of a handle once for each of [count] argument lists, catching panics once
+  // for all of them rather than for every call.
+  //
+  // [arguments] holds the argument lists one after another, and [results] gets one value for each
+  // call. [results] can be NULL.
+  //
+  // [completed] is set to the number of calls that returned, so a panic happened in the call after
+  // them. It can be NULL.
+  CyStatus cyth_call_batch(CyCall* call, const CyValue* arguments, CyValue* results, int count,
+                           int* completed);
+
   // Executes a block of code and catches any runtime panics.
   //
-  // This macro installs a temporary exception handler using setjmp/longjmp and signals (VEH on
-  // Windows). If a runtime error (panic) occurs while executing the block, control flow will
-  // jump to the "else" clause instead of terminating the program. The "else" clause is optional.
-  // This can be used recursively.
+  // This macro sets up a jump target using setjmp/longjmp for the signal handlers (VEH on Windows)
+  // that the VM installs once per process. If a runtime error (panic) occurs while executing the
+  // block, control flow will jump to the "else" clause instead of terminating the program. The
+  // "else" clause is optional. This can be used recursively, with different VMs, and on several
+  // threads at once. Entering and leaving the block makes no system calls.
   //
   // You MUST use this whenever calling generated code, otherwise the program will crash or get into
   // a corrupted state.
@@ -203,10 +554,10 @@ extern "C"
     void* cyth_push_jmp(CyVM* vm, void* new_jmp);                                                  \
     void cyth_pop_jmp(CyVM* vm, void* old_jmp);                                                    \
                                                                                                    \
-    jmp_buf _new;                                                                                  \
-    jmp_buf* _old = (jmp_buf*)cyth_push_jmp((_vm), (void*)&_new);                                  \
+    CyJmp _new;                                                                                    \
+    CyJmp* _old = (CyJmp*)cyth_push_jmp((_vm), (void*)&_new);                                      \
                                                                                                    \
-    if (cyth_setjmp(_new) == 0)                                                                    \
+    if (cyth_setjmp(_new.buf) == 0)                                                                \
       _block                                                                                       \
                                                                                                    \
         cyth_pop_jmp((_vm), (void*)_old);                                                          \
@@ -217,6 +568,7 @@ extern "C"
   static struct                                                                                    \
   {                                                                                                \
     int size;                                                                                      \
+    unsigned int hash;                                                                             \
     char data[sizeof(value)];                                                                      \
   } name = { .size = sizeof(value) - 1, .data = value }
 
@@ -224,7 +576,7 @@ extern "C"
   int cyth_setjmp(jmp_buf buf);
   void cyth_longjmp(jmp_buf buf, int n);
 #else
-#define cyth_setjmp(buf) sigsetjmp(buf, 1)
+#define cyth_setjmp(buf) sigsetjmp(buf, 0)
 #define cyth_longjmp siglongjmp
 #endif
 #endif
@@ -1,3 +1,7 @@
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
 #include "array.h"
 #include "checker.h"
 #include "expression.h"
@@ -11,16 +15,21 @@
 
 #include <ctype.h>
 #include <gc.h>
+#include <gc/gc_inline.h>
+#include <gc/gc_mark.h>
 #include <mir-gen.h>
 #include <mir.h>
 
 #ifdef _WIN32
 #include <Windows.h>
 #include <math.h>
+#include <process.h>
+#define getpid _getpid
 #else
-#define __USE_GNU
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #if defined(__linux__)
 #include <ucontext.h>
@@ -35,6 +44,8 @@ array_def(MIR_op_t, MIR_op_t);
 array_def(MIR_reg_t, MIR_reg_t);
 array_def(MIR_item_t, MIR_item_t);
 
+#define MODULE_MAGIC 0x3930434d48545943ULL
+
 typedef void (*Start)(void);
 typedef struct _FUNCTION
 {
@@ -42,23 +53,182 @@ typedef struct _FUNCTION
   MIR_item_t proto;
 } Function;
 
+typedef struct _SOURCE
+{
+  char* string;
+  uintptr_t import;
+} Source;
+
+typedef struct _MODULE_DATA
+{
+  uint8_t* data;
+  size_t size;
+  size_t capacity;
+  size_t position;
+} ModuleData;
+
+typedef struct _EXTERNAL_BUFFER
+{
+  void* data;
+  size_t size;
+  void (*release)(void* data, void* context);
+  void* context;
+  struct _EXTERNAL_BUFFER* next;
+} ExternalBuffer;
+
+typedef struct _ADDRESS_PAIR
+{
+  uintptr_t from;
+  uintptr_t to;
+} AddressPair;
+
+typedef struct _LAYOUT_FIELD
+{
+  int offset;
+  int layout;
+} LayoutField;
+
+array_def(LayoutField, LayoutField);
+
+// Describes where the references are in a value, so that "cyth_clone" copies exactly those. Types
+// without references have no layout, which is written as -1.
+typedef struct _LAYOUT
+{
+  enum
+  {
+    LAYOUT_STRING,
+    LAYOUT_ARRAY,
+    LAYOUT_OBJECT,
+    LAYOUT_ANY,
+    LAYOUT_FUNCTION,
+  } kind;
+
+  int element;
+  ArrayLayoutField fields;
+} Layout;
+
+array_def(Layout, Layout);
+
+typedef struct _PENDING_OBJECT
+{
+  uintptr_t address;
+  int layout;
+} PendingObject;
+
+typedef struct _HEAP_COPY
+{
+  CyVM* source;
+  AddressPair* objects;
+  uint32_t object_capacity;
+  uint32_t object_count;
+  PendingObject* pending;
+  uint32_t pending_capacity;
+  uint32_t pending_count;
+  AddressPair* items;
+  int item_count;
+} HeapCopy;
+
+typedef void (*Trampoline)(uintptr_t address, MIR_val_t* values);
+struct _CY_CALL
+{
+  CyVM* vm;
+  uintptr_t address;
+  Trampoline trampoline;
+  int argument_count;
+  int result_count;
+};
+
+typedef struct _SYMBOL_ENTRY
+{
+  const char* name;
+  MIR_item_t item;
+  uintptr_t address;
+  int symbol;
+  int layout;
+  CyCall* call;
+} SymbolEntry;
+
+typedef struct _FUNCTION_EMIT
+{
+  double time;
+  size_t memory;
+} FunctionEmit;
+
+typedef struct _HOISTED_CALL
+{
+  CallExpr* expression;
+  MIR_reg_t reg;
+} HoistedCall;
+
+array_def(HoistedCall, HoistedCall);
+
+typedef struct _STRING_APPEND
+{
+  VarStmt* variable;
+  MIR_reg_t owner;
+} StringAppend;
+
+array_def(StringAppend, StringAppend);
+
+typedef struct _LOOP
+{
+  WhileStmt* statement;
+  MIR_item_t function;
+  MIR_label_t label;
+  ArrayHoistedCall calls;
+  VarStmt* counter;
+  VarStmt* bound;
+  ArrayStringAppend appends;
+  struct _LOOP* parent;
+} Loop;
+
+typedef struct _CODE_LINE
+{
+  uintptr_t start;
+  uintptr_t end;
+  int line;
+  int column;
+} CodeLine;
+
+typedef struct _CODE_RANGE
+{
+  uintptr_t start;
+  uintptr_t end;
+  const char* function;
+  CodeLine* lines;
+  int line_count;
+} CodeRange;
+
 struct _CY_VM
 {
-  jmp_buf* jmp;
+  Memory* memory;
+  struct MIR_alloc alloc;
   MIR_context_t ctx;
   MIR_module_t module;
   MIR_item_t function;
+  MIR_item_t start_function;
   MIR_label_t continue_label;
   MIR_label_t break_label;
+  Loop* loop;
   Start start;
 
   ArrayStmt statements;
   MapS64 typeids;
   MapMIR_item string_constants;
   MapMIR_item items;
+  MapMIR_item tier_counters;
+  MapMIR_item panic_messages;
   MapFunction functions;
+  MapMIR_item definitions;
+  MapSInt replacements;
+  MapSInt exports;
+  MapSInt layout_names;
+  MapSInt global_layouts;
+  MapSv function_emits;
+  MIR_item_t vm_data;
 
   Function panic;
+  Function tier_up;
   Function malloc;
   Function malloc_atomic;
   Function realloc;
@@ -71,6 +241,44 @@ struct _CY_VM
   Function string_char_cast;
 
   int logging;
+  int lazy;
+  int tier_threshold;
+  int compile_threads;
+  int optimize_level;
+  int incremental;
+  int budgeted;
+  int64_t budget;
+  volatile int64_t budget_floor;
+  size_t heap_ceiling;
+  CyHeapStats heap_stats;
+  int cloning;
+  ModuleData module_data;
+  uintptr_t* imports;
+  int import_count;
+  Source* sources;
+  int source_count;
+  char** typeid_names;
+  int typeid_count;
+  // Outlives the compiler memory, which is reset after every compilation.
+  Memory* symbol_memory;
+  MapSymbolEntry symbol_table;
+  ArrayLayout layouts;
+  ArrayInt typeid_layouts;
+  CySymbol* symbols;
+  int symbol_count;
+  CodeRange* code_ranges;
+  int code_range_count;
+  int code_range_capacity;
+  char* cache_directory;
+  uint64_t cache_key;
+  uint64_t import_key;
+  int precompiled;
+  int unreadable;
+  ArrayStr cache_sources;
+  CyCompileStats stats;
+  CyFunctionStats* function_stats;
+  double phase_time;
+  size_t phase_memory;
   void (*error_callback)(int start_line, int start_column, int end_line, int end_column,
                          const char* message);
   void (*panic_callback)(const char* function, int line, int column);
@@ -85,38 +293,157 @@ static void generate_statements(CyVM* vm, ArrayStmt* statements);
 static void init_statement(CyVM* vm, Stmt* statement);
 static void init_statements(CyVM* vm, ArrayStmt* statements);
 static void init_function_declaration(CyVM* vm, FuncStmt* statement);
+static void init_process(void);
+static void init_thread(void);
+static double compile_time(void);
 
-uintptr_t panic_fp;
-CyVM* panic_vm;
+static THREAD_LOCAL CyJmp* panic_jmp;
 
-static void panic(CyVM* vm, const char* what, uintptr_t pc, uintptr_t fp)
+// Panics run inside signal handlers where nothing can be allocated, so the range of a function is
+// added as soon as its machine code is generated. Code that was replaced keeps its range, as frames
+// that are still running it can show up in a stack trace.
+static void add_code_range(CyVM* vm, MIR_item_t item)
 {
-  if (vm->panic_callback)
-    vm->panic_callback(what, 0, 0);
+  MIR_func_t func = item->u.func;
+  uintptr_t start = (uintptr_t)func->machine_code;
 
-  for (MIR_item_t item = DLIST_TAIL(MIR_item_t, vm->module->items); item != NULL;
-       item = DLIST_PREV(MIR_item_t, item))
+  int low = 0;
+  int high = vm->code_range_count;
+
+  while (low < high)
   {
-    if (item->item_type != MIR_func_item)
+    int middle = low + (high - low) / 2;
+
+    if (vm->code_ranges[middle].start < start)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  if (low < vm->code_range_count && vm->code_ranges[low].start == start)
+    return;
+
+  CodeRange range = {
+    .start = start,
+    .end = start,
+    .function = func->name,
+    .lines = malloc(DLIST_LENGTH(MIR_insn_t, func->insns) * sizeof(CodeLine)),
+    .line_count = 0,
+  };
+
+  for (MIR_insn_t insn = DLIST_HEAD(MIR_insn_t, func->insns); insn != NULL;
+       insn = DLIST_NEXT(MIR_insn_t, insn))
+  {
+    if (insn->size && insn->line && insn->column)
+      range.lines[range.line_count++] = (CodeLine){ .start = range.end,
+                                                    .end = range.end + insn->size,
+                                                    .line = insn->line,
+                                                    .column = insn->column };
+
+    range.end += insn->size;
+  }
+
+  if (vm->code_range_count == vm->code_range_capacity)
+  {
+    vm->code_range_capacity = vm->code_range_capacity ? vm->code_range_capacity * 2 : 64;
+    vm->code_ranges = realloc(vm->code_ranges, vm->code_range_capacity * sizeof(CodeRange));
+  }
+
+  memmove(&vm->code_ranges[low + 1], &vm->code_ranges[low],
+          (vm->code_range_count - low) * sizeof(CodeRange));
+
+  vm->code_ranges[low] = range;
+  vm->code_range_count++;
+}
+
+static void generate_code_ranges(CyVM* vm)
+{
+  for (MIR_module_t module = DLIST_HEAD(MIR_module_t, *MIR_get_module_list(vm->ctx));
+       module != NULL; module = DLIST_NEXT(MIR_module_t, module))
+  {
+    for (MIR_item_t item = DLIST_HEAD(MIR_item_t, module->items); item != NULL;
+         item = DLIST_NEXT(MIR_item_t, item))
+    {
+      if (item->item_type == MIR_func_item && item->u.func->machine_code)
+        add_code_range(vm, item);
+    }
+  }
+}
+
+// Functions compiled on their first call find their VM through the allocator of its context.
+static void* generate_lazy_function(MIR_context_t ctx, MIR_item_t item)
+{
+  MIR_gen(ctx, item);
+  add_code_range(MIR_get_alloc(ctx)->user_data, item);
+
+  return item->u.func->machine_code;
+}
+
+static void set_lazy_gen_interface(MIR_context_t ctx, MIR_item_t item)
+{
+  if (item == NULL)
+    return;
+
+  void* wrapper = _MIR_get_wrapper(ctx, item, (void*)(uintptr_t)generate_lazy_function);
+  _MIR_redirect_thunk(ctx, item->addr, wrapper);
+}
+
+static CodeLine* get_code_line(CyVM* vm, uintptr_t pc, const char** function)
+{
+  int low = 0;
+  int high = vm->code_range_count - 1;
+
+  while (low <= high)
+  {
+    int middle = low + (high - low) / 2;
+    CodeRange* range = &vm->code_ranges[middle];
+
+    if (pc < range->start)
+    {
+      high = middle - 1;
+      continue;
+    }
+
+    if (pc >= range->end)
+    {
+      low = middle + 1;
       continue;
+    }
 
-    uintptr_t offset = 0;
+    *function = range->function;
+    low = 0;
+    high = range->line_count - 1;
 
-    for (MIR_insn_t insn = DLIST_HEAD(MIR_insn_t, item->u.func->insns); insn != NULL;
-         insn = DLIST_NEXT(MIR_insn_t, insn))
+    while (low <= high)
     {
-      uintptr_t ptr = (uintptr_t)item->u.func->machine_code + offset;
-      if (pc >= ptr && pc < ptr + insn->size)
-      {
-        if (insn->line && insn->column)
-          if (vm->panic_callback)
-            vm->panic_callback(item->u.func->name, insn->line, insn->column);
-      }
+      int middle = low + (high - low) / 2;
+      CodeLine* line = &range->lines[middle];
 
-      offset += insn->size;
+      if (pc < line->start)
+        high = middle - 1;
+      else if (pc >= line->end)
+        low = middle + 1;
+      else
+        return line;
     }
+
+    return NULL;
   }
 
+  return NULL;
+}
+
+static void panic(CyVM* vm, const char* what, uintptr_t pc, uintptr_t fp)
+{
+  if (vm->panic_callback)
+    vm->panic_callback(what, 0, 0);
+
+  const char* function;
+  CodeLine* line = get_code_line(vm, pc, &function);
+
+  if (line && vm->panic_callback)
+    vm->panic_callback(function, line->line, line->column);
+
   if (!fp)
   {
 #if defined(__clang__) || defined(__GNUC__)
@@ -128,51 +455,268 @@ static void panic(CyVM* vm, const char* what, uintptr_t pc, uintptr_t fp)
 
   uintptr_t panic_fp_min = (uintptr_t)alloca(sizeof(uintptr_t));
 
-  while (fp >= panic_fp_min && fp <= panic_fp)
+  while (panic_jmp && fp >= panic_fp_min && fp <= panic_jmp->fp)
   {
     uintptr_t pc = *(uintptr_t*)(fp + sizeof(uintptr_t));
 
-    for (MIR_item_t item = DLIST_TAIL(MIR_item_t, vm->module->items); item != NULL;
-         item = DLIST_PREV(MIR_item_t, item))
+    // A return address points just past the call instruction.
+    CodeLine* line = get_code_line(vm, pc - 1, &function);
+
+    if (line && vm->panic_callback)
+      vm->panic_callback(function, line->line, line->column);
+
+    fp = *(uintptr_t*)fp;
+  }
+
+  if (panic_jmp == NULL)
+  {
+    fprintf(stderr, "Panic was not caught, terminating program!\n");
+    exit(-1);
+  }
+
+  cyth_longjmp(panic_jmp->buf, 1);
+}
+
+static int tier_optimize_level(CyVM* vm)
+{
+  return vm->optimize_level < 1 ? vm->optimize_level : 1;
+}
+
+// Tiering only pays off when the promoted code is compiled at a higher level than the first tier,
+// otherwise functions are compiled once at the requested level.
+static int tier_threshold(CyVM* vm)
+{
+  return vm->optimize_level > 1 ? vm->tier_threshold : 0;
+}
+
+static bool is_tier_counter(MIR_insn_t insn)
+{
+  if (insn->code != MIR_MOV || insn->ops[1].mode != MIR_OP_REF)
+    return false;
+
+  MIR_item_t item = insn->ops[1].u.ref;
+  return item->item_type == MIR_data_item && item->u.data->name &&
+         strncmp(item->u.data->name, "counter.", sizeof("counter.") - 1) == 0;
+}
+
+static bool is_tier_up_call(MIR_insn_t insn)
+{
+  if (insn->code != MIR_CALL || insn->ops[1].mode != MIR_OP_REF)
+    return false;
+
+  MIR_item_t item = insn->ops[1].u.ref;
+  return item->item_type == MIR_import_item && strcmp(item->u.import_id, "tier_up") == 0;
+}
+
+// The instructions of a counter stay together from loading its address up to the call to
+// "tier_up", so the promoted code can leave each of them out and never count again.
+static void remove_tier_counters(CyVM* vm, MIR_item_t item)
+{
+  MIR_insn_t insn = DLIST_HEAD(MIR_insn_t, item->u.func->insns);
+  while (insn != NULL)
+  {
+    if (!is_tier_counter(insn))
     {
-      if (item->item_type != MIR_func_item)
-        continue;
+      insn = DLIST_NEXT(MIR_insn_t, insn);
+      continue;
+    }
 
-      uintptr_t offset = 0;
+    MIR_insn_t end = insn;
+    while (end != NULL && !is_tier_up_call(end))
+      end = DLIST_NEXT(MIR_insn_t, end);
 
-      for (MIR_insn_t insn = DLIST_HEAD(MIR_insn_t, item->u.func->insns); insn != NULL;
-           insn = DLIST_NEXT(MIR_insn_t, insn))
-      {
-        offset += insn->size;
+    if (end == NULL)
+      return;
 
-        uintptr_t ptr = (uintptr_t)item->u.func->machine_code + offset;
-        if (pc >= ptr && pc < ptr + insn->size)
-        {
-          if (insn->line && insn->column)
-            if (vm->panic_callback)
-              vm->panic_callback(item->u.func->name, insn->line, insn->column);
-        }
-      }
+    MIR_insn_t next = DLIST_NEXT(MIR_insn_t, end);
+    while (insn != next)
+    {
+      MIR_insn_t removed = insn;
+      insn = DLIST_NEXT(MIR_insn_t, insn);
+      MIR_remove_insn(vm->ctx, item, removed);
     }
+  }
+}
 
-    fp = *(uintptr_t*)fp;
+static void tier_up(CyVM* vm, void* function)
+{
+  MIR_module_t module = DLIST_TAIL(MIR_module_t, *MIR_get_module_list(vm->ctx));
+  MIR_item_t item = DLIST_HEAD(MIR_item_t, module->items);
+  while (item == NULL || item->item_type != MIR_func_item || item->addr != function)
+  {
+    if (item == NULL)
+    {
+      module = DLIST_PREV(MIR_module_t, module);
+      item = DLIST_HEAD(MIR_item_t, module->items);
+    }
+    else
+    {
+      item = DLIST_NEXT(MIR_item_t, item);
+    }
   }
 
-  if (vm->jmp == NULL)
+  MIR_func_t func = item->u.func;
+
+  // A module compiled with tier counters can be loaded by a VM that does not tier up.
+  if (!tier_threshold(vm) && func->machine_code)
+    return;
+
+  // A function replaced by "cyth_update_string" can still be running, its thunk now leads to the
+  // new version and must stay that way.
+  if (func->machine_code && _MIR_get_thunk_addr(vm->ctx, item->addr) != func->call_addr)
+    return;
+
+  if (func->machine_code)
   {
-    fprintf(stderr, "Panic was not caught, terminating program!\n");
-    exit(-1);
+    _MIR_restore_func_insns(vm->ctx, item);
+    func->machine_code = NULL;
+    func->call_addr = NULL;
+  }
+
+  remove_tier_counters(vm, item);
+
+  MIR_gen_set_optimize_level(vm->ctx, vm->optimize_level);
+  MIR_gen(vm->ctx, item);
+  MIR_gen_set_optimize_level(vm->ctx, tier_optimize_level(vm));
+
+  add_code_range(vm, item);
+}
+
+// Passes the location of the Cyth code that called the current function to "panic", so that the
+// runtime functions below do not need a frame of their own to be skipped over.
+#if defined(__clang__) || defined(__GNUC__)
+#define CALLER_LOCATION                                                                            \
+  (uintptr_t)__builtin_return_address(0) - 1, *(uintptr_t*)__builtin_frame_address(0)
+#else
+#define CALLER_LOCATION 0, 0
+#endif
+
+static void count_allocation(uintptr_t size, CyAllocationSite site, uintptr_t pc, uintptr_t fp)
+{
+  // Allocations are charged to the VM of the innermost "cyth_try_catch", which is the one running.
+  if (!panic_jmp)
+    return;
+
+  CyVM* vm = panic_jmp->vm;
+  vm->heap_stats.bytes += size;
+  vm->heap_stats.count++;
+  vm->heap_stats.sites[site].bytes += size;
+  vm->heap_stats.sites[site].count++;
+
+  if (vm->heap_stats.bytes > vm->heap_ceiling)
+    panic(vm, "Heap limit exceeded", pc, fp);
+}
+
+static void* allocate(uintptr_t size, CyAllocationSite site)
+{
+  count_allocation(size, site, CALLER_LOCATION);
+  return GC_malloc(size);
+}
+
+static void* allocate_atomic(uintptr_t size, CyAllocationSite site)
+{
+  count_allocation(size, site, CALLER_LOCATION);
+  return GC_malloc_atomic(size);
+}
+
+#define EXTERNAL_BUFFER_BUCKETS 1024
+
+static ExternalBuffer* external_buffers[EXTERNAL_BUFFER_BUCKETS];
+static volatile int external_buffer_count;
+
+#ifdef _WIN32
+static SRWLOCK external_buffer_lock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t external_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void lock_external_buffers(void)
+{
+#ifdef _WIN32
+  AcquireSRWLockExclusive(&external_buffer_lock);
+#else
+  pthread_mutex_lock(&external_buffer_lock);
+#endif
+}
+
+static void unlock_external_buffers(void)
+{
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(&external_buffer_lock);
+#else
+  pthread_mutex_unlock(&external_buffer_lock);
+#endif
+}
+
+static ExternalBuffer** find_external_buffer(const void* data)
+{
+  ExternalBuffer** buffer =
+    &external_buffers[((uintptr_t)data >> 4) & (EXTERNAL_BUFFER_BUCKETS - 1)];
+
+  while (*buffer && (*buffer)->data != data)
+    buffer = &(*buffer)->next;
+
+  return buffer;
+}
+
+static bool get_external_buffer_size(const void* data, size_t* size)
+{
+  if (!external_buffer_count)
+    return false;
+
+  lock_external_buffers();
+  ExternalBuffer* buffer = *find_external_buffer(data);
+  if (buffer)
+    *size = buffer->size;
+  unlock_external_buffers();
+
+  return buffer != NULL;
+}
+
+static void release_external_buffer(void* array, void* client_data)
+{
+  (void)array;
+  ExternalBuffer* buffer = client_data;
+
+  lock_external_buffers();
+  ExternalBuffer** link = find_external_buffer(buffer->data);
+  while (*link != buffer)
+    link = &(*link)->next;
+
+  *link = buffer->next;
+  external_buffer_count--;
+  unlock_external_buffers();
+
+  if (buffer->release)
+    buffer->release(buffer->data, buffer->context);
+
+  free(buffer);
+}
+
+static void* reallocate(void* ptr, uintptr_t size)
+{
+  count_allocation(size, CY_ALLOCATION_ARRAY, CALLER_LOCATION);
+
+  // The elements of arrays made by "cyth_external_array" move into collected memory once they
+  // outgrow the buffer of the host, which is only released together with the array.
+  size_t external_size;
+  if (ptr && !GC_base(ptr) && get_external_buffer_size(ptr, &external_size))
+  {
+    void* result = GC_malloc_atomic(size);
+    memcpy(result, ptr, external_size < size ? external_size : size);
+
+    return result;
   }
 
-  cyth_longjmp(*vm->jmp, 1);
+  return GC_realloc(ptr, size);
 }
 
 static void panic_callback(const char* function, int line, int column)
 {
-  static const char* previous_function;
-  static int previous_line;
-  static int previous_column;
-  static int previous_count;
+  static THREAD_LOCAL const char* previous_function;
+  static THREAD_LOCAL int previous_line;
+  static THREAD_LOCAL int previous_column;
+  static THREAD_LOCAL int previous_count;
 
   if (line && column)
   {
@@ -206,52 +750,104 @@ static void error_callback(int start_line, int start_column, int end_line, int e
           message);
 }
 
-static int string_equals(CyString* left, CyString* right)
-{
-  return left == right ||
-         (left->size == right->size && memcmp(left->data, right->data, left->size) == 0);
-}
-
-static CyString* string_int_cast(int n)
+static int string_hash(CyString* n)
 {
-  int length = snprintf(NULL, 0, "%d", n) + 1;
-  uintptr_t size = sizeof(CyString) + length;
+  if (n->hash)
+    return n->hash;
 
-  CyString* result = GC_malloc_atomic(size);
-  result->size = length - 1;
+  uint32_t hash = 0x811c9dc5;
 
-  snprintf(result->data, length, "%d", n);
+  for (int i = 0; i < n->size; i++)
+  {
+    hash ^= n->data[i];
+    hash *= 0x01000193;
+  }
 
-  return result;
+  n->hash = hash;
+  return hash;
 }
 
-static CyString* string_float_cast(float n)
+static int string_equals(CyString* left, CyString* right)
 {
-  int length = snprintf(NULL, 0, "%.10g", n) + 1;
-  uintptr_t size = sizeof(CyString) + length;
-
-  CyString* result = GC_malloc_atomic(size);
-  result->size = length - 1;
+  if (left == right)
+    return true;
 
-  snprintf(result->data, length, "%.10g", n);
+  if (left->size != right->size || (left->hash && right->hash && left->hash != right->hash))
+    return false;
 
-  return result;
+  return memcmp(left->data, right->data, left->size) == 0;
 }
 
-static CyString* string_char_cast(char n)
+// Writes the digits of [n] backwards, ending just before [end], and returns where they start.
+static char* format_int(char* end, int n)
 {
-  int length = snprintf(NULL, 0, "%c", n) + 1;
-  uintptr_t size = sizeof(CyString) + length;
+  unsigned int value = n < 0 ? 0U - (unsigned int)n : (unsigned int)n;
+  do
+  {
+    *--end = (char)('0' + value % 10);
+    value /= 10;
+  } while (value);
+
+  if (n < 0)
+    *--end = '-';
 
-  CyString* result = GC_malloc_atomic(size);
-  result->size = length - 1;
+  return end;
+}
 
-  snprintf(result->data, length, "%c", n);
+static CyString* copy_string(const char* data, int size)
+{
+  CyString* result = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
+  result->size = size;
+  result->hash = 0;
+  result->data[size] = '\0';
+  memcpy(result->data, data, size);
 
   return result;
 }
 
-static CyString* string_bool_cast(bool n)
+static CyString* string_int_cast(int n)
+{
+  char digits[16];
+  char* end = digits + sizeof(digits);
+  char* start = format_int(end, n);
+
+  return copy_string(start, end - start);
+}
+
+static CyString* string_float_cast(float n)
+{
+  // Whole numbers print the same as with "%.10g" up to ten digits, without going through printf.
+  if (n != 0 && n >= -1e9f && n <= 1e9f && n == (int)n)
+    return string_int_cast((int)n);
+
+  char buffer[32];
+  return copy_string(buffer, snprintf(buffer, sizeof(buffer), "%.10g", n));
+}
+
+// Every character has a string made once for the process, so converting one never allocates.
+static struct
+{
+  int size;
+  unsigned int hash;
+  char data[2];
+} char_strings[256];
+
+static void init_char_strings(void)
+{
+  for (int i = 0; i < 256; i++)
+  {
+    char_strings[i].size = 1;
+    char_strings[i].data[0] = (char)i;
+    string_hash((CyString*)&char_strings[i]);
+  }
+}
+
+static CyString* string_char_cast(char n)
+{
+  return (CyString*)&char_strings[(unsigned char)n];
+}
+
+static CyString* string_bool_cast(bool n)
 {
   cyth_static_string(true_string, "true");
   cyth_static_string(false_string, "false");
@@ -292,6 +888,7 @@ static bool data_type_is_pointer(DataType data_type)
     return false;
   case TYPE_ANY:
   case TYPE_STRING:
+  case TYPE_STRING_BUILDER:
   case TYPE_OBJECT:
   case TYPE_ARRAY:
     return true;
@@ -321,6 +918,7 @@ static MIR_type_t data_type_to_mir_type(DataType data_type)
   case TYPE_CHAR:
   case TYPE_INTEGER:
   case TYPE_STRING:
+  case TYPE_STRING_BUILDER:
   case TYPE_OBJECT:
   case TYPE_ARRAY:
     return MIR_T_I64;
@@ -349,6 +947,7 @@ static MIR_type_t data_type_to_sized_mir_type(DataType data_type)
   case TYPE_NULL:
   case TYPE_ANY:
   case TYPE_STRING:
+  case TYPE_STRING_BUILDER:
   case TYPE_OBJECT:
   case TYPE_ARRAY:
     return MIR_T_I64;
@@ -415,6 +1014,82 @@ static MIR_item_t data_type_to_proto(CyVM* vm, DataType data_type)
   return item;
 }
 
+static int data_type_to_layout(CyVM* vm, DataType data_type)
+{
+  Layout layout = { .element = -1 };
+
+  switch (data_type.type)
+  {
+  case TYPE_STRING:
+    layout.kind = LAYOUT_STRING;
+    break;
+  case TYPE_ARRAY:
+    layout.kind = LAYOUT_ARRAY;
+    break;
+  case TYPE_STRING_BUILDER:
+  case TYPE_OBJECT:
+    layout.kind = LAYOUT_OBJECT;
+    break;
+  case TYPE_ANY:
+    layout.kind = LAYOUT_ANY;
+    break;
+  case TYPE_FUNCTION_POINTER:
+    layout.kind = LAYOUT_FUNCTION;
+    break;
+  default:
+    return -1;
+  }
+
+  const char* name = data_type_to_string(data_type);
+  int index = map_get_sint(&vm->layout_names, name);
+  if (index)
+    return index - 1;
+
+  // The index is taken before the fields are visited, since a class can refer to itself.
+  index = vm->layouts.size;
+  map_put_sint(&vm->layout_names, name, index + 1);
+
+  Memory* memory = memory_use(vm->symbol_memory);
+  array_add(&vm->layouts, layout);
+  memory_use(memory);
+
+  ArrayLayoutField fields;
+  array_init(&fields);
+
+  if (data_type.type == TYPE_ARRAY)
+  {
+    int element = data_type_to_layout(vm, array_data_type_element(data_type));
+    vm->layouts.elems[index].element = element;
+  }
+  else if (data_type.type == TYPE_STRING_BUILDER)
+  {
+    // The data of a string builder is a string, which "toString" may have handed out as well.
+    int string_layout = data_type_to_layout(vm, DATA_TYPE(TYPE_STRING));
+    LayoutField field = { offsetof(CyArray, data), string_layout };
+
+    memory = memory_use(vm->symbol_memory);
+    array_add(&fields, field);
+    memory_use(memory);
+  }
+  else if (data_type.type == TYPE_OBJECT)
+  {
+    VarStmt* variable;
+    array_foreach(&data_type.class->variables, variable)
+    {
+      LayoutField field = { variable->offset, data_type_to_layout(vm, variable->data_type) };
+      if (field.layout == -1)
+        continue;
+
+      memory = memory_use(vm->symbol_memory);
+      array_add(&fields, field);
+      memory_use(memory);
+    }
+  }
+
+  vm->layouts.elems[index].fields = fields;
+  return index;
+}
+
 static uint64_t data_type_to_typeid(CyVM* vm, DataType data_type)
 {
   const char* name = data_type_to_string(data_type);
@@ -424,6 +1099,22 @@ static uint64_t data_type_to_typeid(CyVM* vm, DataType data_type)
   {
     id = map_size_s64(&vm->typeids) + 1;
     map_put_s64(&vm->typeids, name, id);
+
+    int layout = data_type_to_layout(vm, data_type);
+
+    Memory* memory = memory_use(vm->symbol_memory);
+    while (vm->typeid_layouts.size <= id)
+      array_add(&vm->typeid_layouts, -1);
+    memory_use(memory);
+
+    vm->typeid_layouts.elems[id] = layout;
+
+    // Updates are emitted into new modules, which must agree on the ids of existing types.
+    if (vm->incremental)
+    {
+      vm->typeid_names = realloc(vm->typeid_names, id * sizeof(char*));
+      vm->typeid_names[vm->typeid_count++] = strdup(name);
+    }
   }
 
   return id;
@@ -452,20 +1143,28 @@ static MIR_insn_t generate_debug_info(Token token, MIR_insn_t insn)
   return insn;
 }
 
-static void generate_malloc_expression(CyVM* vm, MIR_reg_t dest, MIR_op_t size)
+static MIR_insn_t generate_malloc_expression(CyVM* vm, MIR_reg_t dest, MIR_op_t size,
+                                             CyAllocationSite site)
 {
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_call_insn(vm->ctx, 4, MIR_new_ref_op(vm->ctx, vm->malloc.proto),
-                                    MIR_new_ref_op(vm->ctx, vm->malloc.func),
-                                    MIR_new_reg_op(vm->ctx, dest), size));
+  MIR_insn_t insn = MIR_new_call_insn(vm->ctx, 5, MIR_new_ref_op(vm->ctx, vm->malloc.proto),
+                                      MIR_new_ref_op(vm->ctx, vm->malloc.func),
+                                      MIR_new_reg_op(vm->ctx, dest), size,
+                                      MIR_new_int_op(vm->ctx, site));
+
+  MIR_append_insn(vm->ctx, vm->function, insn);
+  return insn;
 }
 
-static void generate_malloc_atomic_expression(CyVM* vm, MIR_reg_t dest, MIR_op_t size)
+static MIR_insn_t generate_malloc_atomic_expression(CyVM* vm, MIR_reg_t dest, MIR_op_t size,
+                                                    CyAllocationSite site)
 {
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_call_insn(vm->ctx, 4, MIR_new_ref_op(vm->ctx, vm->malloc_atomic.proto),
-                                    MIR_new_ref_op(vm->ctx, vm->malloc_atomic.func),
-                                    MIR_new_reg_op(vm->ctx, dest), size));
+  MIR_insn_t insn = MIR_new_call_insn(vm->ctx, 5, MIR_new_ref_op(vm->ctx, vm->malloc_atomic.proto),
+                                      MIR_new_ref_op(vm->ctx, vm->malloc_atomic.func),
+                                      MIR_new_reg_op(vm->ctx, dest), size,
+                                      MIR_new_int_op(vm->ctx, site));
+
+  MIR_append_insn(vm->ctx, vm->function, insn);
+  return insn;
 }
 
 static void generate_realloc_expression(CyVM* vm, MIR_op_t dest, MIR_op_t ptr, MIR_op_t size)
@@ -487,8 +1186,10 @@ static void generate_string_literal_expression(CyVM* vm, MIR_op_t dest, const ch
     uintptr_t size = sizeof(CyString) + length + 1;
     CyString* string = memory_alloc(size);
     string->size = length;
+    string->hash = 0;
     string->data[length] = '\0';
     memcpy(string->data, literal, length);
+    string_hash(string);
 
     const char* name = memory_sprintf("string.%d", map_size_mir_item(&vm->string_constants));
     item = MIR_new_data(vm->ctx, name, MIR_T_U8, size, string);
@@ -503,16 +1204,108 @@ static void generate_string_literal_expression(CyVM* vm, MIR_op_t dest, const ch
 
 static void generate_panic(CyVM* vm, const char* what, Token token)
 {
+  MIR_item_t message = map_get_mir_item(&vm->panic_messages, what);
+  if (!message)
+  {
+    const char* name = memory_sprintf("panic.%d", map_size_mir_item(&vm->panic_messages));
+    message = MIR_new_data(vm->ctx, name, MIR_T_U8, strlen(what) + 1, what);
+
+    map_put_mir_item(&vm->panic_messages, what, message);
+  }
+
+  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                               MIR_new_ref_op(vm->ctx, vm->vm_data)));
+
   MIR_append_insn(vm->ctx, vm->function,
                   generate_debug_info(
                     token, MIR_new_call_insn(vm->ctx, 6, MIR_new_ref_op(vm->ctx, vm->panic.proto),
                                              MIR_new_ref_op(vm->ctx, vm->panic.func),
-                                             MIR_new_int_op(vm->ctx, (uint64_t)vm),
-                                             MIR_new_int_op(vm->ctx, (uint64_t)what),
+                                             MIR_new_mem_op(vm->ctx, MIR_T_I64, 0, ptr, 0, 1),
+                                             MIR_new_ref_op(vm->ctx, message),
                                              MIR_new_int_op(vm->ctx, (uint64_t)0),
                                              MIR_new_int_op(vm->ctx, (uint64_t)0))));
 }
 
+static void generate_tier_counter(CyVM* vm, MIR_item_t function, MIR_insn_t before)
+{
+  MIR_item_t counter = map_get_mir_item(&vm->tier_counters, function->u.func->name);
+  if (!counter)
+  {
+    const char* name = memory_sprintf("counter.%s", function->u.func->name);
+    counter = MIR_new_data(vm->ctx, name, MIR_T_I32, 1, &vm->tier_threshold);
+
+    map_put_mir_item(&vm->tier_counters, function->u.func->name, counter);
+  }
+
+  MIR_label_t skip_label = MIR_new_label(vm->ctx);
+  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, function->u.func);
+
+  MIR_insn_t insns[] = {
+    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr), MIR_new_ref_op(vm->ctx, counter)),
+    MIR_new_insn(vm->ctx, MIR_SUBS, MIR_new_mem_op(vm->ctx, MIR_T_I32, 0, ptr, 0, 1),
+                 MIR_new_mem_op(vm->ctx, MIR_T_I32, 0, ptr, 0, 1), MIR_new_int_op(vm->ctx, 1)),
+    MIR_new_insn(vm->ctx, MIR_BNES, MIR_new_label_op(vm->ctx, skip_label),
+                 MIR_new_mem_op(vm->ctx, MIR_T_I32, 0, ptr, 0, 1), MIR_new_int_op(vm->ctx, 0)),
+    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                 MIR_new_ref_op(vm->ctx, vm->vm_data)),
+    MIR_new_call_insn(vm->ctx, 4, MIR_new_ref_op(vm->ctx, vm->tier_up.proto),
+                      MIR_new_ref_op(vm->ctx, vm->tier_up.func),
+                      MIR_new_mem_op(vm->ctx, MIR_T_I64, 0, ptr, 0, 1),
+                      MIR_new_ref_op(vm->ctx, function)),
+    skip_label,
+  };
+
+  for (size_t i = 0; i < sizeof(insns) / sizeof_ptr(insns); i++)
+  {
+    if (before)
+      MIR_insert_insn_before(vm->ctx, function, before, insns[i]);
+    else
+      MIR_append_insn(vm->ctx, function, insns[i]);
+  }
+}
+
+static void generate_budget_check(CyVM* vm, Token token)
+{
+  MIR_label_t skip_label = MIR_new_label(vm->ctx);
+  MIR_label_t exceeded_label = MIR_new_label(vm->ctx);
+  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+
+  // "cyth_interrupt" raises the floor instead of clearing the budget, as this decrement would
+  // otherwise be able to undo it.
+  MIR_op_t budget = MIR_new_mem_op(vm->ctx, MIR_T_I64, offsetof(CyVM, budget), ptr, 0, 1);
+  MIR_op_t budget_floor =
+    MIR_new_mem_op(vm->ctx, MIR_T_I64, offsetof(CyVM, budget_floor), ptr, 0, 1);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                               MIR_new_ref_op(vm->ctx, vm->vm_data)));
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                               MIR_new_mem_op(vm->ctx, MIR_T_I64, 0, ptr, 0, 1)));
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_SUB, budget, budget, MIR_new_int_op(vm->ctx, 1)));
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_BGT, MIR_new_label_op(vm->ctx, skip_label), budget,
+                               budget_floor));
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_BEQ, MIR_new_label_op(vm->ctx, exceeded_label),
+                               budget_floor, MIR_new_int_op(vm->ctx, 0)));
+
+  generate_panic(vm, "Execution interrupted", token);
+  MIR_append_insn(vm->ctx, vm->function, exceeded_label);
+  generate_panic(vm, "Execution budget exceeded", token);
+  MIR_append_insn(vm->ctx, vm->function, skip_label);
+}
+
+static void generate_index_extension(CyVM* vm, MIR_reg_t index)
+{
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_EXT32, MIR_new_reg_op(vm->ctx, index),
+                               MIR_new_reg_op(vm->ctx, index)));
+}
+
 static MIR_op_t generate_array_length_op(CyVM* vm, MIR_reg_t ptr)
 {
   return MIR_new_mem_op(vm->ctx, MIR_T_U32, 0, ptr, 0, 1);
@@ -533,9 +1326,14 @@ static MIR_op_t generate_string_length_op(CyVM* vm, MIR_reg_t base)
   return MIR_new_mem_op(vm->ctx, MIR_T_I32, 0, base, 0, 1);
 }
 
+static MIR_op_t generate_string_hash_op(CyVM* vm, MIR_reg_t base)
+{
+  return MIR_new_mem_op(vm->ctx, MIR_T_U32, offsetof(CyString, hash), base, 0, 1);
+}
+
 static MIR_op_t generate_string_at_op(CyVM* vm, MIR_reg_t base, MIR_reg_t index)
 {
-  return MIR_new_mem_op(vm->ctx, MIR_T_U8, sizeof(unsigned int), base, index, 1);
+  return MIR_new_mem_op(vm->ctx, MIR_T_U8, offsetof(CyString, data), base, index, 1);
 }
 
 static MIR_op_t generate_object_field_op(CyVM* vm, VarStmt* field, MIR_reg_t ptr)
@@ -546,7 +1344,8 @@ static MIR_op_t generate_object_field_op(CyVM* vm, VarStmt* field, MIR_reg_t ptr
 
 static void generate_default_array_initialization(CyVM* vm, MIR_reg_t dest)
 {
-  generate_malloc_expression(vm, dest, MIR_new_int_op(vm->ctx, sizeof(CyArray)));
+  generate_malloc_expression(vm, dest, MIR_new_int_op(vm->ctx, sizeof(CyArray)),
+                             CY_ALLOCATION_ARRAY);
 
   MIR_append_insn(
     vm->ctx, vm->function,
@@ -749,7 +1548,7 @@ static Function* generate_array_push_string_function(CyVM* vm, DataType data_typ
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_ADD, MIR_new_reg_op(vm->ctx, source_ptr),
                                    MIR_new_reg_op(vm->ctx, string_ptr),
-                                   MIR_new_int_op(vm->ctx, sizeof(unsigned int))));
+                                   MIR_new_int_op(vm->ctx, offsetof(CyString, data))));
 
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_call_insn(vm->ctx, 5, MIR_new_ref_op(vm->ctx, vm->memcpy.proto),
@@ -884,10 +1683,11 @@ static Function* generate_array_to_string_function(CyVM* vm, DataType data_type)
 
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_ADD, MIR_new_reg_op(vm->ctx, size),
-                                   MIR_new_int_op(vm->ctx, sizeof(unsigned int) + 1),
+                                   MIR_new_int_op(vm->ctx, sizeof(CyString) + 1),
                                    generate_array_length_op(vm, ptr)));
 
-      generate_malloc_atomic_expression(vm, string_ptr, MIR_new_reg_op(vm->ctx, size));
+      generate_malloc_atomic_expression(vm, string_ptr, MIR_new_reg_op(vm->ctx, size),
+                                        CY_ALLOCATION_STRING);
 
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, size),
@@ -902,11 +1702,15 @@ static Function* generate_array_to_string_function(CyVM* vm, DataType data_type)
                       MIR_new_insn(vm->ctx, MIR_MOV, generate_string_length_op(vm, string_ptr),
                                    generate_array_length_op(vm, ptr)));
 
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_MOV, generate_string_hash_op(vm, string_ptr),
+                                   MIR_new_int_op(vm->ctx, 0)));
+
       MIR_reg_t dest_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_ADD, MIR_new_reg_op(vm->ctx, dest_ptr),
                                    MIR_new_reg_op(vm->ctx, string_ptr),
-                                   MIR_new_int_op(vm->ctx, sizeof(unsigned int))));
+                                   MIR_new_int_op(vm->ctx, offsetof(CyString, data))));
 
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_call_insn(
@@ -1001,6 +1805,8 @@ static Function* generate_array_remove_function(CyVM* vm, DataType data_type)
     MIR_reg_t index = MIR_reg(vm->ctx, "index", vm->function->u.func);
 
     {
+      generate_index_extension(vm, index);
+
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
                                    MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
@@ -1228,11 +2034,6 @@ static Function* generate_array_reserve_function(CyVM* vm, DataType data_type)
   return function;
 }
 
-static int int_hash(int n)
-{
-  return n;
-}
-
 static Function* generate_int_hash_function(CyVM* vm)
 {
   const char* name = "int.hash";
@@ -1245,30 +2046,36 @@ static Function* generate_int_hash_function(CyVM* vm)
       { .name = "n", .size = 0, .type = data_type_to_mir_type(DATA_TYPE(TYPE_INTEGER)) },
     };
 
+    MIR_item_t previous_function = vm->function;
+    MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+    MIR_set_curr_func(vm->ctx, NULL);
+
     function = ALLOC(Function);
     function->proto =
       MIR_new_proto_arr(vm->ctx, memory_sprintf("%s.proto", name), return_type != MIR_T_UNDEF,
                         &return_type, sizeof(params) / sizeof_ptr(params), params);
-    function->func = MIR_new_import(vm->ctx, name);
+    function->func = MIR_new_func_arr(vm->ctx, name, return_type != MIR_T_UNDEF, &return_type,
+                                      sizeof(params) / sizeof_ptr(params), params);
+
+    vm->function = function->func;
+
+    MIR_reg_t n = MIR_reg(vm->ctx, "n", vm->function->u.func);
+
+    {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_ret_insn(vm->ctx, 1, MIR_new_reg_op(vm->ctx, n)));
+    }
 
-    MIR_load_external(vm->ctx, name, (uintptr_t)int_hash);
     map_put_function(&vm->functions, name, function);
+
+    MIR_finish_func(vm->ctx);
+    MIR_set_curr_func(vm->ctx, previous_func);
+    vm->function = previous_function;
   }
 
   return function;
 }
 
-static int float_hash(float n)
-{
-  union {
-    float f;
-    int i;
-  } value;
-  value.f = n;
-
-  return value.i;
-}
-
 static Function* generate_float_hash_function(CyVM* vm)
 {
   const char* name = "float.hash";
@@ -1281,14 +2088,46 @@ static Function* generate_float_hash_function(CyVM* vm)
       { .name = "n", .size = 0, .type = data_type_to_mir_type(DATA_TYPE(TYPE_FLOAT)) },
     };
 
+    MIR_item_t previous_function = vm->function;
+    MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+    MIR_set_curr_func(vm->ctx, NULL);
+
     function = ALLOC(Function);
     function->proto =
       MIR_new_proto_arr(vm->ctx, memory_sprintf("%s.proto", name), return_type != MIR_T_UNDEF,
                         &return_type, sizeof(params) / sizeof_ptr(params), params);
-    function->func = MIR_new_import(vm->ctx, name);
+    function->func = MIR_new_func_arr(vm->ctx, name, return_type != MIR_T_UNDEF, &return_type,
+                                      sizeof(params) / sizeof_ptr(params), params);
+
+    vm->function = function->func;
+
+    MIR_reg_t n = MIR_reg(vm->ctx, "n", vm->function->u.func);
+    MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+    MIR_reg_t bits = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+
+    {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_ALLOCA, MIR_new_reg_op(vm->ctx, ptr),
+                                   MIR_new_int_op(vm->ctx, sizeof(float))));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_FMOV,
+                                   MIR_new_mem_op(vm->ctx, MIR_T_F, 0, ptr, 0, 1),
+                                   MIR_new_reg_op(vm->ctx, n)));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, bits),
+                                   MIR_new_mem_op(vm->ctx, MIR_T_I32, 0, ptr, 0, 1)));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_ret_insn(vm->ctx, 1, MIR_new_reg_op(vm->ctx, bits)));
+    }
 
-    MIR_load_external(vm->ctx, name, (uintptr_t)float_hash);
     map_put_function(&vm->functions, name, function);
+
+    MIR_finish_func(vm->ctx);
+    MIR_set_curr_func(vm->ctx, previous_func);
+    vm->function = previous_function;
   }
 
   return function;
@@ -1340,19 +2179,6 @@ static Function* generate_float_sqrt_function(CyVM* vm)
   return function;
 }
 
-static int string_hash(CyString* n)
-{
-  uint32_t hash = 0x811c9dc5;
-
-  for (int i = 0; i < n->size; i++)
-  {
-    hash ^= n->data[i];
-    hash *= 0x01000193;
-  }
-
-  return hash;
-}
-
 static Function* generate_string_hash_function(CyVM* vm)
 {
   const char* name = "string.hash";
@@ -1378,29 +2204,46 @@ static Function* generate_string_hash_function(CyVM* vm)
   return function;
 }
 
-static int string_index_of(CyString* haystack, CyString* needle)
+// Returns the offset of the first occurrence of a non-empty needle at or after start, or -1.
+// Both paths lean on libc, which vectorizes the byte scans and selects the kernel at runtime:
+// memmem is a two-way search, and the fallback uses memchr to jump between candidates for the
+// first byte and rejects them on the last byte before comparing the rest.
+static int string_find(CyString* haystack, int start, CyString* needle)
 {
-  if (needle->size == 0)
-    return 0;
+  if (start > haystack->size - needle->size)
+    return -1;
 
-  for (int i = 0; i <= haystack->size - needle->size; i++)
-  {
-    bool match = true;
+#ifndef _WIN32
+  const char* match =
+    memmem(haystack->data + start, haystack->size - start, needle->data, needle->size);
 
-    for (int j = 0; j < needle->size; j++)
-    {
-      if (haystack->data[i + j] != needle->data[j])
-      {
-        match = false;
-        break;
-      }
-    }
+  return match ? match - haystack->data : -1;
+#else
+  const char first = needle->data[0];
+  const char last = needle->data[needle->size - 1];
+  const char* end = haystack->data + haystack->size - needle->size + 1;
+
+  for (const char* current = haystack->data + start; current < end; current++)
+  {
+    current = memchr(current, first, end - current);
+    if (!current)
+      return -1;
 
-    if (match)
-      return i;
+    if (current[needle->size - 1] == last &&
+        memcmp(current + 1, needle->data + 1, needle->size - 1) == 0)
+      return current - haystack->data;
   }
 
   return -1;
+#endif
+}
+
+static int string_index_of(CyString* haystack, CyString* needle)
+{
+  if (needle->size == 0)
+    return 0;
+
+  return string_find(haystack, 0, needle);
 }
 
 static Function* generate_string_index_of_function(CyVM* vm)
@@ -1436,25 +2279,9 @@ static int string_count(CyString* haystack, CyString* needle)
 
   int count = 0;
 
-  for (int i = 0; i <= haystack->size - needle->size; i++)
-  {
-    bool match = true;
-
-    for (int j = 0; j < needle->size; j++)
-    {
-      if (haystack->data[i + j] != needle->data[j])
-      {
-        match = false;
-        break;
-      }
-    }
-
-    if (match)
-    {
-      count++;
-      i += needle->size - 1;
-    }
-  }
+  for (int i = string_find(haystack, 0, needle); i != -1;
+       i = string_find(haystack, i + needle->size, needle))
+    count++;
 
   return count;
 }
@@ -1496,41 +2323,29 @@ static CyString* string_replace(CyString* input, CyString* old, CyString* new)
 
   int size = input->size + count * (new->size - old->size);
 
-  CyString* result = GC_malloc_atomic(sizeof(CyString) + size + 1);
+  CyString* result = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
   result->size = size;
+  result->hash = 0;
   result->data[size] = '\0';
 
   if (old->size > 0)
   {
-    for (int i = 0, k = 0; i < input->size;)
-    {
-      bool match = true;
-
-      for (int j = 0; j < old->size; j++)
-      {
-        if (i + j >= input->size || input->data[i + j] != old->data[j])
-        {
-          match = false;
-          break;
-        }
-      }
+    int i = 0;
+    int k = 0;
 
-      if (match)
-      {
-        for (int j = 0; j < new->size; j++)
-          result->data[k + j] = new->data[j];
+    for (int match = string_find(input, 0, old); match != -1;
+         match = string_find(input, i, old))
+    {
+      memcpy(result->data + k, input->data + i, match - i);
+      k += match - i;
 
-        i += old->size;
-        k += new->size;
-      }
-      else
-      {
-        result->data[k] = input->data[i];
+      memcpy(result->data + k, new->data, new->size);
+      k += new->size;
 
-        i++;
-        k++;
-      }
+      i = match + old->size;
     }
+
+    memcpy(result->data + k, input->data + i, input->size - i);
   }
   else
   {
@@ -1596,8 +2411,9 @@ static CyString* string_trim(CyString* input)
 
   int size = end - start + 1;
 
-  CyString* result = GC_malloc_atomic(sizeof(CyString) + size + 1);
+  CyString* result = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
   result->size = size;
+  result->hash = 0;
   result->data[size] = '\0';
 
   for (int i = start, j = 0; i <= end; i++, j++)
@@ -1752,17 +2568,18 @@ static CyArray* string_split(CyString* input, CyString* delim)
 {
   if (delim->size == 0)
   {
-    CyArray* result = GC_malloc(sizeof(CyArray));
+    CyArray* result = allocate(sizeof(CyArray), CY_ALLOCATION_ARRAY);
     result->size = input->size;
     result->capacity = input->size;
-    result->data = GC_malloc(sizeof(CyString*) * input->size);
+    result->data = allocate(sizeof(CyString*) * input->size, CY_ALLOCATION_ARRAY);
 
     CyString** data = result->data;
 
     for (int i = 0; i < input->size; i++)
     {
-      CyString* item = GC_malloc_atomic(sizeof(CyString) + 1 + 1);
+      CyString* item = allocate_atomic(sizeof(CyString) + 1 + 1, CY_ALLOCATION_STRING);
       item->size = 1;
+      item->hash = 0;
       item->data[0] = input->data[i];
       item->data[1] = '\0';
 
@@ -1776,54 +2593,37 @@ static CyArray* string_split(CyString* input, CyString* delim)
   {
     int count = string_count(input, delim) + 1;
 
-    CyArray* result = GC_malloc(sizeof(CyArray));
+    CyArray* result = allocate(sizeof(CyArray), CY_ALLOCATION_ARRAY);
     result->size = count;
     result->capacity = count;
-    result->data = GC_malloc(sizeof(CyString*) * count);
+    result->data = allocate(sizeof(CyString*) * count, CY_ALLOCATION_ARRAY);
 
     CyString** data = result->data;
 
-    int current = 0;
     int previous = 0;
 
-    while (current <= input->size - delim->size)
+    for (int current = string_find(input, 0, delim); current != -1;
+         current = string_find(input, previous, delim))
     {
-      bool match = true;
+      const int size = current - previous;
 
-      for (int j = 0; j < delim->size; j++)
-      {
-        if (input->data[current + j] != delim->data[j])
-        {
-          match = false;
-          break;
-        }
-      }
+      CyString* item = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
+      item->size = size;
+      item->hash = 0;
+      item->data[size] = '\0';
+      memcpy(item->data, input->data + previous, size);
 
-      if (match)
-      {
-        const int size = current - previous;
-
-        CyString* item = GC_malloc_atomic(sizeof(CyString) + size + 1);
-        item->size = size;
-        item->data[size] = '\0';
-        memcpy(item->data, input->data + previous, size);
-
-        *data = item;
-        data += 1;
+      *data = item;
+      data += 1;
 
-        current += delim->size;
-        previous = current;
-      }
-      else
-      {
-        current++;
-      }
+      previous = current + delim->size;
     }
 
     const int size = input->size - previous;
 
-    CyString* item = GC_malloc_atomic(sizeof(CyString) + size + 1);
+    CyString* item = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
     item->size = size;
+    item->hash = 0;
     item->data[size] = '\0';
     memcpy(item->data, input->data + previous, size);
 
@@ -1864,8 +2664,9 @@ static CyString* string_join(CyArray* input, CyString* delim)
 {
   if (input->size == 0)
   {
-    CyString* result = GC_malloc_atomic(sizeof(CyString) + 1);
+    CyString* result = allocate_atomic(sizeof(CyString) + 1, CY_ALLOCATION_STRING);
     result->size = 0;
+    result->hash = 0;
     result->data[result->size] = '\0';
 
     return result;
@@ -1877,8 +2678,9 @@ static CyString* string_join(CyArray* input, CyString* delim)
   for (int i = 0; i < input->size; i++)
     size += data[i]->size;
 
-  CyString* result = GC_malloc_atomic(sizeof(CyString) + size + 1);
+  CyString* result = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
   result->size = size;
+  result->hash = 0;
   result->data[size] = '\0';
 
   for (int i = 0, k = 0; i < input->size; i++)
@@ -1927,10 +2729,10 @@ static Function* generate_string_join_function(CyVM* vm, DataType array_data_typ
 
 static CyArray* string_to_array(CyString* input)
 {
-  CyArray* result = GC_malloc(sizeof(CyArray));
+  CyArray* result = allocate(sizeof(CyArray), CY_ALLOCATION_ARRAY);
   result->size = input->size;
   result->capacity = input->size;
-  result->data = GC_malloc_atomic(sizeof(char) * input->size);
+  result->data = allocate_atomic(sizeof(char) * input->size, CY_ALLOCATION_ARRAY);
 
   memcpy(result->data, input->data, input->size);
 
@@ -1966,8 +2768,9 @@ static CyString* string_pad(CyString* input, int pad)
 {
   const int size = pad + input->size;
 
-  CyString* result = GC_malloc_atomic(sizeof(CyString) + size + 1);
+  CyString* result = allocate_atomic(sizeof(CyString) + size + 1, CY_ALLOCATION_STRING);
   result->size = size;
+  result->hash = 0;
   result->data[size] = '\0';
 
   for (int i = 0; i < pad; i++)
@@ -2005,23 +2808,192 @@ static Function* generate_string_pad_function(CyVM* vm)
   return function;
 }
 
-static Function* generate_string_concat_function(CyVM* vm, int count)
+// Appends [part] to [string] in place when [string] is the buffer a previous call returned for the
+// same loop, which nothing else can reference yet. Otherwise the result is a copy with spare room.
+static CyString* string_append(CyString* string, CyString* part, CyString* owner)
 {
-  assert(count >= 2);
+  const int size = string->size + part->size;
 
-  const char* name = count == 2 ? "string.concat" : memory_sprintf("string.concat.%d", count);
+  if (string != owner || sizeof(CyString) + size + 1 > GC_size(string))
+  {
+    uintptr_t capacity = sizeof(CyString) + (uintptr_t)size * 2 + 1;
+    CyString* result = allocate_atomic(capacity, CY_ALLOCATION_STRING);
+    result->size = string->size;
+    result->hash = 0;
+    memcpy(result->data, string->data, string->size);
+
+    string = result;
+  }
+
+  memcpy(string->data + string->size, part->data, part->size);
+  string->size = size;
+  string->hash = 0;
+  string->data[size] = '\0';
+
+  return string;
+}
+
+static Function* generate_string_append_function(CyVM* vm)
+{
+  const char* name = "string.append";
 
   Function* function = map_get_function(&vm->functions, name);
   if (!function)
   {
     MIR_type_t return_type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING));
+    MIR_var_t params[] = {
+      { .name = "string", .size = 0, .type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING)) },
+      { .name = "part", .size = 0, .type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING)) },
+      { .name = "owner", .size = 0, .type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING)) },
+    };
 
-    ArrayMIR_var_t params;
-    array_init(&params);
-
-    for (int i = 0; i < count; i++)
-    {
-      MIR_var_t param;
+    function = ALLOC(Function);
+    function->proto =
+      MIR_new_proto_arr(vm->ctx, memory_sprintf("%s.proto", name), return_type != MIR_T_UNDEF,
+                        &return_type, sizeof(params) / sizeof_ptr(params), params);
+    function->func = MIR_new_import(vm->ctx, name);
+
+    MIR_load_external(vm->ctx, name, (uintptr_t)string_append);
+    map_put_function(&vm->functions, name, function);
+  }
+
+  return function;
+}
+
+// String builders share the layout of arrays, where the data is a string with room to append to
+// and the capacity excludes the terminator. A capacity of zero with data marks a string that was
+// handed out by "toString", which is copied before it is appended to again.
+static char* string_builder_reserve(CyArray* builder, int size)
+{
+  if (builder->size + size > builder->capacity)
+  {
+    int capacity = builder->capacity * 2;
+    if (capacity < builder->size + size)
+      capacity = builder->size + size;
+    if (capacity < 16)
+      capacity = 16;
+
+    CyString* string = allocate_atomic(sizeof(CyString) + capacity + 1, CY_ALLOCATION_STRING);
+    string->hash = 0;
+    if (builder->data)
+      memcpy(string->data, ((CyString*)builder->data)->data, builder->size);
+
+    builder->data = string;
+    builder->capacity = capacity;
+  }
+
+  return ((CyString*)builder->data)->data + builder->size;
+}
+
+static void string_builder_append_string(CyArray* builder, CyString* string)
+{
+  memcpy(string_builder_reserve(builder, string->size), string->data, string->size);
+  builder->size += string->size;
+}
+
+static void string_builder_append_int(CyArray* builder, int n)
+{
+  char digits[16];
+  char* end = digits + sizeof(digits);
+  char* start = format_int(end, n);
+
+  int size = (int)(end - start);
+  memcpy(string_builder_reserve(builder, size), start, size);
+  builder->size += size;
+}
+
+static void string_builder_append_float(CyArray* builder, float n)
+{
+  if (n != 0 && n >= -1e9f && n <= 1e9f && n == (int)n)
+  {
+    string_builder_append_int(builder, (int)n);
+    return;
+  }
+
+  const int size = 32;
+  builder->size += snprintf(string_builder_reserve(builder, size), size, "%.10g", n);
+}
+
+static void string_builder_append_char(CyArray* builder, char n)
+{
+  *string_builder_reserve(builder, 1) = n;
+  builder->size++;
+}
+
+static CyString* string_builder_to_string(CyArray* builder)
+{
+  if (!builder->data)
+  {
+    CyString* result = allocate_atomic(sizeof(CyString) + 1, CY_ALLOCATION_STRING);
+    result->size = 0;
+    result->hash = 0;
+    result->data[0] = '\0';
+
+    return result;
+  }
+
+  CyString* result = builder->data;
+  if (builder->capacity)
+  {
+    result->size = builder->size;
+    result->data[builder->size] = '\0';
+    builder->capacity = 0;
+  }
+
+  return result;
+}
+
+static void string_builder_clear(CyArray* builder)
+{
+  builder->size = 0;
+
+  if (!builder->capacity)
+    builder->data = NULL;
+}
+
+static Function* generate_string_builder_function(CyVM* vm, const char* name,
+                                                  DataType return_data_type, DataType data_type,
+                                                  uintptr_t address)
+{
+  Function* function = map_get_function(&vm->functions, name);
+  if (!function)
+  {
+    MIR_type_t return_type = data_type_to_mir_type(return_data_type);
+    MIR_var_t params[] = {
+      { .name = "this", .size = 0, .type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING_BUILDER)) },
+      { .name = "value", .size = 0, .type = data_type_to_mir_type(data_type) },
+    };
+
+    function = ALLOC(Function);
+    function->proto =
+      MIR_new_proto_arr(vm->ctx, memory_sprintf("%s.proto", name), return_type != MIR_T_UNDEF,
+                        &return_type, data_type.type == TYPE_VOID ? 1 : 2, params);
+    function->func = MIR_new_import(vm->ctx, name);
+
+    MIR_load_external(vm->ctx, name, address);
+    map_put_function(&vm->functions, name, function);
+  }
+
+  return function;
+}
+
+static Function* generate_string_concat_function(CyVM* vm, int count)
+{
+  assert(count >= 2);
+
+  const char* name = count == 2 ? "string.concat" : memory_sprintf("string.concat.%d", count);
+
+  Function* function = map_get_function(&vm->functions, name);
+  if (!function)
+  {
+    MIR_type_t return_type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING));
+
+    ArrayMIR_var_t params;
+    array_init(&params);
+
+    for (int i = 0; i < count; i++)
+    {
+      MIR_var_t param;
       param.name = memory_sprintf("n.%d", i);
       param.type = data_type_to_mir_type(DATA_TYPE(TYPE_STRING));
 
@@ -2049,22 +3021,27 @@ static Function* generate_string_concat_function(CyVM* vm, int count)
         MIR_reg_t n_ptr = MIR_reg(vm->ctx, params.elems[i].name, vm->function->u.func);
         MIR_append_insn(vm->ctx, vm->function,
                         MIR_new_insn(vm->ctx, MIR_ADD, MIR_new_reg_op(vm->ctx, size),
-                                     i == 0 ? MIR_new_int_op(vm->ctx, sizeof(unsigned int) + 1)
+                                     i == 0 ? MIR_new_int_op(vm->ctx, sizeof(CyString) + 1)
                                             : MIR_new_reg_op(vm->ctx, size),
                                      generate_string_length_op(vm, n_ptr)));
       }
 
-      generate_malloc_atomic_expression(vm, ptr, MIR_new_reg_op(vm->ctx, size));
+      generate_malloc_atomic_expression(vm, ptr, MIR_new_reg_op(vm->ctx, size),
+                                        CY_ALLOCATION_STRING);
 
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_SUB, MIR_new_reg_op(vm->ctx, size),
                                    MIR_new_reg_op(vm->ctx, size),
-                                   MIR_new_int_op(vm->ctx, sizeof(unsigned int) + 1)));
+                                   MIR_new_int_op(vm->ctx, sizeof(CyString) + 1)));
 
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_MOV, generate_string_length_op(vm, ptr),
                                    MIR_new_reg_op(vm->ctx, size)));
 
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_MOV, generate_string_hash_op(vm, ptr),
+                                   MIR_new_int_op(vm->ctx, 0)));
+
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, data_type_to_mov_type(DATA_TYPE(TYPE_STRING)),
                                    generate_string_at_op(vm, ptr, size),
@@ -2077,7 +3054,7 @@ static Function* generate_string_concat_function(CyVM* vm, int count)
       MIR_append_insn(vm->ctx, vm->function,
                       MIR_new_insn(vm->ctx, MIR_ADD, MIR_new_reg_op(vm->ctx, dest_ptr),
                                    MIR_new_reg_op(vm->ctx, ptr),
-                                   MIR_new_int_op(vm->ctx, sizeof(unsigned int))));
+                                   MIR_new_int_op(vm->ctx, offsetof(CyString, data))));
 
       for (int i = 0; i < count; i++)
       {
@@ -2090,7 +3067,7 @@ static Function* generate_string_concat_function(CyVM* vm, int count)
         MIR_append_insn(vm->ctx, vm->function,
                         MIR_new_insn(vm->ctx, MIR_ADD, MIR_new_reg_op(vm->ctx, n_ptr),
                                      MIR_new_reg_op(vm->ctx, n_ptr),
-                                     MIR_new_int_op(vm->ctx, sizeof(unsigned int))));
+                                     MIR_new_int_op(vm->ctx, offsetof(CyString, data))));
 
         MIR_append_insn(vm->ctx, vm->function,
                         MIR_new_call_insn(vm->ctx, 5, MIR_new_ref_op(vm->ctx, vm->memcpy.proto),
@@ -2146,6 +3123,7 @@ static void generate_default_initialization(CyVM* vm, MIR_reg_t dest, DataType d
     generate_string_literal_expression(vm, MIR_new_reg_op(vm->ctx, dest), "", 0);
     return;
   case TYPE_ARRAY:
+  case TYPE_STRING_BUILDER:
     generate_default_array_initialization(vm, dest);
     return;
   default:
@@ -2210,6 +3188,25 @@ static Function* generate_function_internal(CyVM* vm, DataType data_type)
                                          array_at(&data_type.function_internal.parameter_types, 0));
   else if (strcmp(name, "string.to_array") == 0)
     return generate_string_to_array_function(vm, *data_type.function_internal.return_type);
+  else if (strcmp(name, "string_builder.append_string") == 0)
+    return generate_string_builder_function(vm, name, DATA_TYPE(TYPE_VOID), DATA_TYPE(TYPE_STRING),
+                                            (uintptr_t)string_builder_append_string);
+  else if (strcmp(name, "string_builder.append_int") == 0)
+    return generate_string_builder_function(vm, name, DATA_TYPE(TYPE_VOID),
+                                            DATA_TYPE(TYPE_INTEGER),
+                                            (uintptr_t)string_builder_append_int);
+  else if (strcmp(name, "string_builder.append_float") == 0)
+    return generate_string_builder_function(vm, name, DATA_TYPE(TYPE_VOID), DATA_TYPE(TYPE_FLOAT),
+                                            (uintptr_t)string_builder_append_float);
+  else if (strcmp(name, "string_builder.append_char") == 0)
+    return generate_string_builder_function(vm, name, DATA_TYPE(TYPE_VOID), DATA_TYPE(TYPE_CHAR),
+                                            (uintptr_t)string_builder_append_char);
+  else if (strcmp(name, "string_builder.to_string") == 0)
+    return generate_string_builder_function(vm, name, DATA_TYPE(TYPE_STRING), DATA_TYPE(TYPE_VOID),
+                                            (uintptr_t)string_builder_to_string);
+  else if (strcmp(name, "string_builder.clear") == 0)
+    return generate_string_builder_function(vm, name, DATA_TYPE(TYPE_VOID), DATA_TYPE(TYPE_VOID),
+                                            (uintptr_t)string_builder_clear);
   else
     UNREACHABLE("Unexpected internal function");
 }
@@ -2305,6 +3302,39 @@ static void generate_binary_expression_function_call(CyVM* vm, MIR_reg_t dest,
   MIR_append_insn(vm->ctx, vm->function, insn);
 }
 
+static ArrayExpr collect_string_parts(BinaryExpr* expression)
+{
+  ArrayExpr strings;
+  array_init(&strings);
+
+  ArrayExpr stack;
+  array_init(&stack);
+  array_add(&stack, expression->right);
+  array_add(&stack, expression->left);
+
+  while (array_size(&stack))
+  {
+    Expr* expr = array_at(&stack, stack.size - 1);
+    array_del_last(&stack);
+
+    if (expr->type == EXPR_BINARY && expr->binary.op.type == TOKEN_PLUS)
+    {
+      array_add(&stack, expr->binary.right);
+      array_add(&stack, expr->binary.left);
+    }
+    else if (expr->type == EXPR_GROUP)
+    {
+      array_add(&stack, expr->group.expr);
+    }
+    else
+    {
+      array_add(&strings, expr);
+    }
+  }
+
+  return strings;
+}
+
 static void generate_binary_expression(CyVM* vm, MIR_reg_t dest, BinaryExpr* expression)
 {
   MIR_reg_t left = 0;
@@ -2335,33 +3365,7 @@ static void generate_binary_expression(CyVM* vm, MIR_reg_t dest, BinaryExpr* exp
       op = MIR_FADD;
     else if (data_type.type == TYPE_STRING)
     {
-      ArrayExpr strings;
-      array_init(&strings);
-
-      ArrayExpr stack;
-      array_init(&stack);
-      array_add(&stack, expression->right);
-      array_add(&stack, expression->left);
-
-      while (array_size(&stack))
-      {
-        Expr* expr = array_at(&stack, stack.size - 1);
-        array_del_last(&stack);
-
-        if (expr->type == EXPR_BINARY && expr->binary.op.type == TOKEN_PLUS)
-        {
-          array_add(&stack, expr->binary.right);
-          array_add(&stack, expr->binary.left);
-        }
-        else if (expr->type == EXPR_GROUP)
-        {
-          array_add(&stack, expr->group.expr);
-        }
-        else
-        {
-          array_add(&strings, expr);
-        }
-      }
+      ArrayExpr strings = collect_string_parts(expression);
 
       Function* string_concat = generate_string_concat_function(vm, strings.size);
 
@@ -2382,7 +3386,9 @@ static void generate_binary_expression(CyVM* vm, MIR_reg_t dest, BinaryExpr* exp
       }
 
       MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn_arr(vm->ctx, MIR_INLINE, arguments.size, arguments.elems));
+                      generate_debug_info(expression->op,
+                                          MIR_new_insn_arr(vm->ctx, MIR_INLINE, arguments.size,
+                                                           arguments.elems)));
       return;
     }
     else if (data_type.type == TYPE_OBJECT)
@@ -3345,6 +4351,17 @@ static void generate_string_cast(CyVM* vm, MIR_reg_t dest, MIR_reg_t expr, MIR_r
                     MIR_new_insn(vm->ctx, data_type_to_mov_type(data_type),
                                  MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, expr)));
     return;
+  case TYPE_STRING_BUILDER: {
+    Function* function = generate_string_builder_function(
+      vm, "string_builder.to_string", DATA_TYPE(TYPE_STRING), DATA_TYPE(TYPE_VOID),
+      (uintptr_t)string_builder_to_string);
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_call_insn(vm->ctx, 4, MIR_new_ref_op(vm->ctx, function->proto),
+                                      MIR_new_ref_op(vm->ctx, function->func),
+                                      MIR_new_reg_op(vm->ctx, dest),
+                                      MIR_new_reg_op(vm->ctx, expr)));
+    return;
+  }
   case TYPE_ARRAY: {
     Function* function = generate_string_array_cast_function(vm, data_type);
     MIR_append_insn(vm->ctx, vm->function,
@@ -3418,6 +4435,38 @@ static void generate_string_cast(CyVM* vm, MIR_reg_t dest, MIR_reg_t expr, MIR_r
   }
 }
 
+// Values of type "any" are only cast to the type whose id they carry, and panic otherwise.
+static void generate_any_cast(CyVM* vm, MIR_reg_t dest, MIR_reg_t expr, CastExpr* expression)
+{
+  MIR_label_t cont_label = MIR_new_label(vm->ctx);
+  MIR_label_t if_false_label = MIR_new_label(vm->ctx);
+
+  MIR_reg_t id = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_URSH, MIR_new_reg_op(vm->ctx, id),
+                               MIR_new_reg_op(vm->ctx, expr), MIR_new_int_op(vm->ctx, 48)));
+
+  MIR_append_insn(
+    vm->ctx, vm->function,
+    MIR_new_insn(vm->ctx, MIR_BNE, MIR_new_label_op(vm->ctx, if_false_label),
+                 MIR_new_reg_op(vm->ctx, id),
+                 MIR_new_int_op(vm->ctx, data_type_to_typeid(vm, expression->to_data_type))));
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_AND, MIR_new_reg_op(vm->ctx, dest),
+                               MIR_new_reg_op(vm->ctx, expr),
+                               MIR_new_int_op(vm->ctx, 0xFFFFFFFFFFFFUL)));
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
+  MIR_append_insn(vm->ctx, vm->function, if_false_label);
+
+  generate_panic(vm, "Invalid type cast", expression->type.token);
+
+  MIR_append_insn(vm->ctx, vm->function, cont_label);
+}
+
 static void generate_cast_expression(CyVM* vm, MIR_reg_t dest, CastExpr* expression)
 {
   MIR_type_t type = data_type_to_mir_type(expression->from_data_type);
@@ -3447,6 +4496,7 @@ static void generate_cast_expression(CyVM* vm, MIR_reg_t dest, CastExpr* express
     case TYPE_FLOAT:
     case TYPE_INTEGER:
     case TYPE_CHAR:
+    case TYPE_STRING_BUILDER:
     case TYPE_ARRAY:
     case TYPE_OBJECT:
     case TYPE_ALIAS:
@@ -3481,36 +4531,9 @@ static void generate_cast_expression(CyVM* vm, MIR_reg_t dest, CastExpr* express
       generate_string_cast(vm, dest, expr, depth, list, expression->from_data_type);
       return;
     }
-    case TYPE_ANY: {
-      MIR_label_t cont_label = MIR_new_label(vm->ctx);
-      MIR_label_t if_false_label = MIR_new_label(vm->ctx);
-
-      MIR_reg_t id = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_URSH, MIR_new_reg_op(vm->ctx, id),
-                                   MIR_new_reg_op(vm->ctx, expr), MIR_new_int_op(vm->ctx, 48)));
-
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(vm->ctx, MIR_BNE, MIR_new_label_op(vm->ctx, if_false_label),
-                     MIR_new_reg_op(vm->ctx, id),
-                     MIR_new_int_op(vm->ctx, data_type_to_typeid(vm, expression->to_data_type))));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_AND, MIR_new_reg_op(vm->ctx, dest),
-                                   MIR_new_reg_op(vm->ctx, expr),
-                                   MIR_new_int_op(vm->ctx, 0xFFFFFFFFFFFFUL)));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
-      MIR_append_insn(vm->ctx, vm->function, if_false_label);
-
-      generate_panic(vm, "Invalid type cast", expression->type.token);
-
-      MIR_append_insn(vm->ctx, vm->function, cont_label);
+    case TYPE_ANY:
+      generate_any_cast(vm, dest, expr, expression);
       return;
-    }
     default:
       break;
     }
@@ -3606,6 +4629,7 @@ static void generate_cast_expression(CyVM* vm, MIR_reg_t dest, CastExpr* express
     switch (expression->from_data_type.type)
     {
     case TYPE_STRING:
+    case TYPE_STRING_BUILDER:
     case TYPE_ARRAY:
     case TYPE_OBJECT: {
       uint64_t id = data_type_to_typeid(vm, expression->from_data_type) << 48;
@@ -3634,36 +4658,9 @@ static void generate_cast_expression(CyVM* vm, MIR_reg_t dest, CastExpr* express
   {
     switch (expression->from_data_type.type)
     {
-    case TYPE_ANY: {
-      MIR_label_t cont_label = MIR_new_label(vm->ctx);
-      MIR_label_t if_false_label = MIR_new_label(vm->ctx);
-
-      MIR_reg_t id = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_URSH, MIR_new_reg_op(vm->ctx, id),
-                                   MIR_new_reg_op(vm->ctx, expr), MIR_new_int_op(vm->ctx, 48)));
-
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(vm->ctx, MIR_BNE, MIR_new_label_op(vm->ctx, if_false_label),
-                     MIR_new_reg_op(vm->ctx, id),
-                     MIR_new_int_op(vm->ctx, data_type_to_typeid(vm, expression->to_data_type))));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_AND, MIR_new_reg_op(vm->ctx, dest),
-                                   MIR_new_reg_op(vm->ctx, expr),
-                                   MIR_new_int_op(vm->ctx, 0xFFFFFFFFFFFFUL)));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
-      MIR_append_insn(vm->ctx, vm->function, if_false_label);
-
-      generate_panic(vm, "Invalid type cast", expression->type.token);
-
-      MIR_append_insn(vm->ctx, vm->function, cont_label);
+    case TYPE_ANY:
+      generate_any_cast(vm, dest, expr, expression);
       return;
-    }
     default:
       break;
     }
@@ -3675,36 +4672,20 @@ static void generate_cast_expression(CyVM* vm, MIR_reg_t dest, CastExpr* express
     case TYPE_NULL:
       generate_default_initialization(vm, dest, expression->to_data_type);
       return;
-    case TYPE_ANY: {
-      MIR_label_t cont_label = MIR_new_label(vm->ctx);
-      MIR_label_t if_false_label = MIR_new_label(vm->ctx);
-
-      MIR_reg_t id = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_URSH, MIR_new_reg_op(vm->ctx, id),
-                                   MIR_new_reg_op(vm->ctx, expr), MIR_new_int_op(vm->ctx, 48)));
-
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(vm->ctx, MIR_BNE, MIR_new_label_op(vm->ctx, if_false_label),
-                     MIR_new_reg_op(vm->ctx, id),
-                     MIR_new_int_op(vm->ctx, data_type_to_typeid(vm, expression->to_data_type))));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_AND, MIR_new_reg_op(vm->ctx, dest),
-                                   MIR_new_reg_op(vm->ctx, expr),
-                                   MIR_new_int_op(vm->ctx, 0xFFFFFFFFFFFFUL)));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
-      MIR_append_insn(vm->ctx, vm->function, if_false_label);
-
-      generate_panic(vm, "Invalid type cast", expression->type.token);
-
-      MIR_append_insn(vm->ctx, vm->function, cont_label);
+    case TYPE_ANY:
+      generate_any_cast(vm, dest, expr, expression);
       return;
+    default:
+      break;
     }
+  }
+  else if (expression->to_data_type.type == TYPE_STRING_BUILDER)
+  {
+    switch (expression->from_data_type.type)
+    {
+    case TYPE_ANY:
+      generate_any_cast(vm, dest, expr, expression);
+      return;
     default:
       break;
     }
@@ -3791,1247 +4772,3594 @@ static void generate_variable_expression(CyVM* vm, MIR_reg_t dest, VarExpr* expr
   }
 }
 
-static void generate_assignment_expression(CyVM* vm, MIR_reg_t dest, AssignExpr* expression)
-{
-  MIR_reg_t value = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->value_data_type),
-                                      vm->function->u.func);
-  generate_expression(vm, value, expression->value);
+static bool expression_assigns_variable(Expr* expression, VarStmt* variable);
 
-  VarStmt* variable = expression->variable;
-  if (variable)
+static bool expressions_assign_variable(ArrayExpr* expressions, VarStmt* variable)
+{
+  Expr* expression;
+  array_foreach(expressions, expression)
   {
-    switch (variable->scope)
-    {
-    case SCOPE_LOCAL: {
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, variable->reg),
-                                   MIR_new_reg_op(vm->ctx, value)));
-
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
-
-      return;
-    }
+    if (expression_assigns_variable(expression, variable))
+      return true;
+  }
 
-    case SCOPE_GLOBAL: {
-      MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
-                                   MIR_new_ref_op(vm->ctx, expression->variable->item)));
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(
-          vm->ctx, data_type_to_mov_type(expression->data_type),
-          MIR_new_mem_op(vm->ctx, data_type_to_mir_type(expression->data_type), 0, ptr, 0, 1),
-          MIR_new_reg_op(vm->ctx, value)));
+  return false;
+}
 
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+static bool expression_assigns_variable(Expr* expression, VarStmt* variable)
+{
+  if (!expression)
+    return false;
 
-      return;
-    }
+  switch (expression->type)
+  {
+  case EXPR_LITERAL:
+  case EXPR_VAR:
+    return false;
+  case EXPR_ARRAY:
+    return expressions_assign_variable(&expression->array.values, variable);
+  case EXPR_BINARY:
+    return expression_assigns_variable(expression->binary.left, variable) ||
+           expression_assigns_variable(expression->binary.right, variable);
+  case EXPR_UNARY:
+    return expression_assigns_variable(expression->unary.expr, variable);
+  case EXPR_GROUP:
+    return expression_assigns_variable(expression->group.expr, variable);
+  case EXPR_CAST:
+    return expression_assigns_variable(expression->cast.expr, variable);
+  case EXPR_ASSIGN:
+    return expression->assign.variable == variable ||
+           expression_assigns_variable(expression->assign.target, variable) ||
+           expression_assigns_variable(expression->assign.value, variable);
+  case EXPR_CALL:
+    return expression_assigns_variable(expression->call.callee, variable) ||
+           expressions_assign_variable(&expression->call.arguments, variable);
+  case EXPR_ACCESS:
+    return expression_assigns_variable(expression->access.expr, variable);
+  case EXPR_INDEX:
+    return expression_assigns_variable(expression->index.expr, variable) ||
+           expression_assigns_variable(expression->index.index, variable);
+  case EXPR_IS:
+    return expression_assigns_variable(expression->is.expr, variable);
+  case EXPR_IF:
+    return expression_assigns_variable(expression->cond.condition, variable) ||
+           expression_assigns_variable(expression->cond.left, variable) ||
+           expression_assigns_variable(expression->cond.right, variable);
+  }
 
-    case SCOPE_CLASS: {
-      MIR_reg_t ptr;
+  UNREACHABLE("Unhandled expression");
+}
 
-      if (expression->target->type == EXPR_ACCESS)
-      {
-        ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-        generate_expression(vm, ptr, expression->target->access.expr);
-      }
-      else
-      {
-        ptr = MIR_reg(vm->ctx, "this.0", vm->function->u.func);
-      }
+static bool statements_assign_variable(ArrayStmt* statements, VarStmt* variable)
+{
+  Stmt* statement;
+  array_foreach(statements, statement)
+  {
+    switch (statement->type)
+    {
+    case STMT_EXPR:
+      if (expression_assigns_variable(statement->expr.expr, variable))
+        return true;
+      break;
+    case STMT_RETURN:
+      if (expression_assigns_variable(statement->ret.expr, variable))
+        return true;
+      break;
+    case STMT_IF:
+      if (expression_assigns_variable(statement->cond.condition, variable) ||
+          statements_assign_variable(&statement->cond.then_branch, variable) ||
+          statements_assign_variable(&statement->cond.else_branch, variable))
+        return true;
+      break;
+    case STMT_WHILE:
+      if (expression_assigns_variable(statement->loop.condition, variable) ||
+          statements_assign_variable(&statement->loop.initializer, variable) ||
+          statements_assign_variable(&statement->loop.incrementer, variable) ||
+          statements_assign_variable(&statement->loop.body, variable))
+        return true;
+      break;
+    case STMT_VARIABLE_DECL:
+      if (&statement->var == variable ||
+          expression_assigns_variable(statement->var.initializer, variable))
+        return true;
+      break;
+    default:
+      break;
+    }
+  }
 
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        generate_debug_info(expression->op,
-                            MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                         generate_object_field_op(vm, expression->variable, ptr),
-                                         MIR_new_reg_op(vm->ctx, value))));
+  return false;
+}
 
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+static bool data_type_is_scalar(DataType data_type)
+{
+  return data_type.type == TYPE_INTEGER || data_type.type == TYPE_FLOAT ||
+         data_type.type == TYPE_BOOL || data_type.type == TYPE_CHAR;
+}
 
-      return;
-    }
+static bool expression_may_resize(Expr* expression);
 
-    default:
-      UNREACHABLE("Unhandled scope type");
-    }
-  }
-  else
+static bool expressions_may_resize(ArrayExpr* expressions)
+{
+  Expr* expression;
+  array_foreach(expressions, expression)
   {
-    if (expression->target->type != EXPR_INDEX)
-    {
-      UNREACHABLE("Unhandled expression type");
-    }
+    if (expression_may_resize(expression))
+      return true;
+  }
 
-    MIR_reg_t ptr =
-      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->target->index.expr_data_type),
-                        vm->function->u.func);
-    generate_expression(vm, ptr, expression->target->index.expr);
+  return false;
+}
 
-    MIR_reg_t index =
-      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->target->index.index_data_type),
-                        vm->function->u.func);
-    generate_expression(vm, index, expression->target->index.index);
+static bool expression_may_resize(Expr* expression)
+{
+  if (!expression)
+    return false;
 
-    if (expression->target->index.expr_data_type.type == TYPE_OBJECT)
+  switch (expression->type)
+  {
+  case EXPR_LITERAL:
+  case EXPR_VAR:
+    return false;
+  case EXPR_ARRAY:
+    return expressions_may_resize(&expression->array.values);
+  case EXPR_BINARY:
+    return expression->binary.function || expression_may_resize(expression->binary.left) ||
+           expression_may_resize(expression->binary.right);
+  case EXPR_UNARY:
+    return expression_may_resize(expression->unary.expr);
+  case EXPR_GROUP:
+    return expression_may_resize(expression->group.expr);
+  case EXPR_CAST:
+    if (expression->cast.to_data_type.type == TYPE_STRING &&
+        !data_type_is_scalar(expression->cast.from_data_type) &&
+        expression->cast.from_data_type.type != TYPE_STRING)
+      return true;
+
+    return expression_may_resize(expression->cast.expr);
+  case EXPR_ASSIGN:
+    return expression->assign.function || expression_may_resize(expression->assign.target) ||
+           expression_may_resize(expression->assign.value);
+  case EXPR_CALL: {
+    DataType callee = expression->call.callee_data_type;
+    if (callee.type == TYPE_FUNCTION_INTERNAL)
     {
-      if (expression->function->data_type.type == TYPE_VOID)
-        MIR_append_insn(
-          vm->ctx, vm->function,
-          MIR_new_call_insn(vm->ctx, 5, MIR_new_ref_op(vm->ctx, expression->function->proto),
-                            MIR_new_ref_op(vm->ctx, expression->function->item),
-                            MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
-                            MIR_new_reg_op(vm->ctx, value)));
-      else
-        MIR_append_insn(
-          vm->ctx, vm->function,
-          MIR_new_call_insn(vm->ctx, 6, MIR_new_ref_op(vm->ctx, expression->function->proto),
-                            MIR_new_ref_op(vm->ctx, expression->function->item),
-                            MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, ptr),
-                            MIR_new_reg_op(vm->ctx, index), MIR_new_reg_op(vm->ctx, value)));
+      const char* name = callee.function_internal.name;
+      if (strcmp(name, "array.pop") == 0 || strcmp(name, "array.clear") == 0 ||
+          strcmp(name, "array.remove") == 0)
+        return true;
     }
-    else
+    else if (callee.type != TYPE_FUNCTION || !expression->call.function->pure)
     {
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
-                                   MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
-                                   generate_array_length_op(vm, ptr)));
-
-      MIR_reg_t array_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        generate_debug_info(expression->op,
-                            MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, array_ptr),
-                                         generate_array_data_op(vm, ptr))));
+      return true;
+    }
 
-      DataType element_data_type =
-        array_data_type_element(expression->target->index.expr_data_type);
+    return expression_may_resize(expression->call.callee) ||
+           expressions_may_resize(&expression->call.arguments);
+  }
+  case EXPR_ACCESS:
+    return expression_may_resize(expression->access.expr);
+  case EXPR_INDEX:
+    return expression->index.function || expression_may_resize(expression->index.expr) ||
+           expression_may_resize(expression->index.index);
+  case EXPR_IS:
+    return expression_may_resize(expression->is.expr);
+  case EXPR_IF:
+    return expression_may_resize(expression->cond.condition) ||
+           expression_may_resize(expression->cond.left) ||
+           expression_may_resize(expression->cond.right);
+  }
 
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
-                     MIR_new_mem_op(vm->ctx, data_type_to_sized_mir_type(element_data_type), 0,
-                                    array_ptr, index, size_data_type(element_data_type)),
-                     MIR_new_reg_op(vm->ctx, value)));
+  UNREACHABLE("Unhandled expression");
+}
 
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
-                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+static bool statements_may_resize(ArrayStmt* statements)
+{
+  Stmt* statement;
+  array_foreach(statements, statement)
+  {
+    switch (statement->type)
+    {
+    case STMT_EXPR:
+      if (expression_may_resize(statement->expr.expr))
+        return true;
+      break;
+    case STMT_RETURN:
+      if (expression_may_resize(statement->ret.expr))
+        return true;
+      break;
+    case STMT_IF:
+      if (expression_may_resize(statement->cond.condition) ||
+          statements_may_resize(&statement->cond.then_branch) ||
+          statements_may_resize(&statement->cond.else_branch))
+        return true;
+      break;
+    case STMT_WHILE:
+      if (expression_may_resize(statement->loop.condition) ||
+          statements_may_resize(&statement->loop.initializer) ||
+          statements_may_resize(&statement->loop.incrementer) ||
+          statements_may_resize(&statement->loop.body))
+        return true;
+      break;
+    case STMT_VARIABLE_DECL:
+      if (expression_may_resize(statement->var.initializer))
+        return true;
+      break;
+    default:
+      break;
     }
   }
+
+  return false;
 }
 
-static void generate_call_expression(CyVM* vm, MIR_reg_t dest, CallExpr* expression)
+static bool is_integer_literal(Expr* expression, unsigned int value)
 {
-  MIR_item_t proto = NULL;
-  MIR_item_t func = NULL;
+  return expression->type == EXPR_LITERAL && expression->literal.data_type.type == TYPE_INTEGER &&
+         expression->literal.integer == value;
+}
 
-  if (expression->callee_data_type.type == TYPE_ALIAS)
-  {
-    generate_default_initialization(vm, dest, *expression->callee_data_type.alias.data_type);
+// Recognizes "for int i = 0; i < a.length; i += 1" and the loops "for x in a" turns into. The
+// counter then always indexes "a" in bounds inside the body, as long as the body cannot assign
+// either variable or shrink the array.
+static void init_loop_bounds(Loop* loop, WhileStmt* statement)
+{
+  Expr* condition = statement->condition;
+  if (!condition || condition->type != EXPR_BINARY || condition->binary.op.type != TOKEN_LESS ||
+      condition->binary.function)
     return;
-  }
-  else if (expression->callee_data_type.type == TYPE_FUNCTION_INTERNAL)
-  {
-    Function* internal = generate_function_internal(vm, expression->callee_data_type);
-    proto = internal->proto;
-    func = internal->func;
-  }
-  else if (expression->callee_data_type.type == TYPE_PROTOTYPE)
-  {
-    proto = expression->function->proto_prototype;
-    func = expression->function->item_prototype;
-  }
-  else if (expression->callee_data_type.type == TYPE_FUNCTION_POINTER)
-  {
-    proto = data_type_to_proto(vm, expression->callee_data_type);
-  }
-  else
-  {
-    proto = expression->function->proto;
-    func = expression->function->item;
-  }
 
-  assert(proto != NULL);
+  Expr* left = condition->binary.left;
+  Expr* right = condition->binary.right;
+  if (left->type != EXPR_VAR || right->type != EXPR_ACCESS ||
+      right->access.expr->type != EXPR_VAR || strcmp(right->access.name.lexeme, "length") != 0)
+    return;
 
-  ArrayMIR_op_t arguments;
-  array_init(&arguments);
-  array_add(&arguments, MIR_new_ref_op(vm->ctx, proto));
+  VarStmt* counter = left->var.variable;
+  VarStmt* bound = right->access.expr->var.variable;
+  if (!counter || !bound || counter->scope != SCOPE_LOCAL || bound->scope != SCOPE_LOCAL ||
+      counter->data_type.type != TYPE_INTEGER ||
+      (right->access.expr_data_type.type != TYPE_ARRAY &&
+       right->access.expr_data_type.type != TYPE_STRING))
+    return;
 
-  if (expression->callee_data_type.type == TYPE_FUNCTION_POINTER)
+  bool initialized = false;
+  Stmt* initializer;
+  array_foreach(&statement->initializer, initializer)
   {
-    MIR_reg_t callee_ptr = _MIR_new_temp_reg(
-      vm->ctx, data_type_to_mir_type(expression->callee_data_type), vm->function->u.func);
-    generate_expression(vm, callee_ptr, expression->callee);
+    if (initializer->type != STMT_VARIABLE_DECL || &initializer->var != counter)
+      continue;
 
-    array_add(&arguments, MIR_new_reg_op(vm->ctx, callee_ptr));
+    Expr* value = counter->initializer;
+    initialized = !value || (value->type == EXPR_LITERAL &&
+                             value->literal.data_type.type == TYPE_INTEGER &&
+                             (int)value->literal.integer >= 0);
   }
-  else
-  {
-    assert(func != NULL);
 
-    array_add(&arguments, MIR_new_ref_op(vm->ctx, func));
-  }
+  if (!initialized || statement->incrementer.size != 1)
+    return;
 
-  if (expression->return_data_type.type != TYPE_VOID)
-    array_add(&arguments, MIR_new_reg_op(vm->ctx, dest));
+  Stmt* incrementer = array_at(&statement->incrementer, 0);
+  if (incrementer->type != STMT_EXPR || incrementer->expr.expr->type != EXPR_ASSIGN)
+    return;
 
-  Expr* argument;
-  array_foreach(&expression->arguments, argument)
-  {
-    MIR_reg_t temp =
-      _MIR_new_temp_reg(vm->ctx, sized_mir_type_to_mir_type(proto->u.proto->args->varr[_i].type),
-                        vm->function->u.func);
-    generate_expression(vm, temp, argument);
+  AssignExpr* increment = &incrementer->expr.expr->assign;
+  Expr* value = increment->value;
+  if (increment->variable != counter || value->type != EXPR_BINARY ||
+      value->binary.op.type != TOKEN_PLUS || value->binary.function ||
+      value->binary.left->type != EXPR_VAR || value->binary.left->var.variable != counter ||
+      !is_integer_literal(value->binary.right, 1))
+    return;
 
-    array_add(&arguments, MIR_new_reg_op(vm->ctx, temp));
-  }
+  if (statements_assign_variable(&statement->body, counter) ||
+      statements_assign_variable(&statement->body, bound))
+    return;
 
-  MIR_append_insn(
-    vm->ctx, vm->function,
-    generate_debug_info(expression->callee_token,
-                        MIR_new_insn_arr(vm->ctx, MIR_CALL, arguments.size, arguments.elems)));
+  if (right->access.expr_data_type.type == TYPE_ARRAY && statements_may_resize(&statement->body))
+    return;
+
+  loop->counter = counter;
+  loop->bound = bound;
 }
 
-static void generate_access_expression(CyVM* vm, MIR_reg_t dest, AccessExpr* expression)
+static bool is_bounded_index(CyVM* vm, Expr* expression, Expr* index)
 {
-  if (expression->data_type.type == TYPE_FUNCTION ||
-      expression->data_type.type == TYPE_FUNCTION_MEMBER ||
-      expression->data_type.type == TYPE_FUNCTION_INTERNAL)
+  if (expression->type != EXPR_VAR || index->type != EXPR_VAR)
+    return false;
+
+  for (Loop* loop = vm->loop; loop && loop->function == vm->function; loop = loop->parent)
   {
-    generate_function_pointer(vm, dest, expression->data_type);
-    return;
+    if (loop->counter && loop->counter == index->var.variable &&
+        loop->bound == expression->var.variable)
+      return true;
   }
 
-  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->expr_data_type),
-                                    vm->function->u.func);
-  generate_expression(vm, ptr, expression->expr);
+  return false;
+}
 
-  if (expression->expr_data_type.type == TYPE_STRING)
-  {
-    if (strcmp(expression->name.lexeme, "length") == 0)
-    {
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, dest),
-                                   generate_string_length_op(vm, ptr)));
+static bool is_self_append(Expr* expression, VarStmt* variable)
+{
+  if (expression->type != EXPR_ASSIGN || expression->assign.variable != variable)
+    return false;
 
-      return;
-    }
+  Expr* value = expression->assign.value;
+  if (value->type != EXPR_BINARY || value->binary.op.type != TOKEN_PLUS ||
+      value->binary.left_data_type.type != TYPE_STRING)
+    return false;
 
-    UNREACHABLE("Unhandled string access name");
-  }
-  else if (expression->expr_data_type.type == TYPE_ARRAY)
+  ArrayExpr parts = collect_string_parts(&value->binary);
+  Expr* first = array_at(&parts, 0);
+
+  return first->type == EXPR_VAR && first->var.variable == variable;
+}
+
+static bool expression_only_appends(Expr* expression, VarStmt* variable);
+
+static bool expressions_only_append(ArrayExpr* expressions, VarStmt* variable)
+{
+  Expr* expression;
+  array_foreach(expressions, expression)
   {
-    if (strcmp(expression->name.lexeme, "length") == 0)
-    {
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, dest),
-                                   generate_array_length_op(vm, ptr)));
-      return;
-    }
-    else if (strcmp(expression->name.lexeme, "capacity") == 0)
-    {
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                   MIR_new_reg_op(vm->ctx, dest),
-                                   generate_array_capacity_op(vm, ptr)));
-      return;
-    }
-
-    UNREACHABLE("Unhandled array access name");
+    if (!expression_only_appends(expression, variable))
+      return false;
   }
-  else
-  {
-    MIR_append_insn(
-      vm->ctx, vm->function,
-      generate_debug_info(expression->name,
-                          MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                       MIR_new_reg_op(vm->ctx, dest),
-                                       generate_object_field_op(vm, expression->variable, ptr))));
 
-    return;
-  }
+  return true;
 }
 
-static void generate_index_expression(CyVM* vm, MIR_reg_t dest, IndexExpr* expression)
+// Returns whether [variable] is only appended to, or has its length or characters read, so no other
+// reference to it can be made while it is being appended to in place.
+static bool expression_only_appends(Expr* expression, VarStmt* variable)
 {
-  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->expr_data_type),
-                                    vm->function->u.func);
-  generate_expression(vm, ptr, expression->expr);
-
-  MIR_reg_t index = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->index_data_type),
-                                      vm->function->u.func);
-  generate_expression(vm, index, expression->index);
+  if (!expression)
+    return true;
 
-  switch (expression->expr_data_type.type)
+  switch (expression->type)
   {
-  case TYPE_STRING: {
-    MIR_reg_t length = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, length),
-                                 generate_string_length_op(vm, ptr)));
+  case EXPR_LITERAL:
+    return true;
+  case EXPR_VAR:
+    return expression->var.variable != variable;
+  case EXPR_ARRAY:
+    return expressions_only_append(&expression->array.values, variable);
+  case EXPR_BINARY:
+    return expression_only_appends(expression->binary.left, variable) &&
+           expression_only_appends(expression->binary.right, variable);
+  case EXPR_UNARY:
+    return expression_only_appends(expression->unary.expr, variable);
+  case EXPR_GROUP:
+    return expression_only_appends(expression->group.expr, variable);
+  case EXPR_CAST:
+    return expression_only_appends(expression->cast.expr, variable);
+  case EXPR_ASSIGN:
+    // An append used as a value hands out the buffer, which later appends would overwrite.
+    if (expression->assign.variable == variable)
+      return false;
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
-                                 MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
-                                 MIR_new_reg_op(vm->ctx, length)));
+    return expression_only_appends(expression->assign.target, variable) &&
+           expression_only_appends(expression->assign.value, variable);
+  case EXPR_CALL:
+    return expression_only_appends(expression->call.callee, variable) &&
+           expressions_only_append(&expression->call.arguments, variable);
+  case EXPR_ACCESS:
+    if (expression->access.expr->type == EXPR_VAR &&
+        expression->access.expr->var.variable == variable)
+      return strcmp(expression->access.name.lexeme, "length") == 0;
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, index),
-                                 MIR_new_reg_op(vm->ctx, index), MIR_new_reg_op(vm->ctx, index),
-                                 MIR_new_reg_op(vm->ctx, length)));
+    return expression_only_appends(expression->access.expr, variable);
+  case EXPR_INDEX:
+    if (expression->index.expr->type == EXPR_VAR &&
+        expression->index.expr->var.variable == variable)
+      return expression_only_appends(expression->index.index, variable);
 
-    MIR_append_insn(
-      vm->ctx, vm->function,
-      generate_debug_info(expression->index_token,
-                          MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
-                                       MIR_new_reg_op(vm->ctx, dest),
-                                       generate_string_at_op(vm, ptr, index))));
-    return;
+    return expression_only_appends(expression->index.expr, variable) &&
+           expression_only_appends(expression->index.index, variable);
+  case EXPR_IS:
+    return expression_only_appends(expression->is.expr, variable);
+  case EXPR_IF:
+    return expression_only_appends(expression->cond.condition, variable) &&
+           expression_only_appends(expression->cond.left, variable) &&
+           expression_only_appends(expression->cond.right, variable);
   }
-  case TYPE_ARRAY: {
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
-                                 MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
-                                 generate_array_length_op(vm, ptr)));
 
-    MIR_reg_t array_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-
-    MIR_append_insn(
-      vm->ctx, vm->function,
-      generate_debug_info(expression->index_token,
-                          MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, array_ptr),
-                                       generate_array_data_op(vm, ptr))));
+  UNREACHABLE("Unhandled expression");
+}
 
-    DataType element_data_type = array_data_type_element(expression->expr_data_type);
+// Appends to [variable] are only done in place when they make up a whole statement, as their
+// result is not used then.
+static bool statement_only_appends(Expr* expression, VarStmt* variable)
+{
+  if (expression->type != EXPR_ASSIGN || expression->assign.variable != variable)
+    return expression_only_appends(expression, variable);
 
-    MIR_append_insn(
-      vm->ctx, vm->function,
-      generate_debug_info(
-        expression->index_token,
-        MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
-                     MIR_new_reg_op(vm->ctx, dest),
-                     MIR_new_mem_op(vm->ctx, data_type_to_sized_mir_type(element_data_type), 0,
-                                    array_ptr, index, size_data_type(element_data_type)))));
+  if (!is_self_append(expression, variable))
+    return false;
 
-    return;
+  ArrayExpr parts = collect_string_parts(&expression->assign.value->binary);
+  for (unsigned int i = 1; i < parts.size; i++)
+  {
+    if (!expression_only_appends(array_at(&parts, i), variable))
+      return false;
   }
-  case TYPE_OBJECT: {
-    if (expression->function->data_type.type == TYPE_VOID)
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_call_insn(vm->ctx, 4, MIR_new_ref_op(vm->ctx, expression->function->proto),
-                          MIR_new_ref_op(vm->ctx, expression->function->item),
-                          MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index)));
-    else
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_call_insn(vm->ctx, 5,
-                                        MIR_new_ref_op(vm->ctx, expression->function->proto),
-                                        MIR_new_ref_op(vm->ctx, expression->function->item),
-                                        MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, ptr),
-                                        MIR_new_reg_op(vm->ctx, index)));
 
-    return;
-  }
-  default:
-    UNREACHABLE("Unhandled index type");
-  }
+  return true;
 }
 
-static void generate_array_expression(CyVM* vm, MIR_reg_t dest, LiteralArrayExpr* expression)
+static bool statements_only_append(ArrayStmt* statements, VarStmt* variable)
 {
-  if (expression->values.size)
+  Stmt* statement;
+  array_foreach(statements, statement)
   {
-    MIR_reg_t array_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-    DataType element_data_type = array_data_type_element(expression->data_type);
-
-    generate_malloc_expression(vm, dest, MIR_new_int_op(vm->ctx, sizeof(CyArray)));
+    switch (statement->type)
+    {
+    case STMT_EXPR:
+      if (!statement_only_appends(statement->expr.expr, variable))
+        return false;
+      break;
+    case STMT_RETURN:
+      if (!expression_only_appends(statement->ret.expr, variable))
+        return false;
+      break;
+    case STMT_IF:
+      if (!expression_only_appends(statement->cond.condition, variable) ||
+          !statements_only_append(&statement->cond.then_branch, variable) ||
+          !statements_only_append(&statement->cond.else_branch, variable))
+        return false;
+      break;
+    case STMT_WHILE:
+      if (!expression_only_appends(statement->loop.condition, variable) ||
+          !statements_only_append(&statement->loop.initializer, variable) ||
+          !statements_only_append(&statement->loop.incrementer, variable) ||
+          !statements_only_append(&statement->loop.body, variable))
+        return false;
+      break;
+    case STMT_VARIABLE_DECL:
+      if (&statement->var == variable ||
+          !expression_only_appends(statement->var.initializer, variable))
+        return false;
+      break;
+    default:
+      break;
+    }
+  }
 
-    if (data_type_is_pointer(element_data_type))
-      generate_malloc_expression(
-        vm, array_ptr,
-        MIR_new_int_op(vm->ctx, size_data_type(element_data_type) * expression->values.size));
-    else
-      generate_malloc_atomic_expression(
-        vm, array_ptr,
-        MIR_new_int_op(vm->ctx, size_data_type(element_data_type) * expression->values.size));
+  return true;
+}
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_MOV, generate_array_length_op(vm, dest),
-                                 MIR_new_int_op(vm->ctx, expression->values.size)));
+static void collect_self_appends(ArrayStmt* statements, ArrayVarStmt* variables)
+{
+  Stmt* statement;
+  array_foreach(statements, statement)
+  {
+    switch (statement->type)
+    {
+    case STMT_EXPR: {
+      Expr* expression = statement->expr.expr;
+      if (expression->type != EXPR_ASSIGN)
+        break;
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_MOV, generate_array_capacity_op(vm, dest),
-                                 MIR_new_int_op(vm->ctx, expression->values.size)));
+      VarStmt* variable = expression->assign.variable;
+      if (!variable || variable->scope != SCOPE_LOCAL || !is_self_append(expression, variable))
+        break;
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_MOV, generate_array_data_op(vm, dest),
-                                 MIR_new_reg_op(vm->ctx, array_ptr)));
+      bool found = false;
+      VarStmt* existing;
+      array_foreach(variables, existing)
+      {
+        found |= existing == variable;
+      }
 
-    MIR_reg_t item =
-      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(element_data_type), vm->function->u.func);
-    Expr* value;
-    array_foreach(&expression->values, value)
-    {
-      generate_expression(vm, item, value);
+      if (!found)
+        array_add(variables, variable);
 
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
-                     MIR_new_mem_op(vm->ctx, data_type_to_sized_mir_type(element_data_type),
-                                    _i * size_data_type(element_data_type), array_ptr, 0, 1),
-                     MIR_new_reg_op(vm->ctx, item)));
+      break;
+    }
+    case STMT_IF:
+      collect_self_appends(&statement->cond.then_branch, variables);
+      collect_self_appends(&statement->cond.else_branch, variables);
+      break;
+    case STMT_WHILE:
+      collect_self_appends(&statement->loop.body, variables);
+      break;
+    default:
+      break;
     }
   }
-  else
+}
+
+static StringAppend* find_string_append(CyVM* vm, VarStmt* variable)
+{
+  for (Loop* loop = vm->loop; loop && loop->function == vm->function; loop = loop->parent)
   {
-    generate_default_array_initialization(vm, dest);
+    for (unsigned int i = 0; i < loop->appends.size; i++)
+    {
+      if (loop->appends.elems[i].variable == variable)
+        return &loop->appends.elems[i];
+    }
   }
+
+  return NULL;
 }
 
-static void generate_is_expression(CyVM* vm, MIR_reg_t dest, IsExpr* expression)
+// Strings built with "s = s + part" inside a loop are appended to in place, which turns the
+// quadratic copying into amortized linear time. This is only done when the loop cannot otherwise
+// reference the string, as the buffer is shared with nothing until the loop is left.
+static void init_loop_appends(CyVM* vm, Loop* loop, WhileStmt* statement)
 {
-  if (expression->is_data_type.type == TYPE_ANY)
-  {
-    generate_expression(vm, dest, expression->expr);
+  ArrayVarStmt variables;
+  array_init(&variables);
+  collect_self_appends(&statement->body, &variables);
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_NE, MIR_new_reg_op(vm->ctx, dest),
-                                 MIR_new_reg_op(vm->ctx, dest), MIR_new_int_op(vm->ctx, 0)));
-    return;
-  }
+  VarStmt* variable;
+  array_foreach(&variables, variable)
+  {
+    if (find_string_append(vm, variable))
+      continue;
 
-  generate_expression(vm, dest, expression->expr);
+    if (!expression_only_appends(statement->condition, variable) ||
+        !statements_only_append(&statement->incrementer, variable) ||
+        !statements_only_append(&statement->body, variable))
+      continue;
 
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_URSH, MIR_new_reg_op(vm->ctx, dest),
-                               MIR_new_reg_op(vm->ctx, dest), MIR_new_int_op(vm->ctx, 48)));
+    StringAppend append = {
+      .variable = variable,
+      .owner = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func),
+    };
 
-  uint64_t id = data_type_to_typeid(vm, expression->is_data_type);
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_EQ, MIR_new_reg_op(vm->ctx, dest),
-                               MIR_new_reg_op(vm->ctx, dest), MIR_new_int_op(vm->ctx, id)));
+    array_add(&loop->appends, append);
+  }
 }
 
-static void generate_if_expression(CyVM* vm, MIR_reg_t dest, IfExpr* expression)
+static void generate_string_append(CyVM* vm, MIR_reg_t dest, AssignExpr* expression,
+                                   StringAppend* append)
 {
-  MIR_reg_t condition =
-    _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_BOOL)), vm->function->u.func);
-  generate_expression(vm, condition, expression->condition);
+  Function* string_append = generate_string_append_function(vm);
+  MIR_reg_t string = append->variable->reg;
 
-  MIR_label_t cont_label = MIR_new_label(vm->ctx);
-  MIR_label_t if_false_label = MIR_new_label(vm->ctx);
+  ArrayExpr parts = collect_string_parts(&expression->value->binary);
+  ArrayMIR_reg_t regs;
+  array_init(&regs);
 
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_BFS, MIR_new_label_op(vm->ctx, if_false_label),
-                               MIR_new_reg_op(vm->ctx, condition)));
+  for (unsigned int i = 1; i < parts.size; i++)
+  {
+    MIR_reg_t part = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_STRING)),
+                                       vm->function->u.func);
+    generate_expression(vm, part, array_at(&parts, i));
 
-  generate_expression(vm, dest, expression->left);
+    array_add(&regs, part);
+  }
 
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
+  MIR_reg_t part;
+  array_foreach(&regs, part)
+  {
+    MIR_insn_t call = MIR_new_call_insn(
+      vm->ctx, 6, MIR_new_ref_op(vm->ctx, string_append->proto),
+      MIR_new_ref_op(vm->ctx, string_append->func), MIR_new_reg_op(vm->ctx, string),
+      MIR_new_reg_op(vm->ctx, string), MIR_new_reg_op(vm->ctx, part),
+      MIR_new_reg_op(vm->ctx, append->owner));
 
-  MIR_append_insn(vm->ctx, vm->function, if_false_label);
+    MIR_append_insn(vm->ctx, vm->function, generate_debug_info(expression->op, call));
 
-  generate_expression(vm, dest, expression->right);
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, append->owner),
+                                 MIR_new_reg_op(vm->ctx, string)));
+  }
 
-  MIR_append_insn(vm->ctx, vm->function, cont_label);
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, dest),
+                               MIR_new_reg_op(vm->ctx, string)));
 }
 
-static void generate_expression(CyVM* vm, MIR_reg_t dest, Expr* expression)
+static void generate_assignment_expression(CyVM* vm, MIR_reg_t dest, AssignExpr* expression)
 {
-  switch (expression->type)
+  StringAppend* append = expression->variable && expression->variable->scope == SCOPE_LOCAL
+                           ? find_string_append(vm, expression->variable)
+                           : NULL;
+  if (append)
   {
-  case EXPR_LITERAL:
-    generate_literal_expression(vm, dest, &expression->literal);
-    return;
-  case EXPR_BINARY:
-    generate_binary_expression(vm, dest, &expression->binary);
-    return;
-  case EXPR_GROUP:
-    generate_group_expression(vm, dest, &expression->group);
-    return;
-  case EXPR_UNARY:
-    generate_unary_expression(vm, dest, &expression->unary);
-    return;
-  case EXPR_VAR:
-    generate_variable_expression(vm, dest, &expression->var);
-    return;
-  case EXPR_ASSIGN:
-    generate_assignment_expression(vm, dest, &expression->assign);
+    generate_string_append(vm, dest, expression, append);
     return;
-  case EXPR_CALL:
-    generate_call_expression(vm, dest, &expression->call);
-    return;
-  case EXPR_CAST:
-    generate_cast_expression(vm, dest, &expression->cast);
-    return;
-  case EXPR_ACCESS:
-    generate_access_expression(vm, dest, &expression->access);
+  }
+
+  MIR_reg_t value = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->value_data_type),
+                                      vm->function->u.func);
+  generate_expression(vm, value, expression->value);
+
+  VarStmt* variable = expression->variable;
+  if (variable)
+  {
+    switch (variable->scope)
+    {
+    case SCOPE_LOCAL: {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, variable->reg),
+                                   MIR_new_reg_op(vm->ctx, value)));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+
+      return;
+    }
+
+    case SCOPE_GLOBAL: {
+      MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                                   MIR_new_ref_op(vm->ctx, expression->variable->item)));
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        MIR_new_insn(
+          vm->ctx, data_type_to_mov_type(expression->data_type),
+          MIR_new_mem_op(vm->ctx, data_type_to_mir_type(expression->data_type), 0, ptr, 0, 1),
+          MIR_new_reg_op(vm->ctx, value)));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+
+      return;
+    }
+
+    case SCOPE_CLASS: {
+      MIR_reg_t ptr;
+
+      if (expression->target->type == EXPR_ACCESS)
+      {
+        ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+        generate_expression(vm, ptr, expression->target->access.expr);
+      }
+      else
+      {
+        ptr = MIR_reg(vm->ctx, "this.0", vm->function->u.func);
+      }
+
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        generate_debug_info(expression->op,
+                            MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                         generate_object_field_op(vm, expression->variable, ptr),
+                                         MIR_new_reg_op(vm->ctx, value))));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+
+      return;
+    }
+
+    default:
+      UNREACHABLE("Unhandled scope type");
+    }
+  }
+  else
+  {
+    if (expression->target->type != EXPR_INDEX)
+    {
+      UNREACHABLE("Unhandled expression type");
+    }
+
+    MIR_reg_t ptr =
+      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->target->index.expr_data_type),
+                        vm->function->u.func);
+    generate_expression(vm, ptr, expression->target->index.expr);
+
+    MIR_reg_t index =
+      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->target->index.index_data_type),
+                        vm->function->u.func);
+    generate_expression(vm, index, expression->target->index.index);
+
+    if (expression->target->index.expr_data_type.type == TYPE_OBJECT)
+    {
+      if (expression->function->data_type.type == TYPE_VOID)
+        MIR_append_insn(
+          vm->ctx, vm->function,
+          MIR_new_call_insn(vm->ctx, 5, MIR_new_ref_op(vm->ctx, expression->function->proto),
+                            MIR_new_ref_op(vm->ctx, expression->function->item),
+                            MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
+                            MIR_new_reg_op(vm->ctx, value)));
+      else
+        MIR_append_insn(
+          vm->ctx, vm->function,
+          MIR_new_call_insn(vm->ctx, 6, MIR_new_ref_op(vm->ctx, expression->function->proto),
+                            MIR_new_ref_op(vm->ctx, expression->function->item),
+                            MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, ptr),
+                            MIR_new_reg_op(vm->ctx, index), MIR_new_reg_op(vm->ctx, value)));
+    }
+    else
+    {
+      generate_index_extension(vm, index);
+
+      if (!is_bounded_index(vm, expression->target->index.expr, expression->target->index.index))
+        MIR_append_insn(vm->ctx, vm->function,
+                        MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
+                                     MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
+                                     generate_array_length_op(vm, ptr)));
+
+      MIR_reg_t array_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        generate_debug_info(expression->op,
+                            MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, array_ptr),
+                                         generate_array_data_op(vm, ptr))));
+
+      DataType element_data_type =
+        array_data_type_element(expression->target->index.expr_data_type);
+
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
+                     MIR_new_mem_op(vm->ctx, data_type_to_sized_mir_type(element_data_type), 0,
+                                    array_ptr, index, size_data_type(element_data_type)),
+                     MIR_new_reg_op(vm->ctx, value)));
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
+                                   MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, value)));
+    }
+  }
+}
+
+static bool is_loop_invariant(Expr* expression, WhileStmt* loop)
+{
+  switch (expression->type)
+  {
+  case EXPR_LITERAL:
+    return true;
+  case EXPR_GROUP:
+    return is_loop_invariant(expression->group.expr, loop);
+  case EXPR_CAST:
+    return data_type_is_scalar(expression->cast.from_data_type) &&
+           data_type_is_scalar(expression->cast.to_data_type) &&
+           is_loop_invariant(expression->cast.expr, loop);
+  case EXPR_VAR: {
+    VarStmt* variable = expression->var.variable;
+    if (!variable || variable->scope != SCOPE_LOCAL)
+      return false;
+
+    // Arrays and objects can change without the variable being assigned, strings cannot.
+    if (!data_type_is_scalar(variable->data_type) && variable->data_type.type != TYPE_STRING)
+      return false;
+
+    return !expression_assigns_variable(loop->condition, variable) &&
+           !statements_assign_variable(&loop->incrementer, variable) &&
+           !statements_assign_variable(&loop->body, variable);
+  }
+  default:
+    return false;
+  }
+}
+
+static bool is_loop_invariant_call(CallExpr* expression, WhileStmt* loop)
+{
+  Expr* argument;
+  array_foreach(&expression->arguments, argument)
+  {
+    if (!is_loop_invariant(argument, loop))
+      return false;
+  }
+
+  return true;
+}
+
+static bool is_same_argument(Expr* left, Expr* right)
+{
+  while (left->type == EXPR_GROUP)
+    left = left->group.expr;
+  while (right->type == EXPR_GROUP)
+    right = right->group.expr;
+
+  if (left->type != right->type)
+    return false;
+
+  switch (left->type)
+  {
+  case EXPR_LITERAL: {
+    LiteralExpr* a = &left->literal;
+    LiteralExpr* b = &right->literal;
+    if (a->data_type.type != b->data_type.type)
+      return false;
+
+    switch (a->data_type.type)
+    {
+    case TYPE_INTEGER:
+      return a->integer == b->integer;
+    case TYPE_FLOAT:
+      return memcmp(&a->floating, &b->floating, sizeof(a->floating)) == 0;
+    case TYPE_BOOL:
+      return a->boolean == b->boolean;
+    case TYPE_NULL:
+      return true;
+    case TYPE_CHAR:
+      return a->string.data[0] == b->string.data[0];
+    case TYPE_STRING:
+      return a->string.length == b->string.length &&
+             memcmp(a->string.data, b->string.data, a->string.length) == 0;
+    default:
+      return false;
+    }
+  }
+  case EXPR_CAST:
+    return left->cast.to_data_type.type == right->cast.to_data_type.type &&
+           is_same_argument(left->cast.expr, right->cast.expr);
+  case EXPR_VAR:
+    return left->var.variable == right->var.variable;
+  default:
+    return false;
+  }
+}
+
+static void generate_call(CyVM* vm, MIR_reg_t dest, CallExpr* expression);
+
+static bool generate_hoisted_call(CyVM* vm, MIR_reg_t dest, CallExpr* expression)
+{
+  Loop* target = NULL;
+  for (Loop* loop = vm->loop; loop && loop->function == vm->function; loop = loop->parent)
+  {
+    if (!is_loop_invariant_call(expression, loop->statement))
+      break;
+
+    target = loop;
+  }
+
+  if (!target)
+    return false;
+
+  MIR_reg_t reg = 0;
+
+  HoistedCall call;
+  array_foreach(&target->calls, call)
+  {
+    if (call.expression->function != expression->function)
+      continue;
+
+    bool same = true;
+    for (unsigned int i = 0; i < expression->arguments.size && same; i++)
+      same = is_same_argument(call.expression->arguments.elems[i], expression->arguments.elems[i]);
+
+    if (same)
+    {
+      reg = call.reg;
+      break;
+    }
+  }
+
+  if (!reg)
+  {
+    reg = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->return_data_type),
+                            vm->function->u.func);
+
+    MIR_insn_t last = DLIST_TAIL(MIR_insn_t, vm->function->u.func->insns);
+    generate_call(vm, reg, expression);
+
+    MIR_insn_t insn = DLIST_NEXT(MIR_insn_t, last);
+    while (insn)
+    {
+      MIR_insn_t next = DLIST_NEXT(MIR_insn_t, insn);
+      DLIST_REMOVE(MIR_insn_t, vm->function->u.func->insns, insn);
+      MIR_insert_insn_before(vm->ctx, vm->function, target->label, insn);
+      insn = next;
+    }
+
+    HoistedCall hoisted = { .expression = expression, .reg = reg };
+    array_add(&target->calls, hoisted);
+  }
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->return_data_type),
+                               MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, reg)));
+
+  return true;
+}
+
+static void generate_call_expression(CyVM* vm, MIR_reg_t dest, CallExpr* expression)
+{
+  if (expression->callee_data_type.type == TYPE_FUNCTION && expression->function->pure &&
+      expression->return_data_type.type != TYPE_VOID && generate_hoisted_call(vm, dest, expression))
+    return;
+
+  generate_call(vm, dest, expression);
+}
+
+static void generate_call(CyVM* vm, MIR_reg_t dest, CallExpr* expression)
+{
+  MIR_item_t proto = NULL;
+  MIR_item_t func = NULL;
+
+  if (expression->callee_data_type.type == TYPE_ALIAS)
+  {
+    generate_default_initialization(vm, dest, *expression->callee_data_type.alias.data_type);
+    return;
+  }
+  else if (expression->callee_data_type.type == TYPE_FUNCTION_INTERNAL)
+  {
+    Function* internal = generate_function_internal(vm, expression->callee_data_type);
+    proto = internal->proto;
+    func = internal->func;
+  }
+  else if (expression->callee_data_type.type == TYPE_PROTOTYPE)
+  {
+    proto = expression->function->proto_prototype;
+    func = expression->function->item_prototype;
+  }
+  else if (expression->callee_data_type.type == TYPE_FUNCTION_POINTER)
+  {
+    proto = data_type_to_proto(vm, expression->callee_data_type);
+  }
+  else
+  {
+    proto = expression->function->proto;
+    func = expression->function->item;
+  }
+
+  assert(proto != NULL);
+
+  ArrayMIR_op_t arguments;
+  array_init(&arguments);
+  array_add(&arguments, MIR_new_ref_op(vm->ctx, proto));
+
+  if (expression->callee_data_type.type == TYPE_FUNCTION_POINTER)
+  {
+    MIR_reg_t callee_ptr = _MIR_new_temp_reg(
+      vm->ctx, data_type_to_mir_type(expression->callee_data_type), vm->function->u.func);
+    generate_expression(vm, callee_ptr, expression->callee);
+
+    array_add(&arguments, MIR_new_reg_op(vm->ctx, callee_ptr));
+  }
+  else
+  {
+    assert(func != NULL);
+
+    array_add(&arguments, MIR_new_ref_op(vm->ctx, func));
+  }
+
+  if (expression->return_data_type.type != TYPE_VOID)
+    array_add(&arguments, MIR_new_reg_op(vm->ctx, dest));
+
+  Expr* argument;
+  array_foreach(&expression->arguments, argument)
+  {
+    MIR_reg_t temp =
+      _MIR_new_temp_reg(vm->ctx, sized_mir_type_to_mir_type(proto->u.proto->args->varr[_i].type),
+                        vm->function->u.func);
+    generate_expression(vm, temp, argument);
+
+    array_add(&arguments, MIR_new_reg_op(vm->ctx, temp));
+  }
+
+  // Internal functions are generated by the VM and never redefined, so they can always be inlined.
+  MIR_insn_code_t code =
+    expression->callee_data_type.type == TYPE_FUNCTION_INTERNAL ? MIR_INLINE : MIR_CALL;
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  generate_debug_info(expression->callee_token,
+                                      MIR_new_insn_arr(vm->ctx, code, arguments.size,
+                                                       arguments.elems)));
+}
+
+static void generate_access_expression(CyVM* vm, MIR_reg_t dest, AccessExpr* expression)
+{
+  if (expression->data_type.type == TYPE_FUNCTION ||
+      expression->data_type.type == TYPE_FUNCTION_MEMBER ||
+      expression->data_type.type == TYPE_FUNCTION_INTERNAL)
+  {
+    generate_function_pointer(vm, dest, expression->data_type);
+    return;
+  }
+
+  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->expr_data_type),
+                                    vm->function->u.func);
+  generate_expression(vm, ptr, expression->expr);
+
+  if (expression->expr_data_type.type == TYPE_STRING)
+  {
+    if (strcmp(expression->name.lexeme, "length") == 0)
+    {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest),
+                                   generate_string_length_op(vm, ptr)));
+
+      return;
+    }
+
+    UNREACHABLE("Unhandled string access name");
+  }
+  else if (expression->expr_data_type.type == TYPE_ARRAY)
+  {
+    if (strcmp(expression->name.lexeme, "length") == 0)
+    {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest),
+                                   generate_array_length_op(vm, ptr)));
+      return;
+    }
+    else if (strcmp(expression->name.lexeme, "capacity") == 0)
+    {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest),
+                                   generate_array_capacity_op(vm, ptr)));
+      return;
+    }
+
+    UNREACHABLE("Unhandled array access name");
+  }
+  else if (expression->expr_data_type.type == TYPE_STRING_BUILDER)
+  {
+    if (strcmp(expression->name.lexeme, "length") == 0)
+    {
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                   MIR_new_reg_op(vm->ctx, dest),
+                                   generate_array_length_op(vm, ptr)));
+      return;
+    }
+
+    UNREACHABLE("Unhandled string builder access name");
+  }
+  else
+  {
+    MIR_append_insn(
+      vm->ctx, vm->function,
+      generate_debug_info(expression->name,
+                          MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                       MIR_new_reg_op(vm->ctx, dest),
+                                       generate_object_field_op(vm, expression->variable, ptr))));
+
+    return;
+  }
+}
+
+static void generate_index_expression(CyVM* vm, MIR_reg_t dest, IndexExpr* expression)
+{
+  MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->expr_data_type),
+                                    vm->function->u.func);
+  generate_expression(vm, ptr, expression->expr);
+
+  MIR_reg_t index = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(expression->index_data_type),
+                                      vm->function->u.func);
+  generate_expression(vm, index, expression->index);
+
+  if (expression->expr_data_type.type != TYPE_OBJECT)
+    generate_index_extension(vm, index);
+
+  bool bounded = is_bounded_index(vm, expression->expr, expression->index);
+
+  switch (expression->expr_data_type.type)
+  {
+  case TYPE_STRING: {
+    if (bounded)
+    {
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        generate_debug_info(expression->index_token,
+                            MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                         MIR_new_reg_op(vm->ctx, dest),
+                                         generate_string_at_op(vm, ptr, index))));
+      return;
+    }
+
+    MIR_reg_t length = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, length),
+                                 generate_string_length_op(vm, ptr)));
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
+                                 MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
+                                 MIR_new_reg_op(vm->ctx, length)));
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, index),
+                                 MIR_new_reg_op(vm->ctx, index), MIR_new_reg_op(vm->ctx, index),
+                                 MIR_new_reg_op(vm->ctx, length)));
+
+    MIR_append_insn(
+      vm->ctx, vm->function,
+      generate_debug_info(expression->index_token,
+                          MIR_new_insn(vm->ctx, data_type_to_mov_type(expression->data_type),
+                                       MIR_new_reg_op(vm->ctx, dest),
+                                       generate_string_at_op(vm, ptr, index))));
+    return;
+  }
+  case TYPE_ARRAY: {
+    if (!bounded)
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_CCLEAR, MIR_new_reg_op(vm->ctx, ptr),
+                                   MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index),
+                                   generate_array_length_op(vm, ptr)));
+
+    MIR_reg_t array_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+
+    MIR_append_insn(
+      vm->ctx, vm->function,
+      generate_debug_info(expression->index_token,
+                          MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, array_ptr),
+                                       generate_array_data_op(vm, ptr))));
+
+    DataType element_data_type = array_data_type_element(expression->expr_data_type);
+
+    MIR_append_insn(
+      vm->ctx, vm->function,
+      generate_debug_info(
+        expression->index_token,
+        MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
+                     MIR_new_reg_op(vm->ctx, dest),
+                     MIR_new_mem_op(vm->ctx, data_type_to_sized_mir_type(element_data_type), 0,
+                                    array_ptr, index, size_data_type(element_data_type)))));
+
+    return;
+  }
+  case TYPE_OBJECT: {
+    if (expression->function->data_type.type == TYPE_VOID)
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        MIR_new_call_insn(vm->ctx, 4, MIR_new_ref_op(vm->ctx, expression->function->proto),
+                          MIR_new_ref_op(vm->ctx, expression->function->item),
+                          MIR_new_reg_op(vm->ctx, ptr), MIR_new_reg_op(vm->ctx, index)));
+    else
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_call_insn(vm->ctx, 5,
+                                        MIR_new_ref_op(vm->ctx, expression->function->proto),
+                                        MIR_new_ref_op(vm->ctx, expression->function->item),
+                                        MIR_new_reg_op(vm->ctx, dest), MIR_new_reg_op(vm->ctx, ptr),
+                                        MIR_new_reg_op(vm->ctx, index)));
+
+    return;
+  }
+  default:
+    UNREACHABLE("Unhandled index type");
+  }
+}
+
+static void generate_array_expression(CyVM* vm, MIR_reg_t dest, LiteralArrayExpr* expression)
+{
+  if (expression->values.size)
+  {
+    MIR_reg_t array_ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+    DataType element_data_type = array_data_type_element(expression->data_type);
+
+    MIR_op_t size =
+      MIR_new_int_op(vm->ctx, size_data_type(element_data_type) * expression->values.size);
+
+    generate_debug_info(expression->token,
+                        generate_malloc_expression(vm, dest,
+                                                   MIR_new_int_op(vm->ctx, sizeof(CyArray)),
+                                                   CY_ALLOCATION_ARRAY));
+
+    if (data_type_is_pointer(element_data_type))
+      generate_debug_info(
+        expression->token,
+        generate_malloc_expression(vm, array_ptr, size, CY_ALLOCATION_ARRAY));
+    else
+      generate_debug_info(
+        expression->token,
+        generate_malloc_atomic_expression(vm, array_ptr, size, CY_ALLOCATION_ARRAY));
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_MOV, generate_array_length_op(vm, dest),
+                                 MIR_new_int_op(vm->ctx, expression->values.size)));
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_MOV, generate_array_capacity_op(vm, dest),
+                                 MIR_new_int_op(vm->ctx, expression->values.size)));
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_MOV, generate_array_data_op(vm, dest),
+                                 MIR_new_reg_op(vm->ctx, array_ptr)));
+
+    MIR_reg_t item =
+      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(element_data_type), vm->function->u.func);
+    Expr* value;
+    array_foreach(&expression->values, value)
+    {
+      generate_expression(vm, item, value);
+
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        MIR_new_insn(vm->ctx, data_type_to_mov_type(element_data_type),
+                     MIR_new_mem_op(vm->ctx, data_type_to_sized_mir_type(element_data_type),
+                                    _i * size_data_type(element_data_type), array_ptr, 0, 1),
+                     MIR_new_reg_op(vm->ctx, item)));
+    }
+  }
+  else
+  {
+    generate_default_array_initialization(vm, dest);
+  }
+}
+
+static void generate_is_expression(CyVM* vm, MIR_reg_t dest, IsExpr* expression)
+{
+  if (expression->is_data_type.type == TYPE_ANY)
+  {
+    generate_expression(vm, dest, expression->expr);
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_NE, MIR_new_reg_op(vm->ctx, dest),
+                                 MIR_new_reg_op(vm->ctx, dest), MIR_new_int_op(vm->ctx, 0)));
+    return;
+  }
+
+  generate_expression(vm, dest, expression->expr);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_URSH, MIR_new_reg_op(vm->ctx, dest),
+                               MIR_new_reg_op(vm->ctx, dest), MIR_new_int_op(vm->ctx, 48)));
+
+  uint64_t id = data_type_to_typeid(vm, expression->is_data_type);
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_EQ, MIR_new_reg_op(vm->ctx, dest),
+                               MIR_new_reg_op(vm->ctx, dest), MIR_new_int_op(vm->ctx, id)));
+}
+
+static void generate_if_expression(CyVM* vm, MIR_reg_t dest, IfExpr* expression)
+{
+  MIR_reg_t condition =
+    _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_BOOL)), vm->function->u.func);
+  generate_expression(vm, condition, expression->condition);
+
+  MIR_label_t cont_label = MIR_new_label(vm->ctx);
+  MIR_label_t if_false_label = MIR_new_label(vm->ctx);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_BFS, MIR_new_label_op(vm->ctx, if_false_label),
+                               MIR_new_reg_op(vm->ctx, condition)));
+
+  generate_expression(vm, dest, expression->left);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
+
+  MIR_append_insn(vm->ctx, vm->function, if_false_label);
+
+  generate_expression(vm, dest, expression->right);
+
+  MIR_append_insn(vm->ctx, vm->function, cont_label);
+}
+
+static void generate_expression(CyVM* vm, MIR_reg_t dest, Expr* expression)
+{
+  switch (expression->type)
+  {
+  case EXPR_LITERAL:
+    generate_literal_expression(vm, dest, &expression->literal);
+    return;
+  case EXPR_BINARY:
+    generate_binary_expression(vm, dest, &expression->binary);
+    return;
+  case EXPR_GROUP:
+    generate_group_expression(vm, dest, &expression->group);
+    return;
+  case EXPR_UNARY:
+    generate_unary_expression(vm, dest, &expression->unary);
+    return;
+  case EXPR_VAR:
+    generate_variable_expression(vm, dest, &expression->var);
+    return;
+  case EXPR_ASSIGN:
+    generate_assignment_expression(vm, dest, &expression->assign);
+    return;
+  case EXPR_CALL:
+    generate_call_expression(vm, dest, &expression->call);
+    return;
+  case EXPR_CAST:
+    generate_cast_expression(vm, dest, &expression->cast);
+    return;
+  case EXPR_ACCESS:
+    generate_access_expression(vm, dest, &expression->access);
+    return;
+  case EXPR_INDEX:
+    generate_index_expression(vm, dest, &expression->index);
+    return;
+  case EXPR_ARRAY:
+    generate_array_expression(vm, dest, &expression->array);
+    return;
+  case EXPR_IF:
+    generate_if_expression(vm, dest, &expression->cond);
+    return;
+  case EXPR_IS:
+    generate_is_expression(vm, dest, &expression->is);
+    return;
+  }
+
+  UNREACHABLE("Unhandled expression");
+}
+
+static void generate_expression_statement(CyVM* vm, ExprStmt* statement)
+{
+  MIR_reg_t temp = 0;
+
+  MIR_type_t type = data_type_to_mir_type(statement->data_type);
+  if (type != MIR_T_UNDEF)
+    temp = _MIR_new_temp_reg(vm->ctx, type, vm->function->u.func);
+
+  generate_expression(vm, temp, statement->expr);
+}
+
+static void generate_if_statement(CyVM* vm, IfStmt* statement)
+{
+  MIR_reg_t condition =
+    _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_BOOL)), vm->function->u.func);
+  generate_expression(vm, condition, statement->condition);
+
+  MIR_label_t cont_label = MIR_new_label(vm->ctx);
+  MIR_label_t if_false_label = MIR_new_label(vm->ctx);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_BFS, MIR_new_label_op(vm->ctx, if_false_label),
+                               MIR_new_reg_op(vm->ctx, condition)));
+
+  generate_statements(vm, &statement->then_branch);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
+
+  MIR_append_insn(vm->ctx, vm->function, if_false_label);
+
+  if (statement->else_branch.elems)
+    generate_statements(vm, &statement->else_branch);
+
+  MIR_append_insn(vm->ctx, vm->function, cont_label);
+}
+
+static void generate_while_statement(CyVM* vm, WhileStmt* statement)
+{
+  MIR_label_t previous_continue_label = vm->continue_label;
+  MIR_label_t previous_break_label = vm->break_label;
+
+  vm->continue_label = MIR_new_label(vm->ctx);
+  vm->break_label = MIR_new_label(vm->ctx);
+
+  MIR_label_t loop_label = MIR_new_label(vm->ctx);
+
+  generate_statements(vm, &statement->initializer);
+
+  MIR_append_insn(vm->ctx, vm->function, loop_label);
+
+  Loop loop = { .statement = statement, .function = vm->function, .label = loop_label };
+  array_init(&loop.calls);
+  array_init(&loop.appends);
+  init_loop_bounds(&loop, statement);
+  loop.parent = vm->loop;
+  init_loop_appends(vm, &loop, statement);
+  vm->loop = &loop;
+
+  StringAppend append;
+  array_foreach(&loop.appends, append)
+  {
+    MIR_insert_insn_before(vm->ctx, vm->function, loop_label,
+                           MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, append.owner),
+                                        MIR_new_int_op(vm->ctx, 0)));
+  }
+
+  MIR_reg_t condition =
+    _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_BOOL)), vm->function->u.func);
+  generate_expression(vm, condition, statement->condition);
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_BFS, MIR_new_label_op(vm->ctx, vm->break_label),
+                               MIR_new_reg_op(vm->ctx, condition)));
+
+  generate_statements(vm, &statement->body);
+
+  MIR_append_insn(vm->ctx, vm->function, vm->continue_label);
+
+  generate_statements(vm, &statement->incrementer);
+
+  if (tier_threshold(vm) && vm->function != vm->start_function)
+    generate_tier_counter(vm, vm->function, NULL);
+
+  if (vm->budgeted)
+    generate_budget_check(vm, statement->keyword);
+
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, loop_label)));
+
+  MIR_append_insn(vm->ctx, vm->function, vm->break_label);
+
+  vm->loop = loop.parent;
+  vm->continue_label = previous_continue_label;
+  vm->break_label = previous_break_label;
+}
+
+static void generate_return_statement(CyVM* vm, ReturnStmt* statement)
+{
+  if (statement->expr)
+  {
+    MIR_reg_t temp = _MIR_new_temp_reg(
+      vm->ctx, sized_mir_type_to_mir_type(*vm->function->u.func->res_types), vm->function->u.func);
+    generate_expression(vm, temp, statement->expr);
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_ret_insn(vm->ctx, 1, MIR_new_reg_op(vm->ctx, temp)));
+  }
+  else
+  {
+    MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
+  }
+}
+
+static void generate_continue_statement(CyVM* vm)
+{
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, vm->continue_label)));
+}
+
+static void generate_break_statement(CyVM* vm)
+{
+  MIR_append_insn(vm->ctx, vm->function,
+                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, vm->break_label)));
+}
+
+static void generate_variable_declaration(CyVM* vm, VarStmt* statement)
+{
+  if (statement->scope == SCOPE_GLOBAL)
+  {
+    if (statement->initializer)
+    {
+      MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                                   MIR_new_ref_op(vm->ctx, statement->item)));
+      MIR_reg_t initializer = _MIR_new_temp_reg(
+        vm->ctx, data_type_to_mir_type(statement->data_type), vm->function->u.func);
+      generate_expression(vm, initializer, statement->initializer);
+
+      MIR_append_insn(
+        vm->ctx, vm->function,
+        MIR_new_insn(
+          vm->ctx, data_type_to_mov_type(statement->data_type),
+          MIR_new_mem_op(vm->ctx, data_type_to_mir_type(statement->data_type), 0, ptr, 0, 1),
+          MIR_new_reg_op(vm->ctx, initializer)));
+    }
+  }
+  else if (statement->scope == SCOPE_LOCAL)
+  {
+    if (statement->initializer)
+    {
+      generate_expression(vm, statement->reg, statement->initializer);
+    }
+    else
+    {
+      generate_default_initialization(vm, statement->reg, statement->data_type);
+    }
+  }
+  else
+  {
+    UNREACHABLE("Unexpected scope type");
+  }
+}
+
+static MIR_item_t get_definition(CyVM* vm, const char* name)
+{
+  if (map_get_sint(&vm->replacements, name))
+    return NULL;
+
+  return map_get_mir_item(&vm->definitions, name);
+}
+
+static MIR_item_t generate_definition_import(CyVM* vm, const char* name)
+{
+  MIR_load_external(vm->ctx, name, (uintptr_t)get_definition(vm, name)->addr);
+  return MIR_new_import(vm->ctx, name);
+}
+
+static void generate_function_declaration(CyVM* vm, FuncStmt* statement)
+{
+  if (statement->import)
+    return;
+
+  if (statement->item == NULL || statement->proto == NULL)
+    init_function_declaration(vm, statement);
+
+  if (statement->item->item_type == MIR_import_item)
+    return;
+
+  MIR_item_t previous_function = vm->function;
+  vm->function = statement->item;
+
+  MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+  MIR_set_curr_func(vm->ctx, vm->function->u.func);
+
+  double time = compile_time();
+  size_t memory = memory_allocated();
+
+  VarStmt* variable;
+  array_foreach(&statement->variables, variable)
+  {
+    variable->reg =
+      MIR_new_func_reg(vm->ctx, vm->function->u.func, data_type_to_mir_type(variable->data_type),
+                       memory_sprintf("%s.%d", variable->name.lexeme, variable->index));
+  }
+
+  if (vm->budgeted)
+    generate_budget_check(vm, statement->name);
+
+  generate_statements(vm, &statement->body);
+
+  if (statement->data_type.type == TYPE_VOID)
+    MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
+
+  MIR_finish_func(vm->ctx);
+
+  FunctionEmit* emit = ALLOC(FunctionEmit);
+  emit->time = compile_time() - time;
+  emit->memory = memory_allocated() - memory;
+  map_put_sv(&vm->function_emits, vm->function->u.func->name, emit);
+
+  MIR_set_curr_func(vm->ctx, previous_func);
+  vm->function = previous_function;
+}
+
+static void generate_function_template_declaration(CyVM* vm, FuncTemplateStmt* statement)
+{
+  FuncStmt* function_declaration;
+  array_foreach(&statement->functions, function_declaration)
+  {
+    generate_function_declaration(vm, function_declaration);
+  }
+}
+
+static void generate_class_declaration(CyVM* vm, ClassStmt* statement)
+{
+  ArrayFuncStmt initializer_functions = {
+    .size = 0,
+    .cap = 1,
+    .elems = alloca(sizeof(FuncStmt)),
+  };
+
+  FuncStmt* function;
+  array_foreach(&statement->functions, function)
+  {
+    if (strcmp(function->name_raw.lexeme, "__init__") == 0)
+      array_add(&initializer_functions, function);
+
+    generate_function_declaration(vm, function);
+  }
+
+  FuncTemplateStmt* function_template;
+  array_foreach(&statement->function_templates, function_template)
+  {
+    generate_function_template_declaration(vm, function_template);
+  }
+
+  unsigned int index = 0;
+
+  do
+  {
+    FuncStmt* initializer_function =
+      initializer_functions.size ? initializer_functions.elems[index] : NULL;
+
+    MIR_item_t previous_function = vm->function;
+    MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+
+    if (initializer_function)
+      vm->function = initializer_function->item_prototype;
+    else
+      vm->function = statement->default_constructor->item_prototype;
+
+    if (vm->function->item_type == MIR_import_item)
+    {
+      vm->function = previous_function;
+      index++;
+      continue;
+    }
+
+    MIR_set_curr_func(vm->ctx, vm->function->u.func);
+
+    bool contains_pointers = false;
+    VarStmt* variable;
+    array_foreach(&statement->variables, variable)
+    {
+      if (data_type_is_pointer(variable->data_type))
+      {
+        contains_pointers = true;
+        break;
+      }
+    }
+
+    MIR_reg_t ptr = MIR_reg(vm->ctx, "this.0", vm->function->u.func);
+
+    if (contains_pointers)
+      generate_debug_info(statement->name,
+                          generate_malloc_expression(vm, ptr,
+                                                     MIR_new_int_op(vm->ctx, statement->size),
+                                                     CY_ALLOCATION_OBJECT));
+    else
+      generate_debug_info(statement->name,
+                          generate_malloc_atomic_expression(
+                            vm, ptr, MIR_new_int_op(vm->ctx, statement->size),
+                            CY_ALLOCATION_OBJECT));
+
+    array_foreach(&statement->variables, variable)
+    {
+      MIR_reg_t initializer = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(variable->data_type),
+                                                vm->function->u.func);
+
+      generate_default_initialization(vm, initializer, variable->data_type);
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      MIR_new_insn(vm->ctx, data_type_to_mov_type(variable->data_type),
+                                   generate_object_field_op(vm, variable, ptr),
+                                   MIR_new_reg_op(vm->ctx, initializer)));
+    }
+
+    array_foreach(&statement->variables, variable)
+    {
+      if (variable->initializer)
+      {
+        MIR_reg_t initializer = _MIR_new_temp_reg(
+          vm->ctx, data_type_to_mir_type(variable->data_type), vm->function->u.func);
+
+        generate_expression(vm, initializer, variable->initializer);
+
+        MIR_append_insn(
+          vm->ctx, vm->function,
+          generate_debug_info(variable->name,
+                              MIR_new_insn(vm->ctx, data_type_to_mov_type(variable->data_type),
+                                           generate_object_field_op(vm, variable, ptr),
+                                           MIR_new_reg_op(vm->ctx, initializer))));
+      }
+    }
+
+    if (initializer_function)
+    {
+      ArrayMIR_op_t arguments;
+      array_init(&arguments);
+
+      array_add(&arguments, MIR_new_ref_op(vm->ctx, initializer_function->proto));
+      array_add(&arguments, MIR_new_ref_op(vm->ctx, initializer_function->item));
+
+      for (unsigned int i = 0; i < initializer_function->parameters.size; i++)
+      {
+        VarStmt* parameter = array_at(&initializer_function->parameters, i);
+        const char* name = memory_sprintf("%s.%d", parameter->name.lexeme, parameter->index);
+
+        MIR_reg_t var_reg = MIR_reg(vm->ctx, name, vm->function->u.func);
+        array_add(&arguments, MIR_new_reg_op(vm->ctx, var_reg));
+      }
+
+      MIR_append_insn(vm->ctx, vm->function,
+                      generate_debug_info(
+                        initializer_function->name,
+                        MIR_new_insn_arr(vm->ctx, MIR_INLINE, arguments.size, arguments.elems)));
+    }
+
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_ret_insn(vm->ctx, 1, MIR_new_reg_op(vm->ctx, ptr)));
+
+    index++;
+
+    MIR_finish_func(vm->ctx);
+    MIR_set_curr_func(vm->ctx, previous_func);
+    vm->function = previous_function;
+  } while (index < initializer_functions.size);
+}
+
+static void generate_class_template_declaration(CyVM* vm, ClassTemplateStmt* statement)
+{
+  ClassStmt* class_declaration;
+  array_foreach(&statement->classes, class_declaration)
+  {
+    generate_class_declaration(vm, class_declaration);
+  }
+}
+
+static void generate_statement(CyVM* vm, Stmt* statement)
+{
+  switch (statement->type)
+  {
+  case STMT_EXPR:
+    generate_expression_statement(vm, &statement->expr);
+    return;
+  case STMT_IF:
+    generate_if_statement(vm, &statement->cond);
+    return;
+  case STMT_WHILE:
+    generate_while_statement(vm, &statement->loop);
+    return;
+  case STMT_RETURN:
+    generate_return_statement(vm, &statement->ret);
+    return;
+  case STMT_CONTINUE:
+    generate_continue_statement(vm);
+    return;
+  case STMT_BREAK:
+    generate_break_statement(vm);
+    return;
+  case STMT_VARIABLE_DECL:
+    generate_variable_declaration(vm, &statement->var);
+    return;
+  case STMT_FUNCTION_DECL:
+    generate_function_declaration(vm, &statement->func);
+    return;
+  case STMT_CLASS_DECL:
+    generate_class_declaration(vm, &statement->class);
+    return;
+  case STMT_CLASS_TEMPLATE_DECL:
+    generate_class_template_declaration(vm, &statement->class_template);
+    return;
+  case STMT_FUNCTION_TEMPLATE_DECL:
+    generate_function_template_declaration(vm, &statement->func_template);
+    return;
+  }
+
+  UNREACHABLE("Unhandled statement");
+}
+
+static void generate_statements(CyVM* vm, ArrayStmt* statements)
+{
+  Stmt* statement;
+  array_foreach(statements, statement)
+  {
+    generate_statement(vm, statement);
+  }
+}
+
+static void init_function_declaration(CyVM* vm, FuncStmt* statement)
+{
+  MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+  MIR_set_curr_func(vm->ctx, NULL);
+
+  ArrayMIR_var_t vars;
+  array_init(&vars);
+
+  VarStmt* parameter;
+  array_foreach(&statement->parameters, parameter)
+  {
+    MIR_var_t var;
+    var.name = memory_sprintf("%s.%d", parameter->name.lexeme, parameter->index);
+    var.type = statement->import ? data_type_to_sized_mir_type(parameter->data_type)
+                                 : data_type_to_mir_type(parameter->data_type);
+
+    array_add(&vars, var);
+  }
+
+  MIR_type_t res_types[] = { statement->import ? data_type_to_sized_mir_type(statement->data_type)
+                                               : data_type_to_mir_type(statement->data_type) };
+
+  statement->proto =
+    MIR_new_proto_arr(vm->ctx, memory_sprintf("%s.proto", statement->name.lexeme),
+                      statement->data_type.type != TYPE_VOID, res_types, vars.size, vars.elems);
+
+  if (statement->import)
+  {
+    statement->item = MIR_new_import(vm->ctx, statement->name.lexeme);
+    MIR_load_external(vm->ctx, statement->name.lexeme, (uintptr_t)statement->import);
+  }
+  else if (get_definition(vm, statement->name.lexeme))
+  {
+    statement->item = generate_definition_import(vm, statement->name.lexeme);
+  }
+  else
+  {
+    statement->item =
+      MIR_new_func_arr(vm->ctx, statement->name.lexeme, statement->data_type.type != TYPE_VOID,
+                       res_types, vars.size, vars.elems);
+    statement->item->u.func->opt_level = statement->optimize_level;
+
+    map_put_sint(&vm->exports, statement->name.lexeme, true);
+
+    array_foreach(&statement->parameters, parameter)
+    {
+      parameter->reg = MIR_reg(vm->ctx, vars.elems[_i].name, statement->item->u.func);
+    }
+  }
+
+  MIR_set_curr_func(vm->ctx, previous_func);
+}
+
+static void init_function_template_declaration(CyVM* vm, FuncTemplateStmt* statement)
+{
+  FuncStmt* function_declaration;
+  array_foreach(&statement->functions, function_declaration)
+  {
+    init_function_declaration(vm, function_declaration);
+  }
+}
+
+static void init_class_declaration(CyVM* vm, ClassStmt* statement)
+{
+  ArrayFuncStmt initializer_functions = {
+    .size = 0,
+    .cap = 1,
+    .elems = alloca(sizeof(FuncStmt)),
+  };
+
+  FuncStmt* function;
+  array_foreach(&statement->functions, function)
+  {
+    if (strcmp(function->name_raw.lexeme, "__init__") == 0)
+      array_add(&initializer_functions, function);
+
+    init_function_declaration(vm, function);
+  }
+
+  FuncTemplateStmt* function_template;
+  array_foreach(&statement->function_templates, function_template)
+  {
+    init_function_template_declaration(vm, function_template);
+  }
+
+  unsigned int index = 0;
+
+  do
+  {
+    MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+    MIR_set_curr_func(vm->ctx, NULL);
+
+    FuncStmt* initializer_function =
+      initializer_functions.size ? initializer_functions.elems[index] : NULL;
+
+    const char* initalizer_name =
+      initializer_functions.size > 1
+        ? function_data_type_to_string(statement->name.lexeme,
+                                       initializer_function->function_data_type)
+        : statement->name.lexeme;
+
+    ArrayMIR_var_t vars;
+    array_init(&vars);
+
+    MIR_var_t var;
+    var.name = "this.0";
+    var.type = data_type_to_mir_type(DATA_TYPE(TYPE_OBJECT));
+    array_add(&vars, var);
+
+    if (initializer_function)
+    {
+      for (unsigned int i = 1; i < initializer_function->parameters.size; i++)
+      {
+        VarStmt* parameter = array_at(&initializer_function->parameters, i);
+
+        MIR_var_t var;
+        var.name = memory_sprintf("%s.%d", parameter->name.lexeme, parameter->index);
+        var.type = data_type_to_mir_type(parameter->data_type);
+
+        array_add(&vars, var);
+      }
+    }
+
+    MIR_item_t item =
+      get_definition(vm, initalizer_name)
+        ? generate_definition_import(vm, initalizer_name)
+        : MIR_new_func_arr(vm->ctx, initalizer_name, 1,
+                           (MIR_type_t[]){ data_type_to_mir_type(DATA_TYPE(TYPE_OBJECT)) },
+                           vars.size, vars.elems);
+
+    map_put_sint(&vm->exports, initalizer_name, true);
+
+    MIR_item_t proto = MIR_new_proto_arr(
+      vm->ctx, memory_sprintf("%s.proto", initalizer_name), 1,
+      (MIR_type_t[]){ data_type_to_mir_type(DATA_TYPE(TYPE_OBJECT)) }, vars.size, vars.elems);
+
+    if (initializer_function)
+    {
+      initializer_function->item_prototype = item;
+      initializer_function->proto_prototype = proto;
+    }
+    else
+    {
+      statement->default_constructor->item_prototype = item;
+      statement->default_constructor->proto_prototype = proto;
+    }
+
+    MIR_set_curr_func(vm->ctx, previous_func);
+    index++;
+
+  } while (index < initializer_functions.size);
+}
+
+static void init_class_template_declaration(CyVM* vm, ClassTemplateStmt* statement)
+{
+  ClassStmt* class_declaration;
+  array_foreach(&statement->classes, class_declaration)
+  {
+    init_class_declaration(vm, class_declaration);
+  }
+}
+
+static void init_variable_declaration(CyVM* vm, VarStmt* statement)
+{
+  if (statement->scope == SCOPE_GLOBAL)
+  {
+    const char* name =
+      memory_sprintf("%s.%s", statement->name.lexeme, data_type_to_string(statement->data_type));
+
+    if (get_definition(vm, name))
+    {
+      statement->item = generate_definition_import(vm, name);
+      return;
+    }
+
+    uint64_t init = 0;
+    statement->item =
+      MIR_new_data(vm->ctx, name, data_type_to_mir_type(statement->data_type), 1, &init);
+
+    map_put_sint(&vm->exports, name, true);
+
+    int layout = data_type_to_layout(vm, statement->data_type);
+    if (layout != -1)
+      map_put_sint(&vm->global_layouts, name, layout + 1);
+
+    MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
+    MIR_append_insn(vm->ctx, vm->function,
+                    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
+                                 MIR_new_ref_op(vm->ctx, statement->item)));
+
+    MIR_reg_t initializer =
+      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(statement->data_type), vm->function->u.func);
+    generate_default_initialization(vm, initializer, statement->data_type);
+
+    MIR_append_insn(
+      vm->ctx, vm->function,
+      MIR_new_insn(
+        vm->ctx, data_type_to_mov_type(statement->data_type),
+        MIR_new_mem_op(vm->ctx, data_type_to_mir_type(statement->data_type), 0, ptr, 0, 1),
+        MIR_new_reg_op(vm->ctx, initializer)));
+  }
+  else
+  {
+    UNREACHABLE("Unexpected scope type");
+  }
+}
+
+static void init_statement(CyVM* vm, Stmt* statement)
+{
+  switch (statement->type)
+  {
+  case STMT_VARIABLE_DECL:
+    init_variable_declaration(vm, &statement->var);
     return;
-  case EXPR_INDEX:
-    generate_index_expression(vm, dest, &expression->index);
+  case STMT_FUNCTION_DECL:
+    init_function_declaration(vm, &statement->func);
     return;
-  case EXPR_ARRAY:
-    generate_array_expression(vm, dest, &expression->array);
+  case STMT_CLASS_DECL:
+    init_class_declaration(vm, &statement->class);
     return;
-  case EXPR_IF:
-    generate_if_expression(vm, dest, &expression->cond);
+  case STMT_CLASS_TEMPLATE_DECL:
+    init_class_template_declaration(vm, &statement->class_template);
     return;
-  case EXPR_IS:
-    generate_is_expression(vm, dest, &expression->is);
+  case STMT_FUNCTION_TEMPLATE_DECL:
+    init_function_template_declaration(vm, &statement->func_template);
+    return;
+  default:
     return;
   }
+}
+
+static void init_statements(CyVM* vm, ArrayStmt* statements)
+{
+  Stmt* statement;
+  array_foreach(statements, statement)
+  {
+    init_statement(vm, statement);
+  }
+}
+
+static double compile_time(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+
+  return (double)counter.QuadPart / frequency.QuadPart;
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+}
+
+static void begin_phase(CyVM* vm)
+{
+  vm->phase_time = compile_time();
+  vm->phase_memory = memory_allocated();
+}
+
+static void end_phase(CyVM* vm, CyCompilePhase* phase)
+{
+  phase->time += compile_time() - vm->phase_time;
+  phase->memory += memory_allocated() - vm->phase_memory;
+}
+
+static bool load_string(CyVM* vm, char* string)
+{
+  begin_phase(vm);
+  lexer_init(string, vm->error_callback);
+  ArrayToken tokens = lexer_scan();
+  end_phase(vm, &vm->stats.lex);
+
+  vm->stats.tokens += tokens.size;
+
+  if (lexer_errors())
+    return false;
+
+  begin_phase(vm);
+  parser_init(tokens, vm->error_callback);
+  ArrayStmt statements = parser_parse();
+  end_phase(vm, &vm->stats.parse);
+
+  vm->stats.nodes += parser_nodes();
+
+  if (parser_errors())
+    return false;
+
+  Stmt* statement;
+  array_foreach(&statements, statement)
+  {
+    array_add(&vm->statements, statement);
+  }
+
+  return true;
+}
+
+static bool load_function(CyVM* vm, const char* signature, uintptr_t func)
+{
+  lexer_init((char*)signature, vm->error_callback);
+  ArrayToken tokens = lexer_scan();
+
+  if (lexer_errors())
+    return false;
+
+  parser_init(tokens, vm->error_callback);
+  Stmt* statement = parser_parse_import_function_declaration_statement((void*)func);
+
+  if (parser_errors() || statement == NULL)
+    return false;
+
+  array_add(&vm->statements, statement);
+  return true;
+}
+
+static void add_source(CyVM* vm, const char* string, uintptr_t import)
+{
+  vm->sources = realloc(vm->sources, (vm->source_count + 1) * sizeof(Source));
+  vm->sources[vm->source_count++] = (Source){ .string = strdup(string), .import = import };
+}
+
+static uint64_t cache_hash(uint64_t hash, const void* data, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= ((const uint8_t*)data)[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static uint64_t cache_key(CyVM* vm)
+{
+  // Generated code changes between builds of the compiler, so a cache is only used by the build
+  // that wrote it.
+  static const char build[] = __DATE__ " " __TIME__;
+
+  uint64_t key = cache_hash(vm->cache_key, build, sizeof(build));
+  int threshold = tier_threshold(vm);
+  key = cache_hash(key, &threshold, sizeof(threshold));
+  return cache_hash(key, &vm->budgeted, sizeof(vm->budgeted));
+}
+
+static const char* cache_path(CyVM* vm)
+{
+  return memory_sprintf("%s/%016llx.mir", vm->cache_directory, (unsigned long long)cache_key(vm));
+}
+
+static void load_runtime_functions(CyVM* vm)
+{
+  MIR_load_external(vm->ctx, "string.hash", (uintptr_t)string_hash);
+  MIR_load_external(vm->ctx, "string.index_of", (uintptr_t)string_index_of);
+  MIR_load_external(vm->ctx, "string.count", (uintptr_t)string_count);
+  MIR_load_external(vm->ctx, "string.replace", (uintptr_t)string_replace);
+  MIR_load_external(vm->ctx, "string.trim", (uintptr_t)string_trim);
+  MIR_load_external(vm->ctx, "string.starts_with", (uintptr_t)string_starts_with);
+  MIR_load_external(vm->ctx, "string.ends_with", (uintptr_t)string_ends_with);
+  MIR_load_external(vm->ctx, "string.contains", (uintptr_t)string_contains);
+  MIR_load_external(vm->ctx, "string.split", (uintptr_t)string_split);
+  MIR_load_external(vm->ctx, "string.join", (uintptr_t)string_join);
+  MIR_load_external(vm->ctx, "string.to_array", (uintptr_t)string_to_array);
+  MIR_load_external(vm->ctx, "string.pad", (uintptr_t)string_pad);
+  MIR_load_external(vm->ctx, "string.append", (uintptr_t)string_append);
+  MIR_load_external(vm->ctx, "string_builder.append_string",
+                    (uintptr_t)string_builder_append_string);
+  MIR_load_external(vm->ctx, "string_builder.append_int", (uintptr_t)string_builder_append_int);
+  MIR_load_external(vm->ctx, "string_builder.append_float",
+                    (uintptr_t)string_builder_append_float);
+  MIR_load_external(vm->ctx, "string_builder.append_char", (uintptr_t)string_builder_append_char);
+  MIR_load_external(vm->ctx, "string_builder.to_string", (uintptr_t)string_builder_to_string);
+  MIR_load_external(vm->ctx, "string_builder.clear", (uintptr_t)string_builder_clear);
+}
+
+static void generate_cache_forwards(CyVM* vm)
+{
+  MIR_item_t tail = DLIST_TAIL(MIR_item_t, vm->module->items);
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
+  {
+    if (item->item_type == MIR_func_item || item->item_type == MIR_data_item)
+      MIR_new_forward(vm->ctx, MIR_item_name(vm->ctx, item));
+
+    if (item == tail)
+      break;
+  }
+
+  // Serialized modules are read in a single pass, so anything that can be referenced before its
+  // definition is moved to the front of the module.
+  ArrayMIR_item_t declarations;
+  array_init(&declarations);
+
+  MIR_item_t next;
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL; item = next)
+  {
+    next = DLIST_NEXT(MIR_item_t, item);
+
+    if (item->item_type == MIR_proto_item || item->item_type == MIR_import_item ||
+        item->item_type == MIR_forward_item)
+    {
+      DLIST_REMOVE(MIR_item_t, vm->module->items, item);
+      array_add(&declarations, item);
+    }
+  }
+
+  for (unsigned int i = declarations.size; i > 0; i--)
+    DLIST_PREPEND(MIR_item_t, vm->module->items, declarations.elems[i - 1]);
+}
+
+// MIR reads and writes modules a byte at a time through callbacks that only receive the context.
+static THREAD_LOCAL ModuleData* module_data;
+
+static void write_module_data(ModuleData* module, const void* data, size_t size)
+{
+  if (module->size + size > module->capacity)
+  {
+    module->capacity = module->capacity * 2 > module->size + size ? module->capacity * 2
+                                                                   : module->size + size + 4096;
+    module->data = realloc(module->data, module->capacity);
+  }
+
+  memcpy(module->data + module->size, data, size);
+  module->size += size;
+}
+
+static bool read_module_data(ModuleData* module, void* data, size_t size)
+{
+  if (size > module->size - module->position)
+    return false;
+
+  memcpy(data, module->data + module->position, size);
+  module->position += size;
+  return true;
+}
+
+static int write_module_byte(MIR_context_t ctx, uint8_t byte)
+{
+  (void)ctx;
+  write_module_data(module_data, &byte, 1);
+  return 1;
+}
+
+// Hashes everything after the header, so that damaged files are turned away before MIR reads them.
+static uint64_t module_checksum(ModuleData* module, size_t header_size)
+{
+  return cache_hash(14695981039346656037ULL, module->data + header_size,
+                    module->size - header_size);
+}
+
+// MIR reports an error in a module it reads by calling the error function, which exits by default.
+static THREAD_LOCAL jmp_buf* module_error_jmp;
+
+static void MIR_NO_RETURN module_error(MIR_error_type_t error_type, const char* format, ...)
+{
+  (void)error_type;
+  (void)format;
+
+  longjmp(*module_error_jmp, 1);
+}
+
+static int read_module_byte(MIR_context_t ctx)
+{
+  (void)ctx;
+  uint8_t byte;
+  return read_module_data(module_data, &byte, 1) ? byte : EOF;
+}
+
+static int get_imports(CyVM* vm, uintptr_t** imports)
+{
+  int count = 0;
+  *imports = NULL;
+
+  Stmt* statement;
+  array_foreach(&vm->statements, statement)
+  {
+    if (statement->type != STMT_FUNCTION_DECL || !statement->func.import)
+      continue;
+
+    *imports = realloc(*imports, (count + 1) * sizeof(uintptr_t));
+    (*imports)[count++] = (uintptr_t)statement->func.import;
+  }
+
+  return count;
+}
+
+static void serialize_layouts(CyVM* vm, ModuleData* module)
+{
+  write_module_data(module, &vm->layouts.size, sizeof(vm->layouts.size));
+
+  Layout layout;
+  array_foreach(&vm->layouts, layout)
+  {
+    int values[] = { layout.kind, layout.element, layout.fields.size };
+    write_module_data(module, values, sizeof(values));
+    write_module_data(module, layout.fields.elems, layout.fields.size * sizeof(LayoutField));
+  }
+
+  write_module_data(module, &vm->typeid_layouts.size, sizeof(vm->typeid_layouts.size));
+  write_module_data(module, vm->typeid_layouts.elems, vm->typeid_layouts.size * sizeof(int));
+
+  uint32_t global_count = map_size_sint(&vm->global_layouts);
+  write_module_data(module, &global_count, sizeof(global_count));
+
+  const char* name;
+  int index;
+  map_foreach(&vm->global_layouts, name, index)
+  {
+    uint32_t length = strlen(name);
+    write_module_data(module, &length, sizeof(length));
+    write_module_data(module, name, length);
+    write_module_data(module, &index, sizeof(index));
+  }
+}
+
+static bool parse_layouts(CyVM* vm, ModuleData* module)
+{
+  uint32_t count;
+  if (!read_module_data(module, &count, sizeof(count)))
+    return false;
+
+  Memory* memory = memory_use(vm->symbol_memory);
+  bool result = true;
+
+  for (uint32_t i = 0; result && i < count; i++)
+  {
+    int values[3];
+    result = read_module_data(module, values, sizeof(values)) && values[0] >= LAYOUT_STRING &&
+             values[0] <= LAYOUT_FUNCTION && values[1] >= -1 && values[1] < (int)count &&
+             values[2] >= 0;
+
+    if (!result)
+      break;
+
+    Layout layout = { .kind = values[0], .element = values[1] };
+    array_init(&layout.fields);
+
+    for (int j = 0; result && j < values[2]; j++)
+    {
+      LayoutField field;
+      result = read_module_data(module, &field, sizeof(field)) && field.offset >= 0 &&
+               field.layout >= 0 && field.layout < (int)count;
+
+      if (result)
+        array_add(&layout.fields, field);
+    }
+
+    array_add(&vm->layouts, layout);
+  }
 
-  UNREACHABLE("Unhandled expression");
+  uint32_t typeid_count = 0;
+  result = result && read_module_data(module, &typeid_count, sizeof(typeid_count));
+
+  for (uint32_t i = 0; result && i < typeid_count; i++)
+  {
+    int layout;
+    result = read_module_data(module, &layout, sizeof(layout)) && layout >= -1 &&
+             layout < (int)count;
+
+    if (result)
+      array_add(&vm->typeid_layouts, layout);
+  }
+
+  memory_use(memory);
+
+  uint32_t global_count;
+  result = result && read_module_data(module, &global_count, sizeof(global_count));
+
+  for (uint32_t i = 0; result && i < global_count; i++)
+  {
+    uint32_t length;
+    if (!read_module_data(module, &length, sizeof(length)))
+      return false;
+
+    char* name = memory_alloc(length + 1);
+    int index;
+    if (!read_module_data(module, name, length) || !read_module_data(module, &index, sizeof(index)))
+      return false;
+
+    if (index < 1 || index > (int)count)
+      return false;
+
+    name[length] = '\0';
+    map_put_sint(&vm->global_layouts, name, index);
+  }
+
+  return result;
 }
 
-static void generate_expression_statement(CyVM* vm, ExprStmt* statement)
+static ModuleData serialize_module(CyVM* vm)
 {
-  MIR_reg_t temp = 0;
+  ModuleData module = { 0 };
 
-  MIR_type_t type = data_type_to_mir_type(statement->data_type);
-  if (type != MIR_T_UNDEF)
-    temp = _MIR_new_temp_reg(vm->ctx, type, vm->function->u.func);
+  uint64_t header[] = { MODULE_MAGIC, vm->import_key, cache_key(vm), tier_threshold(vm), 0 };
+  write_module_data(&module, header, sizeof(header));
+
+  Stmt* statement;
+  array_foreach(&vm->statements, statement)
+  {
+    if (statement->type != STMT_FUNCTION_DECL || !statement->func.import)
+      continue;
+
+    uint32_t length = strlen(statement->func.name.lexeme);
+    write_module_data(&module, &length, sizeof(length));
+    write_module_data(&module, statement->func.name.lexeme, length);
+  }
+
+  uint32_t export_count = map_size_sint(&vm->exports);
+  write_module_data(&module, &export_count, sizeof(export_count));
+
+  const char* export;
+  map_foreach_key(&vm->exports, export)
+  {
+    uint32_t length = strlen(export);
+    write_module_data(&module, &length, sizeof(length));
+    write_module_data(&module, export, length);
+  }
+
+  serialize_layouts(vm, &module);
+
+  ArrayInt positions;
+  array_init(&positions);
+
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
+  {
+    if (item->item_type != MIR_func_item)
+      continue;
+
+    array_add(&positions, item->u.func->opt_level);
+
+    for (MIR_insn_t insn = DLIST_HEAD(MIR_insn_t, item->u.func->insns); insn != NULL;
+         insn = DLIST_NEXT(MIR_insn_t, insn))
+    {
+      if (insn->code == MIR_LABEL)
+        continue;
+
+      array_add(&positions, insn->line);
+      array_add(&positions, insn->column);
+    }
+  }
+
+  uint32_t size = positions.size;
+  write_module_data(&module, &size, sizeof(size));
+  write_module_data(&module, positions.elems, positions.size * sizeof(int));
+
+  module_data = &module;
+  MIR_write_module_with_func(vm->ctx, write_module_byte, vm->module);
+  module_data = NULL;
+
+  header[4] = module_checksum(&module, sizeof(header));
+  memcpy(module.data, header, sizeof(header));
+
+  return module;
+}
+
+static bool write_module(CyVM* vm, const char* path)
+{
+  // Other processes and other VMs of this one may be writing the same entry at the same time.
+  const char* temp_path = memory_sprintf("%s.%d.%p", path, (int)getpid(), (void*)vm);
+
+  FILE* file = fopen(temp_path, "wb");
+  if (!file)
+    return false;
+
+  ModuleData module = serialize_module(vm);
+  fwrite(module.data, 1, module.size, file);
+  free(module.data);
+
+  bool result = !ferror(file);
+  result &= fclose(file) == 0;
+
+#ifdef _WIN32
+  if (result)
+    remove(path);
+#endif
+
+  if (!result || rename(temp_path, path) != 0)
+  {
+    remove(temp_path);
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_module(CyVM* vm, ModuleData module, bool cached, const uintptr_t* imports,
+                         int import_count)
+{
+  uint64_t header[5];
+  if (!read_module_data(&module, header, sizeof(header)))
+    return false;
+
+  if (header[0] != MODULE_MAGIC || header[1] != vm->import_key)
+    return false;
+
+  if (cached && header[2] != cache_key(vm))
+    return false;
+
+  if (header[4] != module_checksum(&module, sizeof(header)))
+    return false;
+
+  const char** import_names = memory_alloc(import_count * sizeof(const char*));
+
+  for (int i = 0; i < import_count; i++)
+  {
+    uint32_t length;
+    if (!read_module_data(&module, &length, sizeof(length)))
+      return false;
+
+    char* name = memory_alloc(length + 1);
+    if (!read_module_data(&module, name, length))
+      return false;
+
+    name[length] = '\0';
+    import_names[i] = name;
+  }
+
+  uint32_t export_count;
+  if (!read_module_data(&module, &export_count, sizeof(export_count)))
+    return false;
+
+  for (uint32_t i = 0; i < export_count; i++)
+  {
+    uint32_t length;
+    if (!read_module_data(&module, &length, sizeof(length)))
+      return false;
+
+    char* name = memory_alloc(length + 1);
+    if (!read_module_data(&module, name, length))
+      return false;
+
+    name[length] = '\0';
+    map_put_sint(&vm->exports, name, true);
+  }
+
+  if (!parse_layouts(vm, &module))
+    return false;
+
+  uint32_t size;
+  if (!read_module_data(&module, &size, sizeof(size)))
+    return false;
+
+  int* positions = memory_alloc(size * sizeof(int));
+  if (!read_module_data(&module, positions, size * sizeof(int)))
+    return false;
+
+  MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
+  MIR_finish_func(vm->ctx);
+  MIR_finish_module(vm->ctx);
+
+  jmp_buf buffer;
+  MIR_error_func_t error_func = MIR_get_error_func(vm->ctx);
+  MIR_set_error_func(vm->ctx, module_error);
+  module_error_jmp = &buffer;
+  module_data = &module;
+
+  // The start function was already finished above, so a module that fails part of the way through
+  // leaves nothing to fall back to, and the VM can only report the failure from then on.
+  volatile bool read = false;
+  if (setjmp(buffer) == 0)
+  {
+    MIR_read_with_func(vm->ctx, read_module_byte);
+    read = true;
+  }
+  else
+  {
+    MIR_set_curr_func(vm->ctx, NULL);
+
+    if (setjmp(buffer) == 0)
+      MIR_finish_module(vm->ctx);
+  }
+
+  module_data = NULL;
+  module_error_jmp = NULL;
+  MIR_set_error_func(vm->ctx, error_func);
+
+  if (!read)
+  {
+    vm->unreadable = true;
+    return false;
+  }
+
+  vm->module = DLIST_TAIL(MIR_module_t, *MIR_get_module_list(vm->ctx));
+
+  uint32_t position = 0;
+
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
+  {
+    if (item->item_type == MIR_data_item && strcmp(item->u.data->name, "<vm>") == 0)
+      vm->vm_data = item;
+
+    if (item->item_type != MIR_func_item)
+      continue;
+
+    if (strcmp(item->u.func->name, "<start>") == 0)
+      vm->function = vm->start_function = item;
+
+    if (position < size)
+      item->u.func->opt_level = positions[position++];
+
+    for (MIR_insn_t insn = DLIST_HEAD(MIR_insn_t, item->u.func->insns); insn != NULL;
+         insn = DLIST_NEXT(MIR_insn_t, insn))
+    {
+      if (insn->code == MIR_LABEL || position + 1 >= size)
+        continue;
+
+      insn->line = positions[position++];
+      insn->column = positions[position++];
+    }
+  }
+
+  for (int i = 0; i < import_count; i++)
+    MIR_load_external(vm->ctx, import_names[i], imports[i]);
+
+  load_runtime_functions(vm);
+
+  vm->tier_threshold = header[3];
+  vm->precompiled = true;
+  return true;
+}
+
+static bool read_module(CyVM* vm, const char* path, bool cached)
+{
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  ModuleData module = { 0 };
+  uint8_t buffer[4096];
+  size_t size;
+
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    write_module_data(&module, buffer, size);
+
+  bool result = !ferror(file);
+  fclose(file);
+
+  uintptr_t* imports;
+  int import_count = get_imports(vm, &imports);
+
+  result = result && parse_module(vm, module, cached, imports, import_count);
+  free(imports);
+
+  if (cached && vm->unreadable)
+    remove(path);
+
+  if (result && vm->cloning)
+    vm->module_data = module;
+  else
+    free(module.data);
+
+  return result;
+}
+
+static void init_module(CyVM* vm, const char* name)
+{
+  vm->module = MIR_new_module(vm->ctx, name);
+  vm->function = MIR_new_func(vm->ctx, "<start>", 0, 0, 0);
+  vm->start_function = vm->function;
+
+  vm->vm_data = MIR_new_data(vm->ctx, "<vm>", MIR_T_U64, 1, &(uint64_t){ 0 });
+
+  MIR_load_external(vm->ctx, "panic", (uintptr_t)panic);
+  vm->panic.proto = MIR_new_proto_arr(vm->ctx, "panic.proto", 0, NULL, 4,
+                                      (MIR_var_t[]){
+                                        { .name = "vm", .size = 0, .type = MIR_T_I64 },
+                                        { .name = "what", .size = 0, .type = MIR_T_I64 },
+                                        { .name = "pc", .size = 0, .type = MIR_T_I64 },
+                                        { .name = "fp", .size = 0, .type = MIR_T_I64 },
+                                      });
+  vm->panic.func = MIR_new_import(vm->ctx, "panic");
+
+  MIR_load_external(vm->ctx, "tier_up", (uintptr_t)tier_up);
+  vm->tier_up.proto = MIR_new_proto_arr(vm->ctx, "tier_up.proto", 0, NULL, 2,
+                                        (MIR_var_t[]){
+                                          { .name = "vm", .size = 0, .type = MIR_T_I64 },
+                                          { .name = "function", .size = 0, .type = MIR_T_I64 },
+                                        });
+  vm->tier_up.func = MIR_new_import(vm->ctx, "tier_up");
+
+  MIR_load_external(vm->ctx, "malloc", (uintptr_t)allocate);
+  vm->malloc.proto =
+    MIR_new_proto_arr(vm->ctx, "malloc.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 2,
+                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "site", .size = 0, .type = MIR_T_I64 } });
+  vm->malloc.func = MIR_new_import(vm->ctx, "malloc");
+
+  MIR_load_external(vm->ctx, "malloc_atomic", (uintptr_t)allocate_atomic);
+  vm->malloc_atomic.proto =
+    MIR_new_proto_arr(vm->ctx, "malloc_atomic.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 2,
+                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "site", .size = 0, .type = MIR_T_I64 } });
+  vm->malloc_atomic.func = MIR_new_import(vm->ctx, "malloc_atomic");
+
+  MIR_load_external(vm->ctx, "realloc", (uintptr_t)reallocate);
+  vm->realloc.proto =
+    MIR_new_proto_arr(vm->ctx, "realloc.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 2,
+                      (MIR_var_t[]){ { .name = "ptr", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "size", .size = 0, .type = MIR_T_I64 } });
+  vm->realloc.func = MIR_new_import(vm->ctx, "realloc");
+
+  MIR_load_external(vm->ctx, "memcpy", (uintptr_t)memcpy);
+  vm->memcpy.proto =
+    MIR_new_proto_arr(vm->ctx, "memcpy.proto", 0, (MIR_type_t[]){ MIR_T_I64 }, 3,
+                      (MIR_var_t[]){ { .name = "dest", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "soruce", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "n", .size = 0, .type = MIR_T_I64 } });
+  vm->memcpy.func = MIR_new_import(vm->ctx, "memcpy");
+
+  MIR_load_external(vm->ctx, "memmove", (uintptr_t)memmove);
+  vm->memmove.proto =
+    MIR_new_proto_arr(vm->ctx, "memmove.proto", 0, (MIR_type_t[]){ MIR_T_I64 }, 3,
+                      (MIR_var_t[]){ { .name = "dest", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "soruce", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "n", .size = 0, .type = MIR_T_I64 } });
+  vm->memmove.func = MIR_new_import(vm->ctx, "memmove");
+
+  MIR_load_external(vm->ctx, "string.equals", (uintptr_t)string_equals);
+  vm->string_equals.proto =
+    MIR_new_proto_arr(vm->ctx, "string.equals.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 2,
+                      (MIR_var_t[]){ { .name = "left", .size = 0, .type = MIR_T_I64 },
+                                     { .name = "right", .size = 0, .type = MIR_T_I64 } });
+  vm->string_equals.func = MIR_new_import(vm->ctx, "string.equals");
+
+  MIR_load_external(vm->ctx, "string.bool_cast", (uintptr_t)string_bool_cast);
+  vm->string_bool_cast.proto =
+    MIR_new_proto_arr(vm->ctx, "string.bool_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
+                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
+  vm->string_bool_cast.func = MIR_new_import(vm->ctx, "string.bool_cast");
+
+  MIR_load_external(vm->ctx, "string.int_cast", (uintptr_t)string_int_cast);
+  vm->string_int_cast.proto =
+    MIR_new_proto_arr(vm->ctx, "string.int_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
+                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
+  vm->string_int_cast.func = MIR_new_import(vm->ctx, "string.int_cast");
+
+  MIR_load_external(vm->ctx, "string.float_cast", (uintptr_t)string_float_cast);
+  vm->string_float_cast.proto =
+    MIR_new_proto_arr(vm->ctx, "string.float_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
+                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_F } });
+  vm->string_float_cast.func = MIR_new_import(vm->ctx, "string.float_cast");
+
+  MIR_load_external(vm->ctx, "string.char_cast", (uintptr_t)string_char_cast);
+  vm->string_char_cast.proto =
+    MIR_new_proto_arr(vm->ctx, "string.char_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
+                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
+  vm->string_char_cast.func = MIR_new_import(vm->ctx, "string.char_cast");
+
+  map_init_function(&vm->functions, 0, 0);
+  map_init_mir_item(&vm->string_constants, 0, 0);
+  map_init_mir_item(&vm->items, 0, 0);
+  map_init_mir_item(&vm->tier_counters, 0, 0);
+  map_init_mir_item(&vm->panic_messages, 0, 0);
+  map_init_mir_item(&vm->definitions, 0, 0);
+  map_init_sint(&vm->replacements, 0, 0);
+  map_init_sint(&vm->exports, 0, 0);
+  map_init_sint(&vm->layout_names, 0, 0);
+  map_init_sint(&vm->global_layouts, 0, 0);
+  map_init_sv(&vm->function_emits, 0, 0);
+  map_init_s64(&vm->typeids, 0, 0);
+
+  for (int i = 0; i < vm->typeid_count; i++)
+    map_put_s64(&vm->typeids, vm->typeid_names[i], i + 1);
+}
+
+static void* context_malloc(size_t size, void* vm)
+{
+  (void)vm;
+  return malloc(size);
+}
 
-  generate_expression(vm, temp, statement->expr);
+static void* context_calloc(size_t count, size_t size, void* vm)
+{
+  (void)vm;
+  return calloc(count, size);
 }
 
-static void generate_if_statement(CyVM* vm, IfStmt* statement)
+static void* context_realloc(void* pointer, size_t old_size, size_t new_size, void* vm)
 {
-  MIR_reg_t condition =
-    _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_BOOL)), vm->function->u.func);
-  generate_expression(vm, condition, statement->condition);
+  (void)old_size;
+  (void)vm;
+  return realloc(pointer, new_size);
+}
 
-  MIR_label_t cont_label = MIR_new_label(vm->ctx);
-  MIR_label_t if_false_label = MIR_new_label(vm->ctx);
+static void context_free(void* pointer, void* vm)
+{
+  (void)vm;
+  free(pointer);
+}
 
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_BFS, MIR_new_label_op(vm->ctx, if_false_label),
-                               MIR_new_reg_op(vm->ctx, condition)));
+CyVM* cyth_init(void)
+{
+  init_process();
+  init_thread();
 
-  generate_statements(vm, &statement->then_branch);
+  CyVM* vm = malloc(sizeof(CyVM));
+  vm->memory = memory_init();
+  vm->alloc = (struct MIR_alloc){
+    .malloc = context_malloc,
+    .calloc = context_calloc,
+    .realloc = context_realloc,
+    .free = context_free,
+    .user_data = vm,
+  };
+  vm->ctx = MIR_init2(&vm->alloc, NULL);
+  vm->continue_label = NULL;
+  vm->break_label = NULL;
+  vm->loop = NULL;
+  vm->start = NULL;
+  vm->logging = 0;
+  vm->lazy = 0;
+  vm->tier_threshold = 0;
+  vm->compile_threads = 0;
+  vm->optimize_level = 3;
+  vm->incremental = 0;
+  vm->budgeted = 0;
+  vm->budget = INT64_MAX;
+  vm->budget_floor = 0;
+  vm->heap_ceiling = SIZE_MAX;
+  memset(&vm->heap_stats, 0, sizeof(vm->heap_stats));
+  vm->cloning = 0;
+  vm->module_data = (ModuleData){ 0 };
+  vm->imports = NULL;
+  vm->import_count = 0;
+  vm->sources = NULL;
+  vm->source_count = 0;
+  vm->typeid_names = NULL;
+  vm->typeid_count = 0;
+  vm->symbol_memory = memory_init();
+  array_init(&vm->layouts);
+  array_init(&vm->typeid_layouts);
+  map_init_symbol_entry(&vm->symbol_table, 0, 0);
+  vm->symbols = NULL;
+  vm->symbol_count = 0;
+  vm->code_ranges = NULL;
+  vm->code_range_count = 0;
+  vm->code_range_capacity = 0;
+  vm->stats = (CyCompileStats){ 0 };
+  vm->function_stats = NULL;
+  vm->cache_directory = NULL;
+  vm->cache_key = 14695981039346656037ULL;
+  vm->import_key = 14695981039346656037ULL;
+  vm->precompiled = false;
+  vm->unreadable = false;
+  vm->error_callback = error_callback;
+  vm->panic_callback = panic_callback;
+  array_init(&vm->statements);
+  array_init(&vm->cache_sources);
 
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, cont_label)));
+  Memory* memory = memory_use(vm->memory);
+  init_module(vm, "main");
+  memory_use(memory);
 
-  MIR_append_insn(vm->ctx, vm->function, if_false_label);
+  return vm;
+}
 
-  if (statement->else_branch.elems)
-    generate_statements(vm, &statement->else_branch);
+static void generate_tier_counters(CyVM* vm)
+{
+  if (!tier_threshold(vm))
+    return;
 
-  MIR_append_insn(vm->ctx, vm->function, cont_label);
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
+  {
+    if (item->item_type != MIR_func_item || item == vm->start_function ||
+        item->u.func->opt_level >= 0)
+      continue;
+
+    generate_tier_counter(vm, item, DLIST_HEAD(MIR_insn_t, item->u.func->insns));
+  }
 }
 
-static void generate_while_statement(CyVM* vm, WhileStmt* statement)
+static bool compile_statements(CyVM* vm, bool serialize)
 {
-  MIR_label_t previous_continue_label = vm->continue_label;
-  MIR_label_t previous_break_label = vm->break_label;
+  bool result = true;
 
-  vm->continue_label = MIR_new_label(vm->ctx);
-  vm->break_label = MIR_new_label(vm->ctx);
+  const char* source;
+  array_foreach(&vm->cache_sources, source)
+  {
+    result &= load_string(vm, (char*)source);
+  }
 
-  MIR_label_t loop_label = MIR_new_label(vm->ctx);
+  int nodes = parser_nodes();
 
-  generate_statements(vm, &statement->initializer);
+  begin_phase(vm);
+  checker_init(vm->statements, vm->error_callback, NULL);
+  checker_validate();
+  end_phase(vm, &vm->stats.check);
 
-  MIR_append_insn(vm->ctx, vm->function, loop_label);
+  vm->stats.nodes += parser_nodes() - nodes;
 
-  MIR_reg_t condition =
-    _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(DATA_TYPE(TYPE_BOOL)), vm->function->u.func);
-  generate_expression(vm, condition, statement->condition);
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_BFS, MIR_new_label_op(vm->ctx, vm->break_label),
-                               MIR_new_reg_op(vm->ctx, condition)));
+  begin_phase(vm);
+  map_init_sv(&vm->function_emits, 0, 0);
 
-  generate_statements(vm, &statement->body);
+  result &= !checker_errors();
+  if (result)
+  {
+    VarStmt* global_local;
+    ArrayVarStmt global_local_statements = checker_global_locals();
+    array_foreach(&global_local_statements, global_local)
+    {
+      global_local->reg = MIR_new_func_reg(
+        vm->ctx, vm->function->u.func, data_type_to_mir_type(global_local->data_type),
+        memory_sprintf("%s.%d", global_local->name.lexeme, global_local->index));
+    }
 
-  MIR_append_insn(vm->ctx, vm->function, vm->continue_label);
+    init_statements(vm, &vm->statements);
+    generate_statements(vm, &vm->statements);
+  }
 
-  generate_statements(vm, &statement->incrementer);
+  MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
+  MIR_finish_func(vm->ctx);
 
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, loop_label)));
+  generate_tier_counters(vm);
 
-  MIR_append_insn(vm->ctx, vm->function, vm->break_label);
+  if (serialize && result)
+    generate_cache_forwards(vm);
 
-  vm->continue_label = previous_continue_label;
-  vm->break_label = previous_break_label;
-}
+  MIR_finish_module(vm->ctx);
+  end_phase(vm, &vm->stats.emit);
 
-static void generate_return_statement(CyVM* vm, ReturnStmt* statement)
-{
-  if (statement->expr)
-  {
-    MIR_reg_t temp = _MIR_new_temp_reg(
-      vm->ctx, sized_mir_type_to_mir_type(*vm->function->u.func->res_types), vm->function->u.func);
-    generate_expression(vm, temp, statement->expr);
+  if (vm->cache_directory && result)
+    write_module(vm, cache_path(vm));
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_ret_insn(vm->ctx, 1, MIR_new_reg_op(vm->ctx, temp)));
-  }
-  else
-  {
-    MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
-  }
+  if (vm->cloning && result)
+    vm->module_data = serialize_module(vm);
+
+  return result;
 }
 
-static void generate_continue_statement(CyVM* vm)
+typedef struct _COMPILE_QUEUE
 {
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, vm->continue_label)));
-}
+  CyVM* vm;
+  ArrayMIR_item_t functions;
+  unsigned int next;
 
-static void generate_break_statement(CyVM* vm)
+#ifdef _WIN32
+  CRITICAL_SECTION mutex;
+#else
+  pthread_mutex_t mutex;
+#endif
+} CompileQueue;
+
+typedef struct _COMPILE_WORKER
 {
-  MIR_append_insn(vm->ctx, vm->function,
-                  MIR_new_insn(vm->ctx, MIR_JMP, MIR_new_label_op(vm->ctx, vm->break_label)));
-}
+  CompileQueue* queue;
+  size_t index;
 
-static void generate_variable_declaration(CyVM* vm, VarStmt* statement)
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+} CompileWorker;
+
+static void compile_lock(void* data, int lock)
 {
-  if (statement->scope == SCOPE_GLOBAL)
-  {
-    if (statement->initializer)
-    {
-      MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
-                                   MIR_new_ref_op(vm->ctx, statement->item)));
-      MIR_reg_t initializer = _MIR_new_temp_reg(
-        vm->ctx, data_type_to_mir_type(statement->data_type), vm->function->u.func);
-      generate_expression(vm, initializer, statement->initializer);
+  CompileQueue* queue = data;
 
-      MIR_append_insn(
-        vm->ctx, vm->function,
-        MIR_new_insn(
-          vm->ctx, data_type_to_mov_type(statement->data_type),
-          MIR_new_mem_op(vm->ctx, data_type_to_mir_type(statement->data_type), 0, ptr, 0, 1),
-          MIR_new_reg_op(vm->ctx, initializer)));
-    }
-  }
-  else if (statement->scope == SCOPE_LOCAL)
-  {
-    if (statement->initializer)
-    {
-      generate_expression(vm, statement->reg, statement->initializer);
-    }
-    else
-    {
-      generate_default_initialization(vm, statement->reg, statement->data_type);
-    }
-  }
+#ifdef _WIN32
+  if (lock)
+    EnterCriticalSection(&queue->mutex);
   else
-  {
-    UNREACHABLE("Unexpected scope type");
-  }
+    LeaveCriticalSection(&queue->mutex);
+#else
+  if (lock)
+    pthread_mutex_lock(&queue->mutex);
+  else
+    pthread_mutex_unlock(&queue->mutex);
+#endif
 }
 
-static void generate_function_declaration(CyVM* vm, FuncStmt* statement)
+static int compile_queue_next(CompileQueue* queue)
 {
-  if (statement->import)
-    return;
+  int index = -1;
 
-  if (statement->item == NULL || statement->proto == NULL)
-    init_function_declaration(vm, statement);
+  compile_lock(queue, true);
+  if (queue->next < queue->functions.size)
+    index = queue->next++;
+  compile_lock(queue, false);
 
-  MIR_item_t previous_function = vm->function;
-  vm->function = statement->item;
+  return index;
+}
 
-  MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
-  MIR_set_curr_func(vm->ctx, vm->function->u.func);
+static void compile_function(CompileQueue* queue, CompileWorker* worker, int index)
+{
+  MIR_item_t item = queue->functions.elems[index];
+  double time = compile_time();
 
-  VarStmt* variable;
-  array_foreach(&statement->variables, variable)
-  {
-    variable->reg =
-      MIR_new_func_reg(vm->ctx, vm->function->u.func, data_type_to_mir_type(variable->data_type),
-                       memory_sprintf("%s.%d", variable->name.lexeme, variable->index));
-  }
+  if (worker)
+    MIR_gen_by_worker(queue->vm->ctx, worker->index, item);
+  else
+    MIR_gen(queue->vm->ctx, item);
 
-  generate_statements(vm, &statement->body);
+  queue->vm->function_stats[index].time = compile_time() - time;
+}
 
-  if (statement->data_type.type == TYPE_VOID)
-    MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
+#ifdef _WIN32
+static DWORD WINAPI compile_worker(LPVOID data)
+#else
+static void* compile_worker(void* data)
+#endif
+{
+  CompileWorker* worker = data;
+  int index;
 
-  MIR_finish_func(vm->ctx);
-  MIR_set_curr_func(vm->ctx, previous_func);
-  vm->function = previous_function;
+  while ((index = compile_queue_next(worker->queue)) != -1)
+    compile_function(worker->queue, worker, index);
+
+  return 0;
 }
 
-static void generate_function_template_declaration(CyVM* vm, FuncTemplateStmt* statement)
+static void compile_functions(CyVM* vm)
 {
-  FuncStmt* function_declaration;
-  array_foreach(&statement->functions, function_declaration)
+  CompileQueue queue;
+  queue.vm = vm;
+  queue.next = 0;
+  array_init(&queue.functions);
+
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
   {
-    generate_function_declaration(vm, function_declaration);
+    if (item->item_type == MIR_func_item)
+      array_add(&queue.functions, item);
   }
-}
 
-static void generate_class_declaration(CyVM* vm, ClassStmt* statement)
-{
-  ArrayFuncStmt initializer_functions = {
-    .size = 0,
-    .cap = 1,
-    .elems = alloca(sizeof(FuncStmt)),
-  };
+  size_t count = vm->compile_threads;
+  if (count > queue.functions.size)
+    count = queue.functions.size;
 
-  FuncStmt* function;
-  array_foreach(&statement->functions, function)
+  if (count <= 1)
   {
-    if (strcmp(function->name_raw.lexeme, "__init__") == 0)
-      array_add(&initializer_functions, function);
+    for (unsigned int i = 0; i < queue.functions.size; i++)
+      compile_function(&queue, NULL, i);
 
-    generate_function_declaration(vm, function);
+    MIR_set_gen_interface(vm->ctx, NULL);
+    return;
   }
 
-  FuncTemplateStmt* function_template;
-  array_foreach(&statement->function_templates, function_template)
+  CompileWorker* workers = memory_alloc(sizeof(CompileWorker) * count);
+
+#ifdef _WIN32
+  InitializeCriticalSection(&queue.mutex);
+#else
+  pthread_mutex_init(&queue.mutex, NULL);
+#endif
+
+  MIR_gen_set_workers_num(vm->ctx, count);
+  MIR_gen_set_lock_func(vm->ctx, compile_lock, &queue);
+
+  for (size_t i = 0; i < count; i++)
   {
-    generate_function_template_declaration(vm, function_template);
-  }
+    workers[i].queue = &queue;
+    workers[i].index = i;
 
-  unsigned int index = 0;
+#ifdef _WIN32
+    workers[i].thread = CreateThread(NULL, 0, compile_worker, &workers[i], 0, NULL);
+#else
+    pthread_create(&workers[i].thread, NULL, compile_worker, &workers[i]);
+#endif
+  }
 
-  do
+  for (size_t i = 0; i < count; i++)
   {
-    FuncStmt* initializer_function =
-      initializer_functions.size ? initializer_functions.elems[index] : NULL;
+#ifdef _WIN32
+    WaitForSingleObject(workers[i].thread, INFINITE);
+    CloseHandle(workers[i].thread);
+#else
+    pthread_join(workers[i].thread, NULL);
+#endif
+  }
 
-    MIR_item_t previous_function = vm->function;
-    MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
+  MIR_set_gen_interface(vm->ctx, NULL);
+  MIR_gen_set_lock_func(vm->ctx, NULL, NULL);
+  MIR_gen_set_workers_num(vm->ctx, 0);
 
-    if (initializer_function)
-    {
-      vm->function = initializer_function->item_prototype;
-      MIR_set_curr_func(vm->ctx, vm->function->u.func);
-    }
-    else
-    {
-      vm->function = statement->default_constructor->item_prototype;
-      MIR_set_curr_func(vm->ctx, vm->function->u.func);
-    }
+#ifdef _WIN32
+  DeleteCriticalSection(&queue.mutex);
+#else
+  pthread_mutex_destroy(&queue.mutex);
+#endif
+}
 
-    bool contains_pointers = false;
-    VarStmt* variable;
-    array_foreach(&statement->variables, variable)
-    {
-      if (data_type_is_pointer(variable->data_type))
-      {
-        contains_pointers = true;
-        break;
-      }
-    }
+static void init_function_stats(CyVM* vm)
+{
+  int count = 0;
 
-    MIR_reg_t ptr = MIR_reg(vm->ctx, "this.0", vm->function->u.func);
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
+  {
+    if (item->item_type == MIR_func_item)
+      count++;
+  }
 
-    if (contains_pointers)
-      generate_malloc_expression(vm, ptr, MIR_new_int_op(vm->ctx, statement->size));
-    else
-      generate_malloc_atomic_expression(vm, ptr, MIR_new_int_op(vm->ctx, statement->size));
+  free(vm->function_stats);
+  vm->function_stats = calloc(count, sizeof(CyFunctionStats));
+  vm->stats.function_count = count;
+  vm->stats.instructions = 0;
 
-    array_foreach(&statement->variables, variable)
-    {
-      MIR_reg_t initializer = _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(variable->data_type),
-                                                vm->function->u.func);
+  int index = 0;
 
-      generate_default_initialization(vm, initializer, variable->data_type);
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
+  {
+    if (item->item_type != MIR_func_item)
+      continue;
 
-      MIR_append_insn(vm->ctx, vm->function,
-                      MIR_new_insn(vm->ctx, data_type_to_mov_type(variable->data_type),
-                                   generate_object_field_op(vm, variable, ptr),
-                                   MIR_new_reg_op(vm->ctx, initializer)));
-    }
+    CyFunctionStats* stats = &vm->function_stats[index++];
+    stats->name = item->u.func->name;
+    stats->instructions = DLIST_LENGTH(MIR_insn_t, item->u.func->insns);
 
-    array_foreach(&statement->variables, variable)
+    FunctionEmit* emit = map_get_sv(&vm->function_emits, item->u.func->name);
+    if (emit)
     {
-      if (variable->initializer)
-      {
-        MIR_reg_t initializer = _MIR_new_temp_reg(
-          vm->ctx, data_type_to_mir_type(variable->data_type), vm->function->u.func);
+      stats->emit_time = emit->time;
+      stats->memory = emit->memory;
+    }
 
-        generate_expression(vm, initializer, variable->initializer);
+    vm->stats.instructions += stats->instructions;
+  }
+}
 
-        MIR_append_insn(
-          vm->ctx, vm->function,
-          generate_debug_info(variable->name,
-                              MIR_new_insn(vm->ctx, data_type_to_mov_type(variable->data_type),
-                                           generate_object_field_op(vm, variable, ptr),
-                                           MIR_new_reg_op(vm->ctx, initializer))));
-      }
-    }
+static SymbolEntry* get_symbol_entry(CyVM* vm, const char* name)
+{
+  return map_get_symbol_entry(&vm->symbol_table, name);
+}
 
-    if (initializer_function)
-    {
-      ArrayMIR_op_t arguments;
-      array_init(&arguments);
+static void add_symbol_entry(CyVM* vm, MIR_item_t item)
+{
+  const char* name = MIR_item_name(vm->ctx, item);
 
-      array_add(&arguments, MIR_new_ref_op(vm->ctx, initializer_function->proto));
-      array_add(&arguments, MIR_new_ref_op(vm->ctx, initializer_function->item));
+  SymbolEntry* entry = get_symbol_entry(vm, name);
+  if (!entry)
+  {
+    Memory* memory = memory_use(vm->symbol_memory);
 
-      for (unsigned int i = 0; i < initializer_function->parameters.size; i++)
-      {
-        VarStmt* parameter = array_at(&initializer_function->parameters, i);
-        const char* name = memory_sprintf("%s.%d", parameter->name.lexeme, parameter->index);
+    entry = ALLOC(SymbolEntry);
+    *entry = (SymbolEntry){ .name = name, .symbol = -1, .layout = -1 };
+    map_put_symbol_entry(&vm->symbol_table, name, entry);
 
-        MIR_reg_t var_reg = MIR_reg(vm->ctx, name, vm->function->u.func);
-        array_add(&arguments, MIR_new_reg_op(vm->ctx, var_reg));
-      }
+    memory_use(memory);
+  }
 
-      MIR_append_insn(vm->ctx, vm->function,
-                      generate_debug_info(
-                        initializer_function->name,
-                        MIR_new_insn_arr(vm->ctx, MIR_INLINE, arguments.size, arguments.elems)));
-    }
+  int layout = map_get_sint(&vm->global_layouts, name);
+  if (layout)
+    entry->layout = layout - 1;
 
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_ret_insn(vm->ctx, 1, MIR_new_reg_op(vm->ctx, ptr)));
+  entry->item = item;
+  entry->address = (uintptr_t)item->addr;
 
-    index++;
+  if (entry->call)
+    entry->call->address = entry->address;
 
-    MIR_finish_func(vm->ctx);
-    MIR_set_curr_func(vm->ctx, previous_func);
-    vm->function = previous_function;
-  } while (index < initializer_functions.size);
-}
+  if (!map_get_sint(&vm->exports, name))
+    return;
 
-static void generate_class_template_declaration(CyVM* vm, ClassTemplateStmt* statement)
-{
-  ClassStmt* class_declaration;
-  array_foreach(&statement->classes, class_declaration)
+  if (entry->symbol == -1)
   {
-    generate_class_declaration(vm, class_declaration);
+    vm->symbols = realloc(vm->symbols, (vm->symbol_count + 1) * sizeof(CySymbol));
+    entry->symbol = vm->symbol_count++;
   }
+
+  vm->symbols[entry->symbol] = (CySymbol){
+    .name = name,
+    .type = item->item_type == MIR_func_item ? CY_SYMBOL_FUNCTION : CY_SYMBOL_VARIABLE,
+    .address = entry->address,
+  };
 }
 
-static void generate_statement(CyVM* vm, Stmt* statement)
+static void generate_symbol_table(CyVM* vm)
 {
-  switch (statement->type)
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
   {
-  case STMT_EXPR:
-    generate_expression_statement(vm, &statement->expr);
-    return;
-  case STMT_IF:
-    generate_if_statement(vm, &statement->cond);
-    return;
-  case STMT_WHILE:
-    generate_while_statement(vm, &statement->loop);
-    return;
-  case STMT_RETURN:
-    generate_return_statement(vm, &statement->ret);
-    return;
-  case STMT_CONTINUE:
-    generate_continue_statement(vm);
-    return;
-  case STMT_BREAK:
-    generate_break_statement(vm);
-    return;
-  case STMT_VARIABLE_DECL:
-    generate_variable_declaration(vm, &statement->var);
-    return;
-  case STMT_FUNCTION_DECL:
-    generate_function_declaration(vm, &statement->func);
-    return;
-  case STMT_CLASS_DECL:
-    generate_class_declaration(vm, &statement->class);
-    return;
-  case STMT_CLASS_TEMPLATE_DECL:
-    generate_class_template_declaration(vm, &statement->class_template);
-    return;
-  case STMT_FUNCTION_TEMPLATE_DECL:
-    generate_function_template_declaration(vm, &statement->func_template);
-    return;
-  }
+    if (item->item_type != MIR_func_item && item->item_type != MIR_data_item)
+      continue;
 
-  UNREACHABLE("Unhandled statement");
+    if (item->addr)
+      add_symbol_entry(vm, item);
+  }
 }
 
-static void generate_statements(CyVM* vm, ArrayStmt* statements)
+static void generate_module(CyVM* vm)
 {
-  Stmt* statement;
-  array_foreach(statements, statement)
+  init_function_stats(vm);
+  begin_phase(vm);
+
+  MIR_load_module(vm->ctx, vm->module);
+  *(CyVM**)vm->vm_data->addr = vm;
+
+  if (!vm->start)
+    MIR_gen_init(vm->ctx);
+
+  // Calls between functions keep going through their thunks, which "cyth_update_string" redirects
+  // when a function is replaced.
+  if (vm->incremental)
+    MIR_set_func_redef_permission(vm->ctx, true);
+
+  MIR_gen_set_optimize_level(vm->ctx, vm->optimize_level);
+  MIR_link(vm->ctx, set_lazy_gen_interface, NULL);
+
+  if (!vm->lazy && !tier_threshold(vm))
+    compile_functions(vm);
+
+  vm->start = (Start)MIR_gen(vm->ctx, vm->function);
+
+  if (tier_threshold(vm))
+    MIR_gen_set_optimize_level(vm->ctx, tier_optimize_level(vm));
+
+  end_phase(vm, &vm->stats.generate);
+  GC_set_no_dls(true);
+
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
+       item = DLIST_NEXT(MIR_item_t, item))
   {
-    generate_statement(vm, statement);
+    if (item->item_type != MIR_data_item)
+      continue;
+
+    if (item->u.data->el_type != MIR_T_I64)
+      continue;
+
+    GC_add_roots(item->addr, (char*)item->addr + sizeof(uintptr_t));
   }
+
+  generate_symbol_table(vm);
+  generate_code_ranges(vm);
 }
 
-static void init_function_declaration(CyVM* vm, FuncStmt* statement)
+static int compare_address_pairs(const void* left, const void* right)
 {
-  MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
-  MIR_set_curr_func(vm->ctx, NULL);
+  uintptr_t a = ((const AddressPair*)left)->from;
+  uintptr_t b = ((const AddressPair*)right)->from;
 
-  ArrayMIR_var_t vars;
-  array_init(&vars);
+  return (a > b) - (a < b);
+}
 
-  VarStmt* parameter;
-  array_foreach(&statement->parameters, parameter)
-  {
-    MIR_var_t var;
-    var.name = memory_sprintf("%s.%d", parameter->name.lexeme, parameter->index);
-    var.type = statement->import ? data_type_to_sized_mir_type(parameter->data_type)
-                                 : data_type_to_mir_type(parameter->data_type);
+static AddressPair* find_copied_object(AddressPair* objects, uint32_t capacity, uintptr_t from)
+{
+  uint32_t index = cache_hash(0, &from, sizeof(from)) & (capacity - 1);
+  while (objects[index].from && objects[index].from != from)
+    index = (index + 1) & (capacity - 1);
 
-    array_add(&vars, var);
-  }
+  return &objects[index];
+}
 
-  MIR_type_t res_types[] = { statement->import ? data_type_to_sized_mir_type(statement->data_type)
-                                               : data_type_to_mir_type(statement->data_type) };
+static uintptr_t copy_object(HeapCopy* copy, void* base, size_t size, int kind, int layout)
+{
+  if (copy->object_count * 2 >= copy->object_capacity)
+  {
+    uint32_t capacity = copy->object_capacity * 2;
+    AddressPair* objects = GC_malloc_uncollectable(capacity * sizeof(AddressPair));
 
-  statement->proto =
-    MIR_new_proto_arr(vm->ctx, memory_sprintf("%s.proto", statement->name.lexeme),
-                      statement->data_type.type != TYPE_VOID, res_types, vars.size, vars.elems);
+    for (uint32_t i = 0; i < copy->object_capacity; i++)
+      if (copy->objects[i].from)
+        *find_copied_object(objects, capacity, copy->objects[i].from) = copy->objects[i];
 
-  if (statement->import)
-  {
-    statement->item = MIR_new_import(vm->ctx, statement->name.lexeme);
-    MIR_load_external(vm->ctx, statement->name.lexeme, (uintptr_t)statement->import);
+    GC_free(copy->objects);
+    copy->objects = objects;
+    copy->object_capacity = capacity;
   }
-  else
+
+  AddressPair* object = find_copied_object(copy->objects, copy->object_capacity, (uintptr_t)base);
+  if (!object->from)
   {
-    statement->item =
-      MIR_new_func_arr(vm->ctx, statement->name.lexeme, statement->data_type.type != TYPE_VOID,
-                       res_types, vars.size, vars.elems);
+    void* result = GC_generic_or_special_malloc(size, kind);
+    memcpy(result, base, size);
 
-    array_foreach(&statement->parameters, parameter)
+    *object = (AddressPair){ .from = (uintptr_t)base, .to = (uintptr_t)result };
+    copy->object_count++;
+
+    if (layout != -1)
     {
-      parameter->reg = MIR_reg(vm->ctx, vars.elems[_i].name, statement->item->u.func);
+      if (copy->pending_count == copy->pending_capacity)
+      {
+        copy->pending_capacity = copy->pending_capacity ? copy->pending_capacity * 2 : 256;
+        copy->pending = realloc(copy->pending, copy->pending_capacity * sizeof(PendingObject));
+      }
+
+      copy->pending[copy->pending_count++] = (PendingObject){ (uintptr_t)result, layout };
     }
   }
 
-  MIR_set_curr_func(vm->ctx, previous_func);
+  return object->to;
 }
 
-static void init_function_template_declaration(CyVM* vm, FuncTemplateStmt* statement)
+static uintptr_t copy_value(HeapCopy* copy, uintptr_t value, int layout)
 {
-  FuncStmt* function_declaration;
-  array_foreach(&statement->functions, function_declaration)
-  {
-    init_function_declaration(vm, function_declaration);
-  }
-}
+  if (!value || layout == -1)
+    return value;
 
-static void init_class_declaration(CyVM* vm, ClassStmt* statement)
-{
-  ArrayFuncStmt initializer_functions = {
-    .size = 0,
-    .cap = 1,
-    .elems = alloca(sizeof(FuncStmt)),
-  };
+  const Layout* description = &copy->source->layouts.elems[layout];
 
-  FuncStmt* function;
-  array_foreach(&statement->functions, function)
+  // Values of type "any" keep their type above the address, which decides how they are copied.
+  if (description->kind == LAYOUT_ANY)
   {
-    if (strcmp(function->name_raw.lexeme, "__init__") == 0)
-      array_add(&initializer_functions, function);
+    uintptr_t id = value >> 48;
+    int type_layout =
+      id < copy->source->typeid_layouts.size ? copy->source->typeid_layouts.elems[id] : -1;
 
-    init_function_declaration(vm, function);
+    return copy_value(copy, value & POINTER_MASK, type_layout) | (value & ~(uintptr_t)POINTER_MASK);
   }
 
-  FuncTemplateStmt* function_template;
-  array_foreach(&statement->function_templates, function_template)
+  // Anything pointing to the program itself, like string literals and functions, is moved to the
+  // same item in the copy.
+  void* base = GC_base((void*)value);
+  if (description->kind == LAYOUT_FUNCTION || base != (void*)value)
   {
-    init_function_template_declaration(vm, function_template);
+    AddressPair key = { .from = value };
+    AddressPair* item =
+      bsearch(&key, copy->items, copy->item_count, sizeof(AddressPair), compare_address_pairs);
+
+    return item ? item->to : value;
   }
 
-  unsigned int index = 0;
+  size_t size;
+  int kind = GC_get_kind_and_size(base, &size);
 
-  do
-  {
-    MIR_func_t previous_func = MIR_get_curr_func(vm->ctx);
-    MIR_set_curr_func(vm->ctx, NULL);
+  return copy_object(copy, base, size, kind, description->kind == LAYOUT_STRING ? -1 : layout);
+}
 
-    FuncStmt* initializer_function =
-      initializer_functions.size ? initializer_functions.elems[index] : NULL;
+static void copy_array_data(HeapCopy* copy, CyArray* array, int element)
+{
+  size_t size;
+  int kind;
 
-    const char* initalizer_name =
-      initializer_functions.size > 1
-        ? function_data_type_to_string(statement->name.lexeme,
-                                       initializer_function->function_data_type)
-        : statement->name.lexeme;
+  if (!array->data)
+    return;
 
-    ArrayMIR_var_t vars;
-    array_init(&vars);
+  // The elements of arrays made by "cyth_external_array" are copied as well, since the buffer is
+  // released along with the original array.
+  if (GC_base(array->data) == array->data)
+    kind = GC_get_kind_and_size(array->data, &size);
+  else if (get_external_buffer_size(array->data, &size))
+    kind = GC_I_PTRFREE;
+  else
+    return;
 
-    MIR_var_t var;
-    var.name = "this.0";
-    var.type = data_type_to_mir_type(DATA_TYPE(TYPE_OBJECT));
-    array_add(&vars, var);
+  uint32_t count = copy->object_count;
+  uintptr_t* elements = (uintptr_t*)copy_object(copy, array->data, size, kind, -1);
+  array->data = elements;
 
-    if (initializer_function)
-    {
-      for (unsigned int i = 1; i < initializer_function->parameters.size; i++)
-      {
-        VarStmt* parameter = array_at(&initializer_function->parameters, i);
+  if (copy->object_count == count || element == -1)
+    return;
 
-        MIR_var_t var;
-        var.name = memory_sprintf("%s.%d", parameter->name.lexeme, parameter->index);
-        var.type = data_type_to_mir_type(parameter->data_type);
+  // Elements beyond the size are left over from removals, and are cleared rather than copied.
+  for (size_t i = 0; i < size / sizeof(uintptr_t); i++)
+    elements[i] = i < (size_t)array->size ? copy_value(copy, elements[i], element) : 0;
+}
 
-        array_add(&vars, var);
-      }
-    }
+static void copy_globals(CyVM* vm, CyVM* source)
+{
+  HeapCopy copy = { .source = source };
+  copy.object_capacity = 256;
+  copy.objects = GC_malloc_uncollectable(copy.object_capacity * sizeof(AddressPair));
+  copy.items = malloc(map_size_symbol_entry(&source->symbol_table) * sizeof(AddressPair));
+
+  SymbolEntry* entry;
+  map_foreach_value(&source->symbol_table, entry)
+  {
+    SymbolEntry* target = get_symbol_entry(vm, entry->name);
+    if (target)
+      copy.items[copy.item_count++] =
+        (AddressPair){ .from = entry->address, .to = target->address };
+  }
+
+  qsort(copy.items, copy.item_count, sizeof(AddressPair), compare_address_pairs);
+
+  for (int i = 0; i < source->symbol_count; i++)
+  {
+    if (source->symbols[i].type != CY_SYMBOL_VARIABLE)
+      continue;
+
+    SymbolEntry* from = get_symbol_entry(source, source->symbols[i].name);
+    SymbolEntry* to = get_symbol_entry(vm, source->symbols[i].name);
+    if (!to)
+      continue;
 
-    MIR_item_t item = MIR_new_func_arr(
-      vm->ctx, initalizer_name, 1, (MIR_type_t[]){ data_type_to_mir_type(DATA_TYPE(TYPE_OBJECT)) },
-      vars.size, vars.elems);
+    if (from->item->u.data->el_type == MIR_T_F)
+      memcpy((void*)to->address, (void*)from->address, sizeof(float));
+    else
+      *(uintptr_t*)to->address = copy_value(&copy, *(uintptr_t*)from->address, from->layout);
+  }
 
-    MIR_item_t proto = MIR_new_proto_arr(
-      vm->ctx, memory_sprintf("%s.proto", initalizer_name), 1,
-      (MIR_type_t[]){ data_type_to_mir_type(DATA_TYPE(TYPE_OBJECT)) }, vars.size, vars.elems);
+  // Copied objects are visited by their layouts, so only the fields and elements that hold
+  // references are changed.
+  while (copy.pending_count)
+  {
+    PendingObject object = copy.pending[--copy.pending_count];
+    const Layout* layout = &source->layouts.elems[object.layout];
 
-    if (initializer_function)
+    if (layout->kind == LAYOUT_ARRAY)
     {
-      initializer_function->item_prototype = item;
-      initializer_function->proto_prototype = proto;
+      copy_array_data(&copy, (CyArray*)object.address, layout->element);
+      continue;
     }
-    else
+
+    LayoutField field;
+    array_foreach(&layout->fields, field)
     {
-      statement->default_constructor->item_prototype = item;
-      statement->default_constructor->proto_prototype = proto;
+      uintptr_t* slot = (uintptr_t*)(object.address + field.offset);
+      *slot = copy_value(&copy, *slot, field.layout);
     }
+  }
 
-    MIR_set_curr_func(vm->ctx, previous_func);
-    index++;
-
-  } while (index < initializer_functions.size);
+  GC_free(copy.objects);
+  free(copy.pending);
+  free(copy.items);
 }
 
-static void init_class_template_declaration(CyVM* vm, ClassTemplateStmt* statement)
+int cyth_compile(CyVM* vm)
 {
-  ClassStmt* class_declaration;
-  array_foreach(&statement->classes, class_declaration)
+  Memory* memory = memory_use(vm->memory);
+
+  bool result = vm->precompiled || (vm->cache_directory && read_module(vm, cache_path(vm), true)) ||
+                (!vm->unreadable && compile_statements(vm, vm->cache_directory || vm->cloning));
+
+  if (vm->unreadable)
   {
-    init_class_declaration(vm, class_declaration);
+    memory_reset();
+    memory_use(memory);
+    return false;
   }
-}
 
-static void init_variable_declaration(CyVM* vm, VarStmt* statement)
-{
-  if (statement->scope == SCOPE_GLOBAL)
-  {
-    uint64_t init = 0;
-    statement->item = MIR_new_data(
-      vm->ctx,
-      memory_sprintf("%s.%s", statement->name.lexeme, data_type_to_string(statement->data_type)),
-      data_type_to_mir_type(statement->data_type), 1, &init);
+  if (result && vm->cloning)
+    vm->import_count = get_imports(vm, &vm->imports);
 
-    MIR_reg_t ptr = _MIR_new_temp_reg(vm->ctx, MIR_T_I64, vm->function->u.func);
-    MIR_append_insn(vm->ctx, vm->function,
-                    MIR_new_insn(vm->ctx, MIR_MOV, MIR_new_reg_op(vm->ctx, ptr),
-                                 MIR_new_ref_op(vm->ctx, statement->item)));
+  if (vm->logging)
+    MIR_output(vm->ctx, stdout);
 
-    MIR_reg_t initializer =
-      _MIR_new_temp_reg(vm->ctx, data_type_to_mir_type(statement->data_type), vm->function->u.func);
-    generate_default_initialization(vm, initializer, statement->data_type);
+  generate_module(vm);
 
-    MIR_append_insn(
-      vm->ctx, vm->function,
-      MIR_new_insn(
-        vm->ctx, data_type_to_mov_type(statement->data_type),
-        MIR_new_mem_op(vm->ctx, data_type_to_mir_type(statement->data_type), 0, ptr, 0, 1),
-        MIR_new_reg_op(vm->ctx, initializer)));
-  }
-  else
-  {
-    UNREACHABLE("Unexpected scope type");
-  }
+  memory_reset();
+  memory_use(memory);
+  return result;
 }
 
-static void init_statement(CyVM* vm, Stmt* statement)
+static bool equal_data_type_token(DataTypeToken left, DataTypeToken right)
 {
-  switch (statement->type)
+  if (left.type != right.type || left.types.size != right.types.size)
+    return false;
+
+  if (left.token.lexeme != right.token.lexeme &&
+      (!left.token.lexeme || !right.token.lexeme ||
+       strcmp(left.token.lexeme, right.token.lexeme) != 0))
+    return false;
+
+  for (unsigned int i = 0; i < left.types.size; i++)
+    if (!equal_data_type_token(left.types.elems[i], right.types.elems[i]))
+      return false;
+
+  switch (left.type)
   {
-  case STMT_VARIABLE_DECL:
-    init_variable_declaration(vm, &statement->var);
-    return;
-  case STMT_FUNCTION_DECL:
-    init_function_declaration(vm, &statement->func);
-    return;
-  case STMT_CLASS_DECL:
-    init_class_declaration(vm, &statement->class);
-    return;
-  case STMT_CLASS_TEMPLATE_DECL:
-    init_class_template_declaration(vm, &statement->class_template);
-    return;
-  case STMT_FUNCTION_TEMPLATE_DECL:
-    init_function_template_declaration(vm, &statement->func_template);
-    return;
+  case DATA_TYPE_TOKEN_ARRAY:
+    return left.array.count == right.array.count &&
+           equal_data_type_token(*left.array.type, *right.array.type);
+
+  case DATA_TYPE_TOKEN_FUNCTION:
+    if (left.function.parameters.size != right.function.parameters.size ||
+        !equal_data_type_token(*left.function.return_value, *right.function.return_value))
+      return false;
+
+    for (unsigned int i = 0; i < left.function.parameters.size; i++)
+      if (!equal_data_type_token(left.function.parameters.elems[i],
+                                 right.function.parameters.elems[i]))
+        return false;
+
+    return true;
+
   default:
-    return;
+    return true;
   }
 }
 
-static void init_statements(CyVM* vm, ArrayStmt* statements)
+static bool replaces_function(FuncStmt* function, ArrayStmt* statements, unsigned int start)
 {
-  Stmt* statement;
-  array_foreach(statements, statement)
+  for (unsigned int i = start; i < statements->size; i++)
   {
-    init_statement(vm, statement);
+    Stmt* statement = statements->elems[i];
+    if (statement->type != STMT_FUNCTION_DECL || statement->func.import)
+      continue;
+
+    FuncStmt* replacement = &statement->func;
+    if (strcmp(function->name_raw.lexeme, replacement->name_raw.lexeme) != 0 ||
+        function->parameters.size != replacement->parameters.size ||
+        !equal_data_type_token(function->type, replacement->type))
+      continue;
+
+    bool equal = true;
+
+    VarStmt* parameter;
+    array_foreach(&function->parameters, parameter)
+    {
+      equal &= equal_data_type_token(parameter->type, replacement->parameters.elems[_i]->type);
+    }
+
+    if (equal)
+      return true;
   }
+
+  return false;
 }
 
-CyVM* cyth_init(void)
+static bool update_statements(CyVM* vm, char* string)
 {
-  CyVM* vm = malloc(sizeof(CyVM));
-  vm->ctx = MIR_init();
-  vm->module = MIR_new_module(vm->ctx, "main");
-  vm->function = MIR_new_func(vm->ctx, "<start>", 0, 0, 0);
-  vm->continue_label = NULL;
-  vm->break_label = NULL;
-  vm->jmp = NULL;
-  vm->start = NULL;
-  vm->logging = 0;
-  vm->error_callback = error_callback;
-  vm->panic_callback = panic_callback;
+  bool result = true;
   array_init(&vm->statements);
 
-  MIR_load_external(vm->ctx, "panic", (uintptr_t)panic);
-  vm->panic.proto = MIR_new_proto_arr(vm->ctx, "panic.proto", 0, NULL, 4,
-                                      (MIR_var_t[]){
-                                        { .name = "vm", .size = 0, .type = MIR_T_I64 },
-                                        { .name = "what", .size = 0, .type = MIR_T_I64 },
-                                        { .name = "pc", .size = 0, .type = MIR_T_I64 },
-                                        { .name = "fp", .size = 0, .type = MIR_T_I64 },
-                                      });
-  vm->panic.func = MIR_new_import(vm->ctx, "panic");
+  unsigned int* ends = memory_alloc((vm->source_count + 1) * sizeof(unsigned int));
 
-  MIR_load_external(vm->ctx, "malloc", (uintptr_t)GC_malloc);
-  vm->malloc.proto =
-    MIR_new_proto_arr(vm->ctx, "malloc.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
-                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->malloc.func = MIR_new_import(vm->ctx, "malloc");
+  for (int i = 0; i < vm->source_count; i++)
+  {
+    Source* source = &vm->sources[i];
+    result &= source->import ? load_function(vm, source->string, source->import)
+                             : load_string(vm, source->string);
 
-  MIR_load_external(vm->ctx, "malloc_atomic", (uintptr_t)GC_malloc_atomic);
-  vm->malloc_atomic.proto =
-    MIR_new_proto_arr(vm->ctx, "malloc_atomic.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
-                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->malloc_atomic.func = MIR_new_import(vm->ctx, "malloc_atomic");
+    ends[i] = vm->statements.size;
+  }
 
-  MIR_load_external(vm->ctx, "realloc", (uintptr_t)GC_realloc);
-  vm->realloc.proto =
-    MIR_new_proto_arr(vm->ctx, "realloc.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 2,
-                      (MIR_var_t[]){ { .name = "ptr", .size = 0, .type = MIR_T_I64 },
-                                     { .name = "size", .size = 0, .type = MIR_T_I64 } });
-  vm->realloc.func = MIR_new_import(vm->ctx, "realloc");
+  unsigned int start = vm->statements.size;
+  result &= load_string(vm, string);
+  ends[vm->source_count] = vm->statements.size;
 
-  MIR_load_external(vm->ctx, "memcpy", (uintptr_t)memcpy);
-  vm->memcpy.proto =
-    MIR_new_proto_arr(vm->ctx, "memcpy.proto", 0, (MIR_type_t[]){ MIR_T_I64 }, 3,
-                      (MIR_var_t[]){ { .name = "dest", .size = 0, .type = MIR_T_I64 },
-                                     { .name = "soruce", .size = 0, .type = MIR_T_I64 },
-                                     { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->memcpy.func = MIR_new_import(vm->ctx, "memcpy");
+  if (!result)
+    return false;
 
-  MIR_load_external(vm->ctx, "memmove", (uintptr_t)memmove);
-  vm->memmove.proto =
-    MIR_new_proto_arr(vm->ctx, "memmove.proto", 0, (MIR_type_t[]){ MIR_T_I64 }, 3,
-                      (MIR_var_t[]){ { .name = "dest", .size = 0, .type = MIR_T_I64 },
-                                     { .name = "soruce", .size = 0, .type = MIR_T_I64 },
-                                     { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->memmove.func = MIR_new_import(vm->ctx, "memmove");
+  // Functions redeclared with the same signature by a later string replace the earlier declaration,
+  // the rest of the earlier program is checked again but only referenced by the update.
+  ArrayStmt statements;
+  array_init(&statements);
 
-  MIR_load_external(vm->ctx, "string.equals", (uintptr_t)string_equals);
-  vm->string_equals.proto =
-    MIR_new_proto_arr(vm->ctx, "string.equals.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 2,
-                      (MIR_var_t[]){ { .name = "left", .size = 0, .type = MIR_T_I64 },
-                                     { .name = "right", .size = 0, .type = MIR_T_I64 } });
-  vm->string_equals.func = MIR_new_import(vm->ctx, "string.equals");
+  unsigned int count = 0;
+  int source = 0;
 
-  MIR_load_external(vm->ctx, "string.bool_cast", (uintptr_t)string_bool_cast);
-  vm->string_bool_cast.proto =
-    MIR_new_proto_arr(vm->ctx, "string.bool_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
-                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->string_bool_cast.func = MIR_new_import(vm->ctx, "string.bool_cast");
+  Stmt* statement;
+  array_foreach(&vm->statements, statement)
+  {
+    while (_i >= ends[source])
+      source++;
 
-  MIR_load_external(vm->ctx, "string.int_cast", (uintptr_t)string_int_cast);
-  vm->string_int_cast.proto =
-    MIR_new_proto_arr(vm->ctx, "string.int_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
-                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->string_int_cast.func = MIR_new_import(vm->ctx, "string.int_cast");
+    if (statement->type == STMT_FUNCTION_DECL && !statement->func.import &&
+        replaces_function(&statement->func, &vm->statements, ends[source]))
+      continue;
 
-  MIR_load_external(vm->ctx, "string.float_cast", (uintptr_t)string_float_cast);
-  vm->string_float_cast.proto =
-    MIR_new_proto_arr(vm->ctx, "string.float_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
-                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_F } });
-  vm->string_float_cast.func = MIR_new_import(vm->ctx, "string.float_cast");
+    if (_i < start)
+      count++;
 
-  MIR_load_external(vm->ctx, "string.char_cast", (uintptr_t)string_char_cast);
-  vm->string_char_cast.proto =
-    MIR_new_proto_arr(vm->ctx, "string.char_cast.proto", 1, (MIR_type_t[]){ MIR_T_I64 }, 1,
-                      (MIR_var_t[]){ { .name = "n", .size = 0, .type = MIR_T_I64 } });
-  vm->string_char_cast.func = MIR_new_import(vm->ctx, "string.char_cast");
+    array_add(&statements, statement);
+  }
 
-  map_init_function(&vm->functions, 0, 0);
-  map_init_mir_item(&vm->string_constants, 0, 0);
-  map_init_mir_item(&vm->items, 0, 0);
-  map_init_s64(&vm->typeids, 0, 0);
+  vm->statements = statements;
+  start = count;
 
-  return vm;
-}
+  int nodes = parser_nodes();
 
-int cyth_compile(CyVM* vm)
-{
+  begin_phase(vm);
   checker_init(vm->statements, vm->error_callback, NULL);
   checker_validate();
+  end_phase(vm, &vm->stats.check);
 
-  bool result = !checker_errors();
-  if (result)
+  vm->stats.nodes += parser_nodes() - nodes;
+
+  if (checker_errors())
+    return false;
+
+  begin_phase(vm);
+  map_init_sv(&vm->function_emits, 0, 0);
+  init_module(vm, "update");
+
+  for (MIR_module_t module = DLIST_HEAD(MIR_module_t, *MIR_get_module_list(vm->ctx));
+       module != vm->module; module = DLIST_NEXT(MIR_module_t, module))
   {
-    VarStmt* global_local;
-    ArrayVarStmt global_local_statements = checker_global_locals();
-    array_foreach(&global_local_statements, global_local)
+    for (MIR_item_t item = DLIST_HEAD(MIR_item_t, module->items); item != NULL;
+         item = DLIST_NEXT(MIR_item_t, item))
     {
-      global_local->reg = MIR_new_func_reg(
-        vm->ctx, vm->function->u.func, data_type_to_mir_type(global_local->data_type),
-        memory_sprintf("%s.%d", global_local->name.lexeme, global_local->index));
+      if ((item->item_type == MIR_func_item || item->item_type == MIR_data_item) && item->addr)
+        map_put_mir_item(&vm->definitions, MIR_item_name(vm->ctx, item), item);
     }
+  }
 
-    init_statements(vm, &vm->statements);
-    generate_statements(vm, &vm->statements);
+  for (unsigned int i = start; i < vm->statements.size; i++)
+  {
+    statement = vm->statements.elems[i];
+    if (statement->type == STMT_FUNCTION_DECL)
+      map_put_sint(&vm->replacements, statement->func.name.lexeme, true);
+  }
+
+  VarStmt* global_local;
+  ArrayVarStmt global_local_statements = checker_global_locals();
+  array_foreach(&global_local_statements, global_local)
+  {
+    global_local->reg = MIR_new_func_reg(
+      vm->ctx, vm->function->u.func, data_type_to_mir_type(global_local->data_type),
+      memory_sprintf("%s.%d", global_local->name.lexeme, global_local->index));
+  }
+
+  init_statements(vm, &vm->statements);
+
+  array_foreach(&vm->statements, statement)
+  {
+    if (_i >= start || statement->type == STMT_FUNCTION_DECL ||
+        statement->type == STMT_FUNCTION_TEMPLATE_DECL || statement->type == STMT_CLASS_DECL ||
+        statement->type == STMT_CLASS_TEMPLATE_DECL)
+      generate_statement(vm, statement);
   }
 
   MIR_append_insn(vm->ctx, vm->function, MIR_new_ret_insn(vm->ctx, 0));
   MIR_finish_func(vm->ctx);
-  MIR_finish_module(vm->ctx);
 
-  if (vm->logging)
-    MIR_output(vm->ctx, stdout);
+  generate_tier_counters(vm);
 
-  MIR_load_module(vm->ctx, vm->module);
-  MIR_gen_init(vm->ctx);
-  MIR_gen_set_optimize_level(vm->ctx, 3);
-  MIR_link(vm->ctx, MIR_set_gen_interface, NULL);
+  MIR_finish_module(vm->ctx);
+  end_phase(vm, &vm->stats.emit);
 
-  vm->start = (Start)MIR_gen(vm->ctx, vm->function);
+  if (vm->logging)
+    MIR_output_module(vm->ctx, stdout, vm->module);
 
-  GC_set_no_dls(true);
+  generate_module(vm);
 
-  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
-       item = DLIST_NEXT(MIR_item_t, item))
+  for (unsigned int i = start; i < vm->statements.size; i++)
   {
-    if (item->item_type != MIR_data_item)
+    statement = vm->statements.elems[i];
+    if (statement->type != STMT_FUNCTION_DECL)
       continue;
 
-    if (item->u.data->el_type != MIR_T_I64)
+    const char* name = statement->func.name.lexeme;
+    if (!map_get_mir_item(&vm->definitions, name))
       continue;
 
-    GC_add_roots(item->addr, (char*)item->addr + sizeof(uintptr_t));
+    for (MIR_module_t module = DLIST_HEAD(MIR_module_t, *MIR_get_module_list(vm->ctx));
+         module != vm->module; module = DLIST_NEXT(MIR_module_t, module))
+    {
+      for (MIR_item_t item = DLIST_HEAD(MIR_item_t, module->items); item != NULL;
+           item = DLIST_NEXT(MIR_item_t, item))
+      {
+        if (item->item_type == MIR_func_item && item->addr && strcmp(item->u.func->name, name) == 0)
+          _MIR_redirect_thunk(vm->ctx, item->addr, statement->func.item->addr);
+      }
+    }
   }
 
+  add_source(vm, string, 0);
+  return true;
+}
+
+int cyth_update_string(CyVM* vm, char* string)
+{
+  if (!vm->incremental || !vm->start)
+    return false;
+
+  vm->stats = (CyCompileStats){ 0 };
+
+  Memory* memory = memory_use(vm->memory);
+  bool result = update_statements(vm, string);
+
   memory_reset();
+  memory_use(memory);
   return result;
 }
 
@@ -5041,22 +8369,103 @@ void cyth_run(CyVM* vm)
     cyth_try_catch(vm, { vm->start(); });
 }
 
-void cyth_destroy(CyVM* vm)
+CyVM* cyth_clone(CyVM* vm)
 {
-  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
-       item = DLIST_NEXT(MIR_item_t, item))
+  if (!vm->module_data.data || vm->incremental)
+    return NULL;
+
+  CyVM* clone = cyth_init();
+  clone->lazy = vm->lazy;
+  clone->compile_threads = vm->compile_threads;
+  clone->optimize_level = vm->optimize_level;
+  clone->budgeted = vm->budgeted;
+  clone->import_key = vm->import_key;
+  clone->error_callback = vm->error_callback;
+  clone->panic_callback = vm->panic_callback;
+
+  Memory* memory = memory_use(clone->memory);
+  bool result = parse_module(clone, vm->module_data, false, vm->imports, vm->import_count);
+
+  if (result)
+  {
+    generate_module(clone);
+    copy_globals(clone, vm);
+  }
+
+  memory_reset();
+  memory_use(memory);
+
+  if (!result)
+  {
+    cyth_destroy(clone);
+    return NULL;
+  }
+
+  // The clone can be cloned in turn, even after "vm" is destroyed.
+  clone->cloning = true;
+  clone->module_data.data = malloc(vm->module_data.size);
+  clone->module_data.size = vm->module_data.size;
+  memcpy(clone->module_data.data, vm->module_data.data, vm->module_data.size);
+
+  if (vm->import_count)
+  {
+    clone->imports = malloc(vm->import_count * sizeof(uintptr_t));
+    clone->import_count = vm->import_count;
+    memcpy(clone->imports, vm->imports, vm->import_count * sizeof(uintptr_t));
+  }
+
+  return clone;
+}
+
+void cyth_destroy(CyVM* vm)
+{
+  if (vm->start)
   {
-    if (item->item_type != MIR_data_item)
-      continue;
+    for (MIR_module_t module = DLIST_HEAD(MIR_module_t, *MIR_get_module_list(vm->ctx));
+         module != NULL; module = DLIST_NEXT(MIR_module_t, module))
+    {
+      for (MIR_item_t item = DLIST_HEAD(MIR_item_t, module->items); item != NULL;
+           item = DLIST_NEXT(MIR_item_t, item))
+      {
+        if (item->item_type != MIR_data_item || !item->addr)
+          continue;
 
-    if (item->u.data->el_type != MIR_T_I64)
-      continue;
+        if (item->u.data->el_type != MIR_T_I64)
+          continue;
 
-    GC_remove_roots(item->addr, (char*)item->addr + sizeof(uintptr_t));
+        GC_remove_roots(item->addr, (char*)item->addr + sizeof(uintptr_t));
+      }
+    }
+
+    MIR_gen_finish(vm->ctx);
   }
 
-  MIR_gen_finish(vm->ctx);
+  for (int i = 0; i < vm->source_count; i++)
+    free(vm->sources[i].string);
+
+  for (int i = 0; i < vm->typeid_count; i++)
+    free(vm->typeid_names[i]);
+
   MIR_finish(vm->ctx);
+  free(vm->sources);
+  free(vm->typeid_names);
+  for (int i = 0; i < vm->code_range_count; i++)
+    free(vm->code_ranges[i].lines);
+
+  SymbolEntry* entry;
+  map_foreach_value(&vm->symbol_table, entry)
+  {
+    free(entry->call);
+  }
+
+  free(vm->symbols);
+  free(vm->module_data.data);
+  free(vm->imports);
+  free(vm->code_ranges);
+  free(vm->cache_directory);
+  free(vm->function_stats);
+  memory_destroy(vm->memory);
+  memory_destroy(vm->symbol_memory);
   free(vm);
 }
 
@@ -5078,49 +8487,150 @@ void cyth_set_logging(CyVM* vm, int logging)
   vm->logging = logging;
 }
 
-int cyth_load_function(CyVM* vm, const char* signature, uintptr_t func)
+void cyth_set_lazy_compilation(CyVM* vm, int lazy)
 {
-  lexer_init((char*)signature, vm->error_callback);
-  ArrayToken tokens = lexer_scan();
+  vm->lazy = lazy;
+}
 
-  if (lexer_errors())
-    return false;
+void cyth_set_tiered_compilation(CyVM* vm, int threshold)
+{
+  vm->tier_threshold = threshold;
+}
 
-  parser_init(tokens, vm->error_callback);
-  Stmt* statement = parser_parse_import_function_declaration_statement((void*)func);
+void cyth_set_incremental_compilation(CyVM* vm, int incremental)
+{
+  vm->incremental = incremental;
+}
 
-  if (parser_errors() || statement == NULL)
-    return false;
+void cyth_set_optimize_level(CyVM* vm, int level)
+{
+  vm->optimize_level = level < 0 ? 0 : level > 3 ? 3 : level;
+}
 
-  array_add(&vm->statements, statement);
-  return true;
+void cyth_set_compile_threads(CyVM* vm, int threads)
+{
+  vm->compile_threads = threads;
 }
 
-int cyth_load_string(CyVM* vm, char* string)
+void cyth_set_execution_budget(CyVM* vm, int64_t budget)
 {
-  lexer_init(string, vm->error_callback);
-  ArrayToken tokens = lexer_scan();
+  vm->budgeted = true;
+  vm->budget = budget ? budget : INT64_MAX;
+  vm->budget_floor = 0;
+}
 
-  if (lexer_errors())
-    return false;
+void cyth_interrupt(CyVM* vm)
+{
+  vm->budget_floor = INT64_MAX;
+}
 
-  parser_init(tokens, vm->error_callback);
-  ArrayStmt statements = parser_parse();
+void cyth_set_cloning(CyVM* vm, int cloning)
+{
+  vm->cloning = cloning;
+}
 
-  if (parser_errors())
-    return false;
+void cyth_set_heap_limit(CyVM* vm, size_t limit)
+{
+  vm->heap_ceiling = limit && limit <= SIZE_MAX - vm->heap_stats.bytes
+                       ? vm->heap_stats.bytes + limit
+                       : SIZE_MAX;
+}
 
-  Stmt* statement;
-  array_foreach(&statements, statement)
+void cyth_get_heap_stats(CyVM* vm, CyHeapStats* stats)
+{
+  *stats = vm->heap_stats;
+}
+
+void cyth_set_cache_directory(CyVM* vm, const char* path)
+{
+  free(vm->cache_directory);
+  vm->cache_directory = path ? strdup(path) : NULL;
+}
+
+void cyth_get_compile_stats(CyVM* vm, CyCompileStats* stats)
+{
+  *stats = vm->stats;
+  stats->code_size = 0;
+  stats->functions = vm->function_stats;
+
+  int index = 0;
+
+  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items);
+       item != NULL && index < stats->function_count; item = DLIST_NEXT(MIR_item_t, item))
   {
-    array_add(&vm->statements, statement);
+    if (item->item_type != MIR_func_item)
+      continue;
+
+    CyFunctionStats* function_stats = &vm->function_stats[index++];
+    function_stats->code_size = item->u.func->machine_code ? item->u.func->length : 0;
+
+    stats->code_size += function_stats->code_size;
   }
+}
 
-  return true;
+int cyth_get_generated_function_count(CyVM* vm)
+{
+  int count = 0;
+
+  for (MIR_module_t module = DLIST_HEAD(MIR_module_t, *MIR_get_module_list(vm->ctx));
+       module != NULL; module = DLIST_NEXT(MIR_module_t, module))
+  {
+    for (MIR_item_t item = DLIST_HEAD(MIR_item_t, module->items); item != NULL;
+         item = DLIST_NEXT(MIR_item_t, item))
+    {
+      if (item->item_type != MIR_func_item)
+        continue;
+
+      if (item->u.func->machine_code)
+        count++;
+    }
+  }
+
+  return count;
+}
+
+int cyth_load_function(CyVM* vm, const char* signature, uintptr_t func)
+{
+  Memory* memory = memory_use(vm->memory);
+  vm->import_key = cache_hash(vm->import_key, signature, strlen(signature) + 1);
+
+  if (vm->cache_directory)
+    vm->cache_key = cache_hash(vm->cache_key, signature, strlen(signature) + 1);
+
+  bool result = load_function(vm, signature, func);
+
+  if (result && vm->incremental)
+    add_source(vm, signature, func);
+
+  memory_use(memory);
+  return result;
+}
+
+int cyth_load_string(CyVM* vm, char* string)
+{
+  Memory* memory = memory_use(vm->memory);
+  bool result = true;
+
+  if (vm->cache_directory)
+  {
+    vm->cache_key = cache_hash(vm->cache_key, string, strlen(string) + 1);
+    array_add(&vm->cache_sources, memory_strdup(string));
+  }
+  else
+  {
+    result = load_string(vm, string);
+  }
+
+  if (result && vm->incremental)
+    add_source(vm, string, 0);
+
+  memory_use(memory);
+  return result;
 }
 
 int cyth_load_file(CyVM* vm, const char* filename)
 {
+  Memory* memory = memory_use(vm->memory);
   bool result = false;
   FILE* file = fopen(filename, "rb");
   if (!file)
@@ -5150,51 +8660,190 @@ clean_up_file:
   fclose(file);
 
 clean_up:
+  memory_use(memory);
+  return result;
+}
+
+int cyth_load_compiled_file(CyVM* vm, const char* filename)
+{
+  Memory* memory = memory_use(vm->memory);
+  bool result = read_module(vm, filename, false);
+
+  memory_use(memory);
+  return result;
+}
+
+int cyth_compile_to_file(CyVM* vm, const char* filename)
+{
+  Memory* memory = memory_use(vm->memory);
+  bool result = compile_statements(vm, true) && write_module(vm, filename);
+
+  memory_reset();
+  memory_use(memory);
   return result;
 }
 
 void* cyth_alloc(int atomic, uintptr_t size)
 {
-  return atomic ? GC_malloc_atomic(size) : GC_malloc(size);
+  count_allocation(size, CY_ALLOCATION_HOST, CALLER_LOCATION);
+
+  if (!atomic)
+    return GC_malloc(size);
+
+  // Unlike the rest, atomic memory is not cleared by the collector, and strings built by hosts
+  // rely on their hash starting out as zero.
+  void* result = GC_malloc_atomic(size);
+  if (result)
+    memset(result, 0, size);
+
+  return result;
 }
 
-uintptr_t cyth_get_function(CyVM* vm, const char* name)
+CyString* cyth_alloc_string(int size)
 {
-  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
-       item = DLIST_NEXT(MIR_item_t, item))
-  {
-    if (item->item_type != MIR_func_item)
-      continue;
+  count_allocation(sizeof(CyString) + size + 1, CY_ALLOCATION_HOST, CALLER_LOCATION);
 
-    if (strcmp(name, item->u.func->name) == 0)
-      return MIR_gen(vm->ctx, item);
-  }
+  CyString* string = GC_malloc_atomic(sizeof(CyString) + size + 1);
+  string->size = size;
+  string->hash = 0;
+  string->data[size] = '\0';
 
-  return 0;
+  return string;
+}
+
+CyArray* cyth_external_array(void* data, int size, uintptr_t element_size,
+                             void (*release)(void* data, void* context), void* context)
+{
+  count_allocation(sizeof(CyArray), CY_ALLOCATION_HOST, CALLER_LOCATION);
+
+  CyArray* array = GC_malloc(sizeof(CyArray));
+  array->size = size;
+  array->capacity = size;
+  array->data = data;
+
+  ExternalBuffer* buffer = malloc(sizeof(ExternalBuffer));
+  buffer->data = data;
+  buffer->size = size * element_size;
+  buffer->release = release;
+  buffer->context = context;
+
+  lock_external_buffers();
+  ExternalBuffer** bucket = find_external_buffer(data);
+  buffer->next = *bucket;
+  *bucket = buffer;
+  external_buffer_count++;
+  unlock_external_buffers();
+
+  GC_register_finalizer_no_order(array, release_external_buffer, buffer, NULL, NULL);
+  return array;
+}
+
+uintptr_t cyth_get_function(CyVM* vm, const char* name)
+{
+  SymbolEntry* entry = get_symbol_entry(vm, name);
+  if (!entry || entry->item->item_type != MIR_func_item)
+    return 0;
+
+  return entry->address;
 }
 
 uintptr_t cyth_get_variable(CyVM* vm, const char* name)
 {
-  for (MIR_item_t item = DLIST_HEAD(MIR_item_t, vm->module->items); item != NULL;
-       item = DLIST_NEXT(MIR_item_t, item))
+  SymbolEntry* entry = get_symbol_entry(vm, name);
+  if (!entry || entry->item->item_type != MIR_data_item)
+    return 0;
+
+  return entry->address;
+}
+
+CyCall* cyth_get_call(CyVM* vm, const char* name)
+{
+  SymbolEntry* entry = get_symbol_entry(vm, name);
+  if (!entry || entry->item->item_type != MIR_func_item)
+    return NULL;
+
+  if (!entry->call)
   {
-    if (item->item_type != MIR_data_item)
-      continue;
+    MIR_func_t func = entry->item->u.func;
+    _MIR_arg_desc_t* arguments = alloca((func->nargs + 1) * sizeof(_MIR_arg_desc_t));
 
-    if (strcmp(name, item->u.func->name) == 0)
-      return (uintptr_t)item->addr;
+    for (uint32_t i = 0; i < func->nargs; i++)
+      arguments[i] = (_MIR_arg_desc_t){ .type = VARR_GET(MIR_var_t, func->vars, i).type };
+
+    // The trampoline takes the results and then the arguments from an array of values, and calls
+    // the function with them in the registers of its prototype.
+    CyCall* call = malloc(sizeof(CyCall));
+    call->vm = vm;
+    call->address = entry->address;
+    call->trampoline = (Trampoline)(uintptr_t)_MIR_get_ff_call(vm->ctx, func->nres, func->res_types,
+                                                               func->nargs, arguments, func->nargs);
+    call->argument_count = func->nargs;
+    call->result_count = func->nres;
+
+    entry->call = call;
   }
 
-  return 0;
+  return entry->call;
+}
+
+CyStatus cyth_call(CyCall* call, const CyValue* arguments, CyValue* result)
+{
+  return cyth_call_batch(call, arguments, result, 1, NULL);
+}
+
+CyStatus cyth_call_batch(CyCall* call, const CyValue* arguments, CyValue* results, int count,
+                         int* completed)
+{
+  MIR_val_t* values = alloca((call->result_count + call->argument_count) * sizeof(MIR_val_t));
+  MIR_val_t* values_arguments = values + call->result_count;
+
+  volatile int index = 0;
+  volatile CyStatus status = CY_STATUS_PANIC;
+
+  cyth_try_catch(call->vm, {
+    for (int i = 0; i < count; i++)
+    {
+      const CyValue* argument = arguments + (size_t)i * call->argument_count;
+      for (int j = 0; j < call->argument_count; j++)
+        values_arguments[j].i = argument[j].i;
+
+      call->trampoline(call->address, values);
+
+      if (results && call->result_count)
+        results[i].i = values[0].i;
+
+      index = i + 1;
+    }
+
+    status = CY_STATUS_OK;
+  });
+
+  if (completed)
+    *completed = index;
+
+  return status;
+}
+
+const CySymbol* cyth_get_symbols(CyVM* vm, int* count)
+{
+  *count = vm->symbol_count;
+  return vm->symbols;
 }
 
 #ifdef _WIN32
-PVOID handler;
+static INIT_ONCE process_once = INIT_ONCE_STATIC_INIT;
+static DWORD thread_key;
+static THREAD_LOCAL bool thread_initialized;
+static THREAD_LOCAL bool stack_overflow;
+
 static LONG WINAPI vector_handler(EXCEPTION_POINTERS* ExceptionInfo)
 {
   uintptr_t pc = 0;
   uintptr_t fp = 0;
 
+  if (!panic_jmp)
+    return EXCEPTION_CONTINUE_SEARCH;
+
 #ifdef _M_ARM64
   pc = ExceptionInfo->ContextRecord->Pc ? ExceptionInfo->ContextRecord->Pc
                                         : ExceptionInfo->ContextRecord->Lr - 4;
@@ -5209,28 +8858,112 @@ static LONG WINAPI vector_handler(EXCEPTION_POINTERS* ExceptionInfo)
   {
   case EXCEPTION_INT_DIVIDE_BY_ZERO:
   case EXCEPTION_FLT_DIVIDE_BY_ZERO:
-    panic(panic_vm, "Division by zero", pc, fp);
+    panic(panic_jmp->vm, "Division by zero", pc, fp);
     return EXCEPTION_CONTINUE_EXECUTION;
 
   case EXCEPTION_STACK_OVERFLOW:
-    panic(panic_vm, "Stack overflow", pc, fp);
+    stack_overflow = true;
+    panic(panic_jmp->vm, "Stack overflow", pc, fp);
     return EXCEPTION_CONTINUE_EXECUTION;
 
   case EXCEPTION_ACCESS_VIOLATION:
-    panic(panic_vm, "Invalid memory or null pointer access", pc, fp);
+    panic(panic_jmp->vm, "Invalid memory or null pointer access", pc, fp);
     return EXCEPTION_CONTINUE_EXECUTION;
 
   default:
     return EXCEPTION_CONTINUE_SEARCH;
   }
 }
+
+static void WINAPI exit_thread(void* registered)
+{
+#ifdef GC_THREADS
+  if (registered)
+    GC_unregister_my_thread();
+#else
+  (void)registered;
+#endif
+}
+
+static BOOL CALLBACK init_process_once(PINIT_ONCE once, PVOID parameter, PVOID* context)
+{
+  GC_INIT();
+#ifdef GC_THREADS
+  GC_allow_register_threads();
+#endif
+
+  thread_key = FlsAlloc(exit_thread);
+  AddVectoredExceptionHandler(1, vector_handler);
+  init_char_strings();
+  return TRUE;
+}
+
+static void init_process(void)
+{
+  InitOnceExecuteOnce(&process_once, init_process_once, NULL, NULL);
+}
+
+static void init_thread(void)
+{
+  if (thread_initialized)
+    return;
+
+  ULONG size = 1024 * 1024;
+  SetThreadStackGuarantee(&size);
+
+  // Without thread support in the collector, only the thread that initialized it may use a VM.
+#ifdef GC_THREADS
+  struct GC_stack_base base;
+  if (GC_get_stack_base(&base) == GC_SUCCESS)
+  {
+    int result = GC_register_my_thread(&base);
+    if (result == GC_SUCCESS || result == GC_DUPLICATE)
+      FlsSetValue(thread_key, (void*)1);
+  }
+#endif
+
+  thread_initialized = true;
+}
 #else
+static pthread_once_t process_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static struct sigaction previous_segv_action;
+static struct sigaction previous_fpe_action;
+static THREAD_LOCAL struct
+{
+  bool initialized;
+  bool registered;
+  void* signal_stack;
+  void* stack_base;
+  size_t stack_size;
+} thread_state;
+
+static void forward_signal(int sig, siginfo_t* si, void* ctx)
+{
+  struct sigaction* action = sig == SIGSEGV ? &previous_segv_action : &previous_fpe_action;
+
+  if ((action->sa_flags & SA_SIGINFO) && action->sa_sigaction)
+    action->sa_sigaction(sig, si, ctx);
+  else if (action->sa_handler != SIG_DFL && action->sa_handler != SIG_IGN)
+    action->sa_handler(sig);
+  else
+    sigaction(sig, action, NULL);
+}
+
 static void signal_handler(int sig, siginfo_t* si, void* ctx)
 {
   ucontext_t* uc = (ucontext_t*)ctx;
   uintptr_t pc = 0;
   uintptr_t fp = 0;
 
+  // The handlers stay installed for the whole process, faults outside of "cyth_try_catch" belong
+  // to someone else. Restoring the previous action makes the faulting instruction raise it again.
+  if (!panic_jmp)
+  {
+    forward_signal(sig, si, ctx);
+    return;
+  }
+
 #if defined(__linux__) && defined(__x86_64__)
   pc = uc->uc_mcontext.gregs[REG_RIP] ? (uintptr_t)uc->uc_mcontext.gregs[REG_RIP]
                                       : (*(uintptr_t*)uc->uc_mcontext.gregs[REG_RSP]) - 2;
@@ -5249,99 +8982,151 @@ static void signal_handler(int sig, siginfo_t* si, void* ctx)
 
   if (sig == SIGSEGV)
   {
-    void* stack_base;
-    size_t stack_size;
-
-#if defined(__APPLE__)
-    stack_size = pthread_get_stacksize_np(pthread_self());
-    void* stack_addr = pthread_get_stackaddr_np(pthread_self());
-
-    int stack_variable;
-    if (stack_addr > (void*)&stack_variable)
-      stack_base = (uint8_t*)stack_addr - stack_size;
-    else
-      stack_base = stack_addr;
-#else
-    pthread_attr_t attributes;
-    pthread_getattr_np(pthread_self(), &attributes);
-    pthread_attr_getstack(&attributes, &stack_base, &stack_size);
-    pthread_attr_destroy(&attributes);
-#endif
-
     uint8_t* fault = si->si_addr;
+    uint8_t* stack_base = thread_state.stack_base;
 
-    if (fault < (uint8_t*)stack_base && fault >= (uint8_t*)stack_base - stack_size)
-      panic(panic_vm, "Stack overflow", pc, fp);
+    if (fault < stack_base && fault >= stack_base - thread_state.stack_size)
+      panic(panic_jmp->vm, "Stack overflow", pc, fp);
     else if (fault < (uint8_t*)0xffff)
-      panic(panic_vm, "Invalid memory or null pointer access", pc, fp);
+      panic(panic_jmp->vm, "Invalid memory or null pointer access", pc, fp);
     else
-      panic(panic_vm, "Internal runtime error", pc, fp);
+      panic(panic_jmp->vm, "Internal runtime error", pc, fp);
   }
   else if (sig == SIGFPE)
   {
-    panic(panic_vm, "Division by zero", pc, fp);
+    panic(panic_jmp->vm, "Division by zero", pc, fp);
   }
 }
-#endif
 
-void* cyth_push_jmp(CyVM* vm, void* new)
+static void exit_thread(void* data)
 {
-  jmp_buf* old = vm->jmp;
-  vm->jmp = new;
+  (void)data;
 
-  if (!old)
-  {
-#ifndef _WIN32
-    static char stack[SIGSTKSZ * 2];
-    stack_t ss = {
-      .ss_size = SIGSTKSZ * 2,
-      .ss_sp = stack,
-    };
-    sigaltstack(&ss, NULL);
+  if (thread_state.registered)
+    GC_unregister_my_thread();
+
+  stack_t ss = { .ss_flags = SS_DISABLE };
+  sigaltstack(&ss, NULL);
+
+  free(thread_state.signal_stack);
+}
+
+static void init_process_once(void)
+{
+  // The collector assumes it is initialized on the main thread, and would otherwise scan this
+  // thread's stack up to the bottom of the main one.
+  struct GC_stack_base base;
+  if (GC_get_stack_base(&base) == GC_SUCCESS)
+    GC_set_stackbottom(NULL, &base);
+
+  GC_INIT();
+  GC_allow_register_threads();
+
+  pthread_key_create(&thread_key, exit_thread);
+  init_char_strings();
+
+  // Panics jump out of the handler, so the signal must not stay blocked (the jump buffers do not
+  // save the signal mask, as that would cost a system call on every "cyth_try_catch").
+  struct sigaction sa = { 0 };
+  sa.sa_flags = SA_ONSTACK | SA_SIGINFO | SA_NODEFER;
+  sa.sa_sigaction = signal_handler;
+  sigemptyset(&sa.sa_mask);
+
+  sigaction(SIGSEGV, &sa, &previous_segv_action);
+  sigaction(SIGFPE, &sa, &previous_fpe_action);
+}
+
+static void init_process(void)
+{
+  pthread_once(&process_once, init_process_once);
+}
 
-    struct sigaction sa = { 0 };
-    sa.sa_flags = SA_ONSTACK | SA_SIGINFO;
-    sigemptyset(&sa.sa_mask);
+static void init_thread(void)
+{
+  if (thread_state.initialized)
+    return;
+
+  // Threads the host created have to be known to the collector, which scans their stacks. The
+  // thread that initialized the collector is already registered, and must be unregistered too.
+  struct GC_stack_base base;
+  if (GC_get_stack_base(&base) == GC_SUCCESS)
+  {
+    int result = GC_register_my_thread(&base);
+    thread_state.registered = result == GC_SUCCESS || result == GC_DUPLICATE;
+  }
 
-    sa.sa_sigaction = signal_handler;
-    sigaction(SIGSEGV, &sa, NULL);
+#if defined(__APPLE__)
+  thread_state.stack_size = pthread_get_stacksize_np(pthread_self());
+  void* stack_addr = pthread_get_stackaddr_np(pthread_self());
 
-    sa.sa_sigaction = signal_handler;
-    sigaction(SIGFPE, &sa, NULL);
+  int stack_variable;
+  if (stack_addr > (void*)&stack_variable)
+    thread_state.stack_base = (uint8_t*)stack_addr - thread_state.stack_size;
+  else
+    thread_state.stack_base = stack_addr;
 #else
-    ULONG size = 1024 * 1024;
-    SetThreadStackGuarantee(&size);
+  pthread_attr_t attributes;
+  pthread_getattr_np(pthread_self(), &attributes);
+  pthread_attr_getstack(&attributes, &thread_state.stack_base, &thread_state.stack_size);
+  pthread_attr_destroy(&attributes);
+#endif
 
-    handler = AddVectoredExceptionHandler(1, vector_handler);
+  // Stack overflows are handled on an alternate stack, which every thread needs its own of. The
+  // collector has to know about it, as it would otherwise scan from the alternate stack up to the
+  // end of the normal one when it stops a thread that is panicking.
+  thread_state.signal_stack = malloc(SIGSTKSZ * 2);
+  stack_t ss = {
+    .ss_size = SIGSTKSZ * 2,
+    .ss_sp = thread_state.signal_stack,
+  };
+  sigaltstack(&ss, NULL);
+
+  if (thread_state.registered)
+    GC_register_altstack(thread_state.stack_base, thread_state.stack_size,
+                         thread_state.signal_stack, SIGSTKSZ * 2);
+
+  thread_state.initialized = true;
+  pthread_setspecific(thread_key, &thread_state);
+}
 #endif
 
+void* cyth_push_jmp(CyVM* vm, void* new)
+{
+  CyJmp* old = panic_jmp;
+  CyJmp* jmp = new;
+
+  if (old)
+  {
+    jmp->fp = old->fp;
+  }
+  else
+  {
+    init_process();
+    init_thread();
+
 #if defined(__clang__) || defined(__GNUC__)
-    panic_fp = (uintptr_t)__builtin_frame_address(0);
+    jmp->fp = (uintptr_t)__builtin_frame_address(0);
 #elif defined(_MSC_VER)
-    panic_fp = (uintptr_t)_AddressOfReturnAddress() - 8;
+    jmp->fp = (uintptr_t)_AddressOfReturnAddress() - 8;
 #endif
-
-    panic_vm = vm;
   }
 
+  jmp->vm = vm;
+  panic_jmp = jmp;
+
   return old;
 }
 
 void cyth_pop_jmp(CyVM* vm, void* old)
 {
-  vm->jmp = old;
+  (void)vm;
+  panic_jmp = old;
 
-  if (!old)
-  {
 #ifdef _WIN32
-    RemoveVectoredExceptionHandler(handler);
+  if (!old && stack_overflow)
+  {
     _resetstkoflw();
-#else
-    sigaction(SIGSEGV, NULL, NULL);
-    sigaction(SIGFPE, NULL, NULL);
-#endif
-
-    panic_fp = 0;
-    panic_vm = NULL;
+    stack_overflow = false;
   }
+#endif
 }
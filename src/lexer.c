@@ -1,5 +1,6 @@
 #include "lexer.h"
 #include "array.h"
+#include "main.h"
 
 #include <ctype.h>
 #include <stdbool.h>
@@ -22,7 +23,7 @@
 
 #define LITERAL_MAX_SIZE 64
 
-static struct
+static THREAD_LOCAL struct
 {
   int start_line;
   int start_column;
@@ -558,6 +559,9 @@ static void scan_token(void)
   case '?':
     add_token(TOKEN_QUESTION);
     break;
+  case '@':
+    add_token(TOKEN_AT);
+    break;
   case ';':
     add_token(TOKEN_SEMICOLON);
     break;
@@ -866,6 +870,7 @@ void lexer_print(void)
       "TOKEN_PERCENT",
       "TOKEN_PERCENT_EQUAL",
       "TOKEN_QUESTION",
+      "TOKEN_AT",
 
       "TOKEN_TILDE",
       "TOKEN_AMPERSAND",
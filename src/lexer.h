@@ -42,6 +42,7 @@ typedef enum
   TOKEN_PERCENT,
   TOKEN_PERCENT_EQUAL,
   TOKEN_QUESTION,
+  TOKEN_AT,
 
   TOKEN_TILDE,
   TOKEN_AMPERSAND,
@@ -3,8 +3,11 @@
 #include "include/cyth.h"
 #include "memory.h"
 
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #ifdef _WIN32
 #include <fcntl.h>
@@ -15,11 +18,19 @@ static struct
 {
   bool error;
   bool logging;
+  bool timing;
   bool wasm;
+  bool aot;
+  bool compiled;
   bool io;
+  int threads;
+  int optimize_level;
+  long long budget;
+  unsigned long long heap_limit;
 
   const char* input_path;
   const char* output_path;
+  const char* cache_path;
 
   const char* previous_function;
   int previous_line;
@@ -86,6 +97,49 @@ static void error_callback(int start_line, int start_column, int end_line, int e
   cyth.error = true;
 }
 
+static int compare_function_stats(const void* a, const void* b)
+{
+  double time_a = ((const CyFunctionStats*)a)->time;
+  double time_b = ((const CyFunctionStats*)b)->time;
+
+  return (time_a < time_b) - (time_a > time_b);
+}
+
+static void print_compile_stats(CyVM* vm)
+{
+  CyCompileStats stats;
+  cyth_get_compile_stats(vm, &stats);
+
+  const char* names[] = { "lex", "parse", "check", "emit", "generate" };
+  CyCompilePhase phases[] = { stats.lex, stats.parse, stats.check, stats.emit, stats.generate };
+
+  fprintf(stderr, "%-10s %12s %12s\n", "phase", "time (ms)", "memory");
+
+  for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++)
+    fprintf(stderr, "%-10s %12.3f %12zu\n", names[i], phases[i].time * 1000, phases[i].memory);
+
+  fprintf(stderr,
+          "\n"
+          "tokens:       %d\n"
+          "nodes:        %d\n"
+          "instructions: %d\n"
+          "code size:    %d\n"
+          "\n",
+          stats.tokens, stats.nodes, stats.instructions, stats.code_size);
+
+  CyFunctionStats* functions = memory_alloc(sizeof(CyFunctionStats) * stats.function_count);
+  memcpy(functions, stats.functions, sizeof(CyFunctionStats) * stats.function_count);
+  qsort(functions, stats.function_count, sizeof(CyFunctionStats), compare_function_stats);
+
+  fprintf(stderr, "%12s %12s %12s %12s %12s  %s\n", "time (ms)", "emit (ms)", "memory",
+          "instructions", "code size", "function");
+
+  for (int i = 0; i < stats.function_count; i++)
+    fprintf(stderr, "%12.3f %12.3f %12zu %12d %12d  %s\n", functions[i].time * 1000,
+            functions[i].emit_time * 1000, functions[i].memory, functions[i].instructions,
+            functions[i].code_size, functions[i].name);
+}
+
 #ifdef WASM
 static void result_callback(size_t size, void* data, size_t source_map_size, void* source_map)
 {
@@ -152,14 +206,56 @@ void run(char* source)
     cyth_set_error_callback(vm, error_callback);
     cyth_set_panic_callback(vm, panic_callback);
     cyth_set_logging(vm, cyth.logging);
+    cyth_set_cache_directory(vm, cyth.cache_path);
+    cyth_set_compile_threads(vm, cyth.threads);
+    cyth_set_optimize_level(vm, cyth.optimize_level);
+
+    if (cyth.budget)
+      cyth_set_execution_budget(vm, cyth.budget);
+
+    if (cyth.heap_limit)
+      cyth_set_heap_limit(vm, cyth.heap_limit);
+
     cyth_load_function(vm, "void log(int n)", (uintptr_t)log_int);
     cyth_load_function(vm, "void log(bool n)", (uintptr_t)log_int);
     cyth_load_function(vm, "void log(float n)", (uintptr_t)log_float);
     cyth_load_function(vm, "void log(char n)", (uintptr_t)log_char);
     cyth_load_function(vm, "void log(string n)", (uintptr_t)log_string);
-    cyth_load_string(vm, source);
-    cyth_compile(vm);
-    cyth_run(vm);
+
+    if (cyth.aot)
+    {
+      cyth_load_string(vm, source);
+
+      if (!cyth_compile_to_file(vm, cyth.output_path) && !cyth.error)
+      {
+        fprintf(stderr, "error: could not write file: %s\n", cyth.output_path);
+        cyth.error = true;
+      }
+    }
+    else if (cyth.compiled)
+    {
+      cyth_set_lazy_compilation(vm, true);
+
+      if (cyth_load_compiled_file(vm, cyth.input_path) && cyth_compile(vm))
+      {
+        cyth_run(vm);
+      }
+      else
+      {
+        fprintf(stderr, "error: could not read compiled file: %s\n", cyth.input_path);
+        cyth.error = true;
+      }
+    }
+    else
+    {
+      cyth_load_string(vm, source);
+      cyth_compile(vm);
+      cyth_run(vm);
+    }
+
+    if (cyth.timing)
+      print_compile_stats(vm);
+
     cyth_destroy(vm);
   }
 }
@@ -186,7 +282,7 @@ static void run_file(void)
   }
 #endif
 
-  if (cyth.io)
+  if (cyth.io && !cyth.compiled)
   {
     ArrayChar source;
     array_init(&source);
@@ -211,6 +307,12 @@ static void run_file(void)
       return;
     }
 
+    if (cyth.compiled)
+    {
+      run(NULL);
+      return;
+    }
+
     FILE* file = fopen(cyth.input_path, "rb");
     if (!file)
     {
@@ -247,19 +349,40 @@ int main(int argc, char* argv[])
   {
     printf("usage: cyth [options] <input_file>\n");
 
+    printf("       cyth aot [options] <input_file> <output_file>\n");
+    printf("       cyth run [options] <compiled_file>\n");
+
 #ifdef WASM
     printf("       cyth wasm [options] <input_file> [output_file]\n");
 #endif
 
     printf("\n"
            "Available options are:\n"
-           "  -l Print IR.\n"
-           "  -  Read from stdin and output to stdout (will ignore other options).\n");
+           "  -l       Print IR.\n"
+           "  -c <dir> Cache compiled programs in <dir>.\n"
+           "  -O<n>    Optimize at level <n> (0 to 3, default 3).\n"
+           "  -j <n>   Compile functions on <n> threads.\n"
+           "  -b <n>   Panic after <n> function calls and loop iterations.\n"
+           "  -m <n>   Panic after allocating more than <n> bytes.\n"
+           "  -t       Print compile times and sizes.\n"
+           "  -        Read from stdin and output to stdout (will ignore other options).\n");
 
     return 0;
   }
 
   int arg = 1;
+  cyth.optimize_level = 3;
+
+  if (strcmp(argv[1], "aot") == 0)
+  {
+    cyth.aot = true;
+    arg++;
+  }
+  else if (strcmp(argv[1], "run") == 0)
+  {
+    cyth.compiled = true;
+    arg++;
+  }
 
 #ifdef WASM
   if (strcmp(argv[1], "wasm") == 0)
@@ -275,6 +398,52 @@ int main(int argc, char* argv[])
     {
       cyth.logging = true;
     }
+    else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc)
+    {
+      cyth.cache_path = argv[++arg];
+    }
+    else if (strncmp(argv[arg], "-O", 2) == 0 && argv[arg][2] >= '0' && argv[arg][2] <= '3' &&
+             argv[arg][3] == '\0')
+    {
+      cyth.optimize_level = argv[arg][2] - '0';
+    }
+    else if (strcmp(argv[arg], "-t") == 0)
+    {
+      cyth.timing = true;
+    }
+    else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+    {
+      cyth.threads = atoi(argv[++arg]);
+    }
+    else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+    {
+      char* end;
+      const char* value = argv[++arg];
+
+      errno = 0;
+      cyth.budget = strtoll(value, &end, 10);
+
+      if (end == value || *end != '\0' || errno == ERANGE || cyth.budget < 0)
+      {
+        fprintf(stderr, "error: invalid budget: '%s'\n", value);
+        return -1;
+      }
+    }
+    else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc)
+    {
+      char* end;
+      const char* value = argv[++arg];
+
+      errno = 0;
+      cyth.heap_limit = strtoull(value, &end, 10);
+
+      if (end == value || *end != '\0' || errno == ERANGE || value[0] == '-' ||
+          cyth.heap_limit > SIZE_MAX)
+      {
+        fprintf(stderr, "error: invalid heap limit: '%s'\n", value);
+        return -1;
+      }
+    }
     else if (strcmp(argv[arg], "-") == 0)
     {
       cyth.io = true;
@@ -287,6 +456,10 @@ int main(int argc, char* argv[])
         {
           cyth.input_path = argv[arg];
         }
+        else if (cyth.output_path == NULL && cyth.aot)
+        {
+          cyth.output_path = argv[arg];
+        }
 #ifdef WASM
         else if (cyth.output_path == NULL && cyth.wasm)
         {
@@ -307,6 +480,12 @@ int main(int argc, char* argv[])
     }
   }
 
+  if (cyth.aot && !cyth.output_path)
+  {
+    fprintf(stderr, "error: no output file\n");
+    return -1;
+  }
+
   run_file();
   memory_free();
 
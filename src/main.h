@@ -24,6 +24,12 @@
     }                                                                                              \
   } while (0)
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #ifdef _WIN32
 #include <malloc.h>
 
@@ -1,4 +1,5 @@
 #include "memory.h"
+#include "main.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -50,11 +51,22 @@ typedef struct _BUCKET
   long double data[];
 } Bucket;
 
-static struct
+struct _MEMORY
 {
   Bucket* begin;
   Bucket* end;
-} memory;
+  size_t allocated;
+};
+
+// Every thread allocates from its own arena, unless "memory_use" switched it to another one (each
+// VM owns the arena its syntax trees live in).
+static THREAD_LOCAL Memory thread_memory;
+static THREAD_LOCAL Memory* current_memory;
+
+static Memory* get_memory(void)
+{
+  return current_memory ? current_memory : &thread_memory;
+}
 
 static Bucket* new_bucket(size_t capacity)
 {
@@ -72,57 +84,94 @@ static void free_bucket(Bucket* bucket)
   free(bucket);
 }
 
+Memory* memory_init(void)
+{
+  Memory* memory = malloc(sizeof(Memory));
+  memory->begin = NULL;
+  memory->end = NULL;
+  memory->allocated = 0;
+
+  return memory;
+}
+
+Memory* memory_use(Memory* memory)
+{
+  Memory* previous = current_memory;
+  current_memory = memory;
+
+  return previous;
+}
+
+void memory_destroy(Memory* memory)
+{
+  Memory* previous = memory_use(memory);
+  memory_free();
+  memory_use(previous);
+
+  free(memory);
+}
+
 void* memory_alloc(size_t size_bytes)
 {
+  Memory* memory = get_memory();
   size_t size = (size_bytes + ASAN_REDZONE_BYTES() + sizeof(long double) - 1) / sizeof(long double);
 
-  if (memory.end == NULL)
+  if (memory->end == NULL)
   {
     size_t capacity = DEFAULT_BUCKET_SIZE;
     if (capacity < size)
       capacity = size;
 
-    memory.end = new_bucket(capacity);
-    memory.begin = memory.end;
+    memory->end = new_bucket(capacity);
+    memory->begin = memory->end;
   }
 
-  while (memory.end->count + size > memory.end->capacity && memory.end->next != NULL)
+  while (memory->end->count + size > memory->end->capacity && memory->end->next != NULL)
   {
-    memory.end = memory.end->next;
+    memory->end = memory->end->next;
   }
 
-  if (memory.end->count + size > memory.end->capacity)
+  if (memory->end->count + size > memory->end->capacity)
   {
     size_t capacity = DEFAULT_BUCKET_SIZE;
     if (capacity < size)
       capacity = size;
 
-    memory.end->next = new_bucket(capacity);
-    memory.end = memory.end->next;
+    memory->end->next = new_bucket(capacity);
+    memory->end = memory->end->next;
   }
 
-  void* result = &memory.end->data[memory.end->count];
-  memory.end->count += size;
+  void* result = &memory->end->data[memory->end->count];
+  memory->end->count += size;
+  memory->allocated += size_bytes;
 
   ASAN_UNPOISON_MEMORY_REGION(result, size_bytes);
   return result;
 }
 
+size_t memory_allocated(void)
+{
+  return get_memory()->allocated;
+}
+
 void memory_reset(void)
 {
-  for (Bucket* bucket = memory.begin; bucket != NULL; bucket = bucket->next)
+  Memory* memory = get_memory();
+
+  for (Bucket* bucket = memory->begin; bucket != NULL; bucket = bucket->next)
   {
     bucket->count = 0;
 
     ASAN_POISON_MEMORY_REGION(bucket->data, sizeof(long double) * bucket->capacity);
   }
 
-  memory.end = memory.begin;
+  memory->end = memory->begin;
 }
 
 void memory_free(void)
 {
-  Bucket* bucket = memory.begin;
+  Memory* memory = get_memory();
+  Bucket* bucket = memory->begin;
 
   while (bucket)
   {
@@ -131,8 +180,8 @@ void memory_free(void)
     free_bucket(freed_bucket);
   }
 
-  memory.begin = NULL;
-  memory.end = NULL;
+  memory->begin = NULL;
+  memory->end = NULL;
 }
 
 void* memory_realloc(void* old_pointer, size_t old_size, size_t new_size)
@@ -5,12 +5,18 @@
 
 #define ALLOC(type) ((type*)memory_alloc(sizeof(type)))
 
+typedef struct _MEMORY Memory;
+
+Memory* memory_init(void);
+Memory* memory_use(Memory* memory);
+void memory_destroy(Memory* memory);
 void* memory_alloc(size_t size_bytes);
 void* memory_realloc(void* old_pointer, size_t old_size, size_t new_size);
 char* memory_strdup(const char* cstr);
 char* memory_strldup(const char* str, size_t length);
 void* memory_memdup(void* data, size_t size);
 char* memory_sprintf(const char* format, ...);
+size_t memory_allocated(void);
 void memory_reset(void);
 void memory_free(void);
 
@@ -2,15 +2,19 @@
 #include "array.h"
 #include "expression.h"
 #include "lexer.h"
+#include "main.h"
 #include "statement.h"
 
 #include <math.h>
 #include <stdio.h>
 
-static struct
+static THREAD_LOCAL struct
 {
   int current;
   unsigned int classes;
+  int nodes;
+  int optimize_level;
+  bool pure;
   ArrayToken tokens;
 
   bool error;
@@ -36,6 +40,18 @@ static void error(Token token, const char* message)
   parser.errors++;
 }
 
+static Expr* new_expression(void)
+{
+  parser.nodes++;
+  return EXPR();
+}
+
+static Stmt* new_statement(void)
+{
+  parser.nodes++;
+  return STMT();
+}
+
 static Token peek(void)
 {
   return array_at(&parser.tokens, parser.current);
@@ -177,7 +193,7 @@ static Expr* cast_to_array(DataTypeToken type, Expr* expr)
 
   if (expr->type == EXPR_ARRAY)
   {
-    Expr* cast = EXPR();
+    Expr* cast = new_expression();
     cast->type = EXPR_CAST;
     cast->cast.expr = expr;
     cast->cast.to_data_type = DATA_TYPE(TYPE_VOID);
@@ -410,7 +426,7 @@ static void synchronize(void)
 
 static Expr* primary(void)
 {
-  Expr* expr = EXPR();
+  Expr* expr = new_expression();
   Token token = peek();
 
   switch (token.type)
@@ -602,7 +618,7 @@ static Expr* call(void)
 
       consume(TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
 
-      Expr* call = EXPR();
+      Expr* call = new_expression();
       call->type = EXPR_CALL;
       call->call.arguments = arguments;
       call->call.argument_tokens = argument_tokens;
@@ -613,7 +629,7 @@ static Expr* call(void)
     }
     else if (match(TOKEN_DOT))
     {
-      Expr* access = EXPR();
+      Expr* access = new_expression();
       access->type = EXPR_ACCESS;
       access->access.name = consume(TOKEN_IDENTIFIER, "Expected an identifier.");
       access->access.variable = NULL;
@@ -632,7 +648,7 @@ static Expr* call(void)
 
       consume(TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
 
-      Expr* index = EXPR();
+      Expr* index = new_expression();
       index->type = EXPR_INDEX;
       index->index.index = index_expr;
       index->index.index_token = combine_tokens(start_index_token, end_index_token);
@@ -644,7 +660,7 @@ static Expr* call(void)
     }
     else if (match(TOKEN_IS))
     {
-      Expr* is = EXPR();
+      Expr* is = new_expression();
       is->type = EXPR_IS;
       is->is.is_data_type_token = consume_data_type("Expected a type after 'is' keyword.");
       is->is.expr = expr;
@@ -906,7 +922,7 @@ static Expr* assignment(void)
     if (op.type != TOKEN_EQUAL)
       BINARY_EXPR(value, op, expr, value);
 
-    Expr* var = EXPR();
+    Expr* var = new_expression();
     var->type = EXPR_ASSIGN;
     var->assign.op = op;
     var->assign.target = expr_copy;
@@ -926,7 +942,7 @@ static Expr* assignment(void)
     Expr* right = assignment();
     Token body_token = combine_tokens(start_token, previous());
 
-    Expr* var = EXPR();
+    Expr* var = new_expression();
     var->type = EXPR_IF;
 
     var->cond.body_token = body_token;
@@ -951,16 +967,20 @@ static Expr* expression(void)
 
 static Stmt* function_declaration_statement(DataTypeToken type, Token name)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_FUNCTION_DECL;
   stmt->func.type = type;
   stmt->func.name = name;
   stmt->func.name_raw = name;
   stmt->func.import = NULL;
+  stmt->func.optimize_level = parser.optimize_level;
+  stmt->func.pure = parser.pure;
   stmt->func.item = NULL;
   stmt->func.proto = NULL;
   stmt->func.item_prototype = NULL;
   stmt->func.proto_prototype = NULL;
+  parser.optimize_level = -1;
+  parser.pure = false;
 
   array_init(&stmt->func.parameters);
   array_init(&stmt->func.body);
@@ -975,7 +995,7 @@ static Stmt* function_declaration_statement(DataTypeToken type, Token name)
       DataTypeToken type = consume_data_type("Expected a type after '('");
       Token name = consume(TOKEN_IDENTIFIER, "Expected a parameter name after type.");
 
-      Stmt* parameter = STMT();
+      Stmt* parameter = new_statement();
       parameter->type = STMT_VARIABLE_DECL;
       parameter->var.type = type;
       parameter->var.name = name;
@@ -999,7 +1019,7 @@ static Stmt* function_declaration_statement(DataTypeToken type, Token name)
 
 static Stmt* function_template_declaration_statement(DataTypeToken type, Token name)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_FUNCTION_TEMPLATE_DECL;
   stmt->func_template.type = type;
   stmt->func_template.name = name;
@@ -1009,6 +1029,8 @@ static Stmt* function_template_declaration_statement(DataTypeToken type, Token n
   stmt->func_template.cond = NULL;
   stmt->func_template.environment = NULL;
   stmt->func_template.tokens = parser.tokens;
+  stmt->func_template.optimize_level = parser.optimize_level;
+  parser.optimize_level = -1;
 
   array_init(&stmt->func_template.types);
   array_init(&stmt->func_template.parameters);
@@ -1064,7 +1086,7 @@ static Stmt* function_template_declaration_statement(DataTypeToken type, Token n
 
 static Stmt* variable_declaration_statement(DataTypeToken type, Token name, bool newline)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_VARIABLE_DECL;
   stmt->var.type = type;
   stmt->var.name = name;
@@ -1091,7 +1113,7 @@ static Stmt* variable_declaration_statement(DataTypeToken type, Token name, bool
 
 static Stmt* class_template_declaration_statement(Token keyword, Token name)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_CLASS_TEMPLATE_DECL;
   stmt->class_template.keyword = keyword;
   stmt->class_template.name = name;
@@ -1148,7 +1170,7 @@ static Stmt* class_template_declaration_statement(Token keyword, Token name)
 
 static Stmt* class_declaration_statement(Token keyword, Token name)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_CLASS_DECL;
   stmt->class.keyword = keyword;
   stmt->class.name = name;
@@ -1204,7 +1226,7 @@ static Stmt* expression_statement(bool newline)
   if (newline)
     consume(TOKEN_NEWLINE, "Expected a newline after an expression.");
 
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_EXPR;
   stmt->expr.expr = expr;
 
@@ -1222,7 +1244,7 @@ static Stmt* return_statement(void)
     consume(TOKEN_NEWLINE, "Expected a newline after 'return' statement.");
   }
 
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_RETURN;
   stmt->ret.expr = expr;
   stmt->ret.keyword = keyword;
@@ -1232,7 +1254,7 @@ static Stmt* return_statement(void)
 
 static Stmt* continue_statement(void)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_CONTINUE;
   stmt->cont.keyword = advance();
 
@@ -1243,7 +1265,7 @@ static Stmt* continue_statement(void)
 
 static Stmt* break_statement(void)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_BREAK;
   stmt->cont.keyword = advance();
 
@@ -1254,7 +1276,7 @@ static Stmt* break_statement(void)
 
 static Stmt* if_statement(void)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_IF;
   stmt->cond.keyword = advance();
   stmt->cond.condition = expression();
@@ -1287,7 +1309,7 @@ static Stmt* if_statement(void)
 
 static Stmt* while_statement(void)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_WHILE;
   stmt->loop.keyword = advance();
   stmt->loop.condition = expression();
@@ -1311,7 +1333,7 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
   Token end_token = previous();
   Token list_token = combine_tokens(start_token, end_token);
 
-  Stmt* counter_stmt = STMT();
+  Stmt* counter_stmt = new_statement();
   counter_stmt->type = STMT_VARIABLE_DECL;
   counter_stmt->var.type = DATA_TYPE_TOKEN_EMPTY();
   counter_stmt->var.type.type = DATA_TYPE_TOKEN_PRIMITIVE;
@@ -1327,7 +1349,7 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
 
   array_add(&stmt->loop.initializer, counter_stmt);
 
-  Stmt* list_stmt = STMT();
+  Stmt* list_stmt = new_statement();
   list_stmt->type = STMT_VARIABLE_DECL;
   list_stmt->var.type = DATA_TYPE_TOKEN_EMPTY();
   list_stmt->var.type.token = TOKEN_EMPTY();
@@ -1342,19 +1364,19 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
   array_add(&stmt->loop.initializer, list_stmt);
 
   {
-    Expr* counter = EXPR();
+    Expr* counter = new_expression();
     counter->type = EXPR_VAR;
     counter->var.name = counter_stmt->var.name;
     counter->var.variable = NULL;
     counter->var.template_types = NULL;
 
-    Expr* list = EXPR();
+    Expr* list = new_expression();
     list->type = EXPR_VAR;
     list->var.name = list_stmt->var.name;
     list->var.variable = NULL;
     list->var.template_types = NULL;
 
-    Expr* element_access = EXPR();
+    Expr* element_access = new_expression();
     element_access->type = EXPR_ACCESS;
     element_access->access.name = list_token;
     element_access->access.name.lexeme = "length";
@@ -1371,13 +1393,13 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
   }
 
   {
-    Expr* counter = EXPR();
+    Expr* counter = new_expression();
     counter->type = EXPR_VAR;
     counter->var.name = counter_stmt->var.name;
     counter->var.variable = NULL;
     counter->var.template_types = NULL;
 
-    Expr* constant = EXPR();
+    Expr* constant = new_expression();
     constant->type = EXPR_LITERAL;
     constant->literal.data_type = DATA_TYPE(TYPE_INTEGER);
     constant->literal.integer = 1;
@@ -1388,20 +1410,20 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
     Expr* binary;
     BINARY_EXPR(binary, op, counter, constant);
 
-    Expr* target = EXPR();
+    Expr* target = new_expression();
     target->type = EXPR_VAR;
     target->var.name = counter_stmt->var.name;
     target->var.variable = NULL;
     target->var.template_types = NULL;
 
-    Expr* assignment = EXPR();
+    Expr* assignment = new_expression();
     assignment->type = EXPR_ASSIGN;
     assignment->assign.op = op;
     assignment->assign.target = target;
     assignment->assign.value = binary;
     assignment->assign.variable = NULL;
 
-    Stmt* incrementer = STMT();
+    Stmt* incrementer = new_statement();
     incrementer->type = STMT_EXPR;
     incrementer->expr.expr = assignment;
 
@@ -1415,26 +1437,26 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
     statements(&stmt->loop.body);
 
   {
-    Expr* counter = EXPR();
+    Expr* counter = new_expression();
     counter->type = EXPR_VAR;
     counter->var.name = counter_stmt->var.name;
     counter->var.variable = NULL;
     counter->var.template_types = NULL;
 
-    Expr* list = EXPR();
+    Expr* list = new_expression();
     list->type = EXPR_VAR;
     list->var.name = list_stmt->var.name;
     list->var.variable = NULL;
     list->var.template_types = NULL;
 
-    Expr* index = EXPR();
+    Expr* index = new_expression();
     index->type = EXPR_INDEX;
     index->index.index = counter;
     index->index.index_token = list_token;
     index->index.expr = list;
     index->index.expr_token = list_token;
 
-    Stmt* element_stmt = STMT();
+    Stmt* element_stmt = new_statement();
     element_stmt->type = STMT_VARIABLE_DECL;
     element_stmt->var.type = type;
     element_stmt->var.name = name;
@@ -1451,7 +1473,7 @@ static Stmt* for_in_statement(DataTypeToken type, Token name, Stmt* stmt)
 
 static Stmt* for_statement(void)
 {
-  Stmt* stmt = STMT();
+  Stmt* stmt = new_statement();
   stmt->type = STMT_WHILE;
   stmt->loop.keyword = advance();
 
@@ -1495,7 +1517,7 @@ static Stmt* for_statement(void)
   }
   else
   {
-    Expr* expr = EXPR();
+    Expr* expr = new_expression();
     expr->type = EXPR_LITERAL;
     expr->literal.data_type = DATA_TYPE(TYPE_BOOL);
     expr->literal.boolean = true;
@@ -1527,8 +1549,62 @@ static Stmt* for_statement(void)
   return stmt;
 }
 
+static void annotation_statement(ArrayStmt* stmts)
+{
+  Token at = advance();
+  Token name = consume(TOKEN_IDENTIFIER, "Expected an annotation name after '@'.");
+
+  if (strcmp(name.lexeme, "optimize") == 0)
+  {
+    consume(TOKEN_LEFT_PAREN, "Expected '(' after annotation name.");
+    Token level = consume(TOKEN_INTEGER, "Expected an optimization level.");
+    consume(TOKEN_RIGHT_PAREN, "Expected ')' after optimization level.");
+
+    unsigned long value = strtoul(level.lexeme, NULL, 10);
+    if (value > 3)
+      error(level, "The optimization level must be between 0 and 3.");
+    else
+      parser.optimize_level = value;
+  }
+  else if (strcmp(name.lexeme, "pure") == 0)
+  {
+    parser.pure = true;
+  }
+  else
+  {
+    error(name, "Unknown annotation.");
+  }
+
+  consume(TOKEN_NEWLINE, "Expected a newline after an annotation.");
+
+  if (parser.error)
+  {
+    parser.optimize_level = -1;
+    parser.pure = false;
+    return;
+  }
+
+  unsigned int size = array_size(stmts);
+  statement(stmts);
+
+  Stmt* stmt = array_size(stmts) > size ? array_last(stmts) : NULL;
+  if (!stmt || (stmt->type != STMT_FUNCTION_DECL && stmt->type != STMT_FUNCTION_TEMPLATE_DECL))
+    error(combine_tokens(at, name), "Annotations can only be applied to functions.");
+  else if (parser.pure && stmt->type == STMT_FUNCTION_TEMPLATE_DECL)
+    error(combine_tokens(at, name), "Only imported functions can be pure.");
+
+  parser.optimize_level = -1;
+  parser.pure = false;
+}
+
 static void statement(ArrayStmt* stmts)
 {
+  if (check(TOKEN_AT))
+  {
+    annotation_statement(stmts);
+    return;
+  }
+
   if (is_data_type_and_identifier())
   {
     DataTypeToken type = consume_data_type("Expected a type.");
@@ -1618,6 +1694,9 @@ void parser_init(ArrayToken tokens,
 {
   parser.tokens = tokens;
   parser.classes = 0;
+  parser.nodes = 0;
+  parser.optimize_level = -1;
+  parser.pure = false;
   parser.errors = 0;
   parser.error = false;
   parser.error_callback = error_callback;
@@ -1630,6 +1709,11 @@ int parser_errors(void)
   return parser.errors;
 }
 
+int parser_nodes(void)
+{
+  return parser.nodes;
+}
+
 ArrayStmt parser_parse(void)
 {
   ArrayStmt stmts;
@@ -1661,6 +1745,7 @@ Stmt* parser_parse_class_declaration_statement(ClassTemplateStmt* template)
 Stmt* parser_parse_function_declaration_statement(FuncTemplateStmt* template)
 {
   parser.tokens = template->tokens;
+  parser.optimize_level = template->optimize_level;
   seek(template->offset);
 
   return function_declaration_statement(template->type, template->name);
@@ -8,6 +8,7 @@ void parser_init(ArrayToken tokens,
                  void (*error_callback)(int start_line, int start_column, int end_line,
                                         int end_column, const char* message));
 int parser_errors(void);
+int parser_nodes(void);
 ArrayStmt parser_parse(void);
 
 Stmt* parser_parse_class_declaration_statement(ClassTemplateStmt* template);
@@ -62,6 +62,8 @@ typedef struct _FUNC_STMT
   Token name;
   Token name_raw;
   const void* import;
+  int optimize_level;
+  bool pure;
 
   ArrayVarStmt variables;
   ArrayVarStmt parameters;
@@ -84,6 +86,7 @@ typedef struct _FUNC_TEMPLATE_STMT
 
   int offset;
   int count;
+  int optimize_level;
 
   struct _CLASS_STMT* class;
   struct _FUNC_STMT* function;
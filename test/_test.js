@@ -9,6 +9,16 @@ Error.stackTraceLimit = Infinity;
 const executable = process.argv[2];
 const files = await fs.readdir(import.meta.dirname);
 const scripts = process.env.FILE ? process.env.FILE.split(",").filter(Boolean) : files.filter((f) => f.endsWith(".cy"));
+const host = process.env.FILE ? null : process.argv[3];
+
+if (host) {
+  await test(path.basename(host), async () => {
+    const process = child_process.spawnSync(host);
+
+    assert.deepStrictEqual(process.stderr.toString(), "");
+    assert.deepStrictEqual(process.status, 0);
+  });
+}
 
 for (const filename of scripts) {
   await test(filename, async () => {
@@ -0,0 +1,385 @@
+// Checks the behaviour of the C API that scripts in this directory cannot reach on their own.
+// Each case prints what went wrong to stderr, and the process exits with 1 if any case failed.
+
+#include <cyth.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static int result;
+
+static void set_result(int n)
+{
+  result = n;
+}
+
+static CyVM* create_vm(void)
+{
+  CyVM* vm = cyth_init();
+  cyth_load_function(vm, "void result(int n)", (uintptr_t)set_result);
+
+  return vm;
+}
+
+static bool run(CyVM* vm, const char* source)
+{
+  result = -1;
+
+  if (!cyth_load_string(vm, (char*)source) || !cyth_compile(vm))
+  {
+    cyth_destroy(vm);
+    return false;
+  }
+
+  cyth_run(vm);
+  cyth_destroy(vm);
+  return true;
+}
+
+static CyString* make_string(void)
+{
+  CyString* string = cyth_alloc(true, sizeof(CyString) + 3 + 1);
+  string->size = 3;
+  memcpy(string->data, "abc", 4);
+
+  return string;
+}
+
+static void churn(void)
+{
+  for (int i = 0; i < 1000; i++)
+  {
+    unsigned int* block = cyth_alloc(true, sizeof(CyString) + 3 + 1);
+    block[0] = 3;
+    block[1] = 0xdeadbeef;
+  }
+}
+
+// Strings made by hosts with "cyth_alloc" only set their size and characters.
+static bool test_alloc_string(void)
+{
+  CyVM* vm = create_vm();
+  cyth_load_function(vm, "string make()", (uintptr_t)make_string);
+  cyth_load_function(vm, "void churn()", (uintptr_t)churn);
+
+  return run(vm, "int bad = 0\n"
+                 "for int i = 0; i < 200; i += 1\n"
+                 "  churn()\n"
+                 "  string s = make()\n"
+                 "  if s != \"abc\" or s.hash() != \"abc\".hash()\n"
+                 "    bad += 1\n"
+                 "result(bad)\n") &&
+         result == 0;
+}
+
+static int pure_calls;
+
+static int pure_square(int n)
+{
+  pure_calls++;
+  return n * n;
+}
+
+static int pure_sum(CyArray* array)
+{
+  pure_calls++;
+
+  int sum = 0;
+  for (int i = 0; i < array->size; i++)
+    sum += ((int*)array->data)[i];
+
+  return sum;
+}
+
+// A pure call whose arguments the loop never changes is made once, in front of the loop.
+static bool test_pure_hoisted(void)
+{
+  CyVM* vm = create_vm();
+  cyth_load_function(vm, "@pure\nint square(int n)", (uintptr_t)pure_square);
+
+  pure_calls = 0;
+  return run(vm, "void f()\n"
+                 "  int n = 3\n"
+                 "  int total = 0\n"
+                 "  for int i = 0; i < 10; i += 1\n"
+                 "    total += square(n)\n"
+                 "  result(total)\n"
+                 "f()\n") &&
+         result == 90 && pure_calls == 1;
+}
+
+// Arrays can change inside the loop without being assigned, so calls taking them stay put.
+static bool test_pure_array_argument(void)
+{
+  CyVM* vm = create_vm();
+  cyth_load_function(vm, "@pure\nint sum(int[] a)", (uintptr_t)pure_sum);
+
+  pure_calls = 0;
+  return run(vm, "void f()\n"
+                 "  int[] b = [1]\n"
+                 "  int total = 0\n"
+                 "  for int i = 0; i < 3; i += 1\n"
+                 "    b.push(10)\n"
+                 "    total += sum(b)\n"
+                 "  result(total)\n"
+                 "f()\n") &&
+         result == 63 && pure_calls == 3;
+}
+
+// Damaged compiled files are turned away instead of ending the process.
+static bool test_damaged_compiled_file(void)
+{
+  const char* path = "_test_host.cyc";
+  const char* source = "int n = 0\n"
+                       "for int i = 0; i < 10; i += 1\n"
+                       "  n += i\n"
+                       "result(n)\n";
+
+  CyVM* vm = create_vm();
+  cyth_load_string(vm, (char*)source);
+  bool written = cyth_compile_to_file(vm, path);
+  cyth_destroy(vm);
+
+  FILE* file = fopen(path, "rb");
+  if (!written || !file)
+    return false;
+
+  char data[65536];
+  size_t size = fread(data, 1, sizeof(data), file);
+  fclose(file);
+
+  bool passed = true;
+
+  for (int damage = 0; damage < 3; damage++)
+  {
+    file = fopen(path, "wb");
+    if (damage == 0)
+      fwrite(data, 1, size, file);
+    else if (damage == 1)
+      fwrite(data, 1, size / 2, file);
+    else
+    {
+      data[size - 8] ^= 0x5a;
+      fwrite(data, 1, size, file);
+    }
+    fclose(file);
+
+    result = -1;
+    vm = create_vm();
+    bool loaded = cyth_load_compiled_file(vm, path);
+    if (loaded && cyth_compile(vm))
+      cyth_run(vm);
+    cyth_destroy(vm);
+
+    passed &= damage == 0 ? loaded && result == 45 : !loaded && result == -1;
+  }
+
+  remove(path);
+  return passed;
+}
+
+// Levels outside 0 to 3 are clamped, and tiering below level 2 leaves functions as they are.
+static bool test_tiered_optimize_levels(void)
+{
+  const int levels[] = { -1, 0, 1, 2, 3, 9 };
+  bool passed = true;
+
+  for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+  {
+    CyVM* vm = create_vm();
+    cyth_set_tiered_compilation(vm, 3);
+    cyth_set_optimize_level(vm, levels[i]);
+
+    passed &= run(vm, "int add(int a, int b)\n"
+                      "  return a + b\n"
+                      "int n = 0\n"
+                      "for int i = 0; i < 20; i += 1\n"
+                      "  n = add(n, i)\n"
+                      "result(n)\n") &&
+              result == 190;
+  }
+
+  return passed;
+}
+
+static char panic_function[64];
+static int panic_line;
+
+static void record_panic(const char* function, int line, int column)
+{
+  (void)column;
+
+  if (line && !panic_line)
+  {
+    snprintf(panic_function, sizeof(panic_function), "%s", function);
+    panic_line = line;
+  }
+}
+
+// Calls a function from the host, so that it cannot be inlined into the code that calls it.
+static bool call_panic(CyVM* vm, const char* source, const char* name, int argument)
+{
+  panic_function[0] = '\0';
+  panic_line = 0;
+
+  cyth_set_panic_callback(vm, record_panic);
+
+  if (!cyth_load_string(vm, (char*)source) || !cyth_compile(vm))
+  {
+    cyth_destroy(vm);
+    return false;
+  }
+
+  cyth_run(vm);
+
+  CyValue arguments[] = { { .i = argument } };
+  CyStatus status = cyth_call(cyth_get_call(vm, name), arguments, NULL);
+  cyth_destroy(vm);
+
+  return status != CY_STATUS_OK;
+}
+
+// Functions compiled on their first call still know the line that panicked.
+static bool test_lazy_panic_line(void)
+{
+  CyVM* vm = create_vm();
+  cyth_set_lazy_compilation(vm, true);
+
+  return call_panic(vm,
+                    "void divide(int n)\n"
+                    "  result(10 / n)\n",
+                    "divide.void(int)", 0) &&
+         panic_line == 2 && strcmp(panic_function, "divide.void(int)") == 0;
+}
+
+// A function promoted while it runs keeps its lines in the frame that is still running the first
+// tier, and the promoted code reports them as well.
+static bool test_tiered_panic_line(void)
+{
+  CyVM* vm = create_vm();
+  cyth_set_tiered_compilation(vm, 5);
+  cyth_set_panic_callback(vm, record_panic);
+
+  if (!cyth_load_string(vm, "int sum(int n)\n"
+                            "  int total = 0\n"
+                            "  for int i = 0; i < n; i += 1\n"
+                            "    total += 100 / (n - 8 - i)\n"
+                            "  return total\n") ||
+      !cyth_compile(vm))
+  {
+    cyth_destroy(vm);
+    return false;
+  }
+
+  cyth_run(vm);
+
+  CyCall* call = cyth_get_call(vm, "sum.int(int)");
+  CyValue arguments[] = { { .i = 20 } };
+  bool passed = true;
+
+  for (int i = 0; i < 2; i++)
+  {
+    panic_line = 0;
+    passed &= cyth_call(call, arguments, NULL) != CY_STATUS_OK && panic_line == 4;
+  }
+
+  arguments[0].i = 3;
+  CyValue value;
+  passed &= cyth_call(call, arguments, &value) == CY_STATUS_OK && (int)value.i == -50;
+
+  cyth_destroy(vm);
+  return passed;
+}
+
+static int call_result(CyVM* vm, const char* name)
+{
+  CyValue value = { 0 };
+  if (cyth_call(cyth_get_call(vm, name), NULL, &value) != CY_STATUS_OK)
+    return -1;
+
+  return (int)value.i;
+}
+
+// Clones copy what the globals reach by their types, including values kept in "any", and share
+// nothing with the VM they were cloned from.
+static bool test_clone_globals(void)
+{
+  CyVM* vm = create_vm();
+  cyth_set_cloning(vm, true);
+
+  if (!cyth_load_string(vm, "class Node\n"
+                            "  int id\n"
+                            "  Node next\n"
+                            "  string name\n"
+                            "Node first = Node()\n"
+                            "first.id = 7\n"
+                            "first.next = Node()\n"
+                            "first.next.id = 8\n"
+                            "first.name = \"first\"\n"
+                            "int[] numbers = [1, 2, 3]\n"
+                            "string[] names = [\"a\", \"b\"]\n"
+                            "any[] values = [first, \"text\", numbers]\n"
+                            "int check()\n"
+                            "  int passed = 0\n"
+                            "  if first.next.id == 8 and first.name == \"first\"\n"
+                            "    passed += 1\n"
+                            "  if numbers[0] == 1 and names[1] == \"b\"\n"
+                            "    passed += 1\n"
+                            "  if (Node)values[0] == first and ((int[])values[2])[0] == 1\n"
+                            "    passed += 1\n"
+                            "  if (string)values[1] == \"text\"\n"
+                            "    passed += 1\n"
+                            "  return passed\n"
+                            "int change()\n"
+                            "  first.next.id = 9\n"
+                            "  numbers[0] = 5\n"
+                            "  return 0\n") ||
+      !cyth_compile(vm))
+  {
+    cyth_destroy(vm);
+    return false;
+  }
+
+  cyth_run(vm);
+
+  CyVM* clone = cyth_clone(vm);
+  bool passed = clone && call_result(vm, "change.int()") == 0 &&
+                call_result(vm, "check.int()") == 1 && call_result(clone, "check.int()") == 4;
+
+  if (clone)
+    cyth_destroy(clone);
+
+  cyth_destroy(vm);
+  return passed;
+}
+
+int main(void)
+{
+  struct
+  {
+    const char* name;
+    bool (*run)(void);
+  } tests[] = {
+    { "alloc_string", test_alloc_string },
+    { "pure_hoisted", test_pure_hoisted },
+    { "pure_array_argument", test_pure_array_argument },
+    { "damaged_compiled_file", test_damaged_compiled_file },
+    { "tiered_optimize_levels", test_tiered_optimize_levels },
+    { "lazy_panic_line", test_lazy_panic_line },
+    { "tiered_panic_line", test_tiered_panic_line },
+    { "clone_globals", test_clone_globals },
+  };
+
+  int failed = 0;
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+  {
+    if (!tests[i].run())
+    {
+      fprintf(stderr, "%s failed\n", tests[i].name);
+      failed++;
+    }
+  }
+
+  return failed ? 1 : 0;
+}
@@ -2546,7 +2546,7 @@ static void target_rebase (gen_ctx_t gen_ctx, uint8_t *base) {
   gen_setup_lrefs (gen_ctx, base);
 }
 
-static void target_change_to_direct_calls (MIR_context_t ctx MIR_UNUSED) {}
+static void target_change_to_direct_calls (gen_ctx_t gen_ctx MIR_UNUSED) {}
 
 struct target_bb_version {
   uint8_t *base;
@@ -1011,7 +1011,8 @@ static void target_machinize (gen_ctx_t gen_ctx) {
       gen_add_insn_before (gen_ctx, insn, new_insn);
       new_insn = MIR_new_insn (ctx, MIR_MOV, insn->ops[0], areg_op);
       gen_add_insn_after (gen_ctx, insn, new_insn);
-      insn->ops[0] = areg_op;
+      /* Keep ax live into the insn so no compared operand is allocated to it: */
+      insn->ops[0] = insn->ops[1] = areg_op;
       break;
     }
     case MIR_UMULO:
@@ -1594,11 +1595,11 @@ struct pattern {
   {ICODE, "L mld mld", "DB /5 m2; DB /5 m1; DF F1; DD D8; " LONG_JMP_OPCODE " L0", 0},
 
 static struct pattern patterns[] = {
-  /* xor r0, r0; cmp r2, r3; cmovb r0, r1 */
-  {MIR_CCLEAR, "h0 r r r", "X 33 r0 R0; X 3B r2 R3; X 0F 42 r0 R1", 0},
+  /* cmp r2, r3; cmovae r0, 0 */
+  {MIR_CCLEAR, "h0 h0 r r", "X 3B r2 R3; X 0F 43 h0 c0", 0},
 
   /* sqrtss r0, r1 */
-  {MIR_FSQRT, "r r", "F3 0F 51 r0 R1", 0},
+  {MIR_FSQRT, "r r", "F3 Y 0F 51 r0 R1", 0},
 
   {MIR_MOV, "r z", "Y 33 r0 R0", 0},      /* xor r0,r0 -- 32 bit xor */
   {MIR_MOV, "r r", "X 8B r0 R1", 0},      /* mov r0,r1 */
@@ -3035,8 +3036,8 @@ static void target_rebase (gen_ctx_t gen_ctx, uint8_t *base) {
   gen_setup_lrefs (gen_ctx, base);
 }
 
-static void target_change_to_direct_calls (MIR_context_t ctx) {
-  gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
+static void target_change_to_direct_calls (gen_ctx_t gen_ctx) {
+  MIR_context_t ctx = gen_ctx->ctx;
   size_t len = VARR_LENGTH (call_ref_t, gen_ctx->target_ctx->call_refs);
   if (len == 0) return;
   call_ref_t *call_refs_addr = VARR_ADDR (call_ref_t, gen_ctx->target_ctx->call_refs);
@@ -203,6 +203,7 @@ DEF_VARR (spot_attr_t);
 
 DEF_VARR (MIR_op_t);
 DEF_VARR (MIR_insn_t);
+DEF_VARR (gen_ctx_t);
 
 struct gen_ctx {
   MIR_context_t ctx;
@@ -246,6 +247,11 @@ struct gen_ctx {
   void *bb_wrapper;                /* to jump to lazy basic block generation */
   VARR (spot_attr_t) * spot2attr;  /* map: spot number -> spot_attr */
   VARR (spot_attr_t) * spot_attrs; /* spot attrs wit only non-zero properies */
+  /* Used to serialize access to the shared MIR context when workers generate code in parallel: */
+  void (*lock_func) (void *data, int lock_p);
+  void *lock_data;
+  int lock_depth;
+  VARR (gen_ctx_t) * workers; /* additional generator contexts, only in the main one */
 };
 
 #define optimize_level gen_ctx->optimize_level
@@ -367,6 +373,26 @@ static void *gen_malloc_and_mark_to_free (gen_ctx_t gen_ctx, size_t size) {
   return res;
 }
 
+/* Lock the shared MIR context.  Nested locking by the same generator context is permitted. */
+static void gen_lock (gen_ctx_t gen_ctx) {
+  if (gen_ctx->lock_func != NULL && gen_ctx->lock_depth++ == 0)
+    gen_ctx->lock_func (gen_ctx->lock_data, TRUE);
+}
+
+static void gen_unlock (gen_ctx_t gen_ctx) {
+  if (gen_ctx->lock_func != NULL && --gen_ctx->lock_depth == 0)
+    gen_ctx->lock_func (gen_ctx->lock_data, FALSE);
+}
+
+static MIR_insn_t gen_new_label (gen_ctx_t gen_ctx) {
+  MIR_insn_t label;
+
+  gen_lock (gen_ctx);
+  label = MIR_new_label (gen_ctx->ctx);
+  gen_unlock (gen_ctx);
+  return label;
+}
+
 #define DEFAULT_INIT_BITMAP_BITS_NUM 256
 
 typedef struct bb *bb_t;
@@ -1000,7 +1026,7 @@ static bb_t split_edge_if_necessary (gen_ctx_t gen_ctx, edge_t e) {
       }
     }
     /* add fall through new block before dst */
-    insn = MIR_new_label (ctx);
+    insn = gen_new_label (gen_ctx);
     MIR_insert_insn_before (ctx, curr_func_item, first_insn, insn);
     new_bb = create_bb (gen_ctx, insn);
     insert_new_bb_before (gen_ctx, dst, new_bb);
@@ -1196,8 +1222,11 @@ static void update_max_var (gen_ctx_t gen_ctx, MIR_reg_t reg) {
 }
 
 static MIR_reg_t gen_new_temp_reg (gen_ctx_t gen_ctx, MIR_type_t type, MIR_func_t func) {
-  MIR_reg_t reg = _MIR_new_temp_reg (gen_ctx->ctx, type, func) + MAX_HARD_REG;
+  MIR_reg_t reg;
 
+  gen_lock (gen_ctx);
+  reg = _MIR_new_temp_reg (gen_ctx->ctx, type, func) + MAX_HARD_REG;
+  gen_unlock (gen_ctx);
   update_max_var (gen_ctx, reg);
   return reg;
 }
@@ -1582,7 +1611,7 @@ static void build_func_cfg (gen_ctx_t gen_ctx) {
   add_new_bb (gen_ctx, exit_bb);
   /* To deal with special cases like adding insns before call in
      machinize or moving invariant out of loop: */
-  MIR_prepend_insn (ctx, curr_func_item, MIR_new_label (ctx));
+  MIR_prepend_insn (ctx, curr_func_item, gen_new_label (gen_ctx));
   bb = create_bb (gen_ctx, NULL);
   add_new_bb (gen_ctx, bb);
   bitmap_clear (tied_regs);
@@ -1757,7 +1786,7 @@ static void build_func_cfg (gen_ctx_t gen_ctx) {
         if (bo_insn->code == MIR_BNO || bo_insn->code == MIR_UBNO) {
           new_insn = MIR_new_insn (ctx, MIR_BF, bo_insn->ops[0], temp_op1);
         } else {
-          new_label = MIR_new_label (ctx);
+          new_label = gen_new_label (gen_ctx);
           new_insn = MIR_new_insn (ctx, MIR_BF, MIR_new_label_op (ctx, new_label), temp_op1);
         }
         MIR_insert_insn_before (ctx, curr_func_item, bo_insn, new_insn);
@@ -1990,7 +2019,7 @@ static MIR_insn_t get_insn_label (gen_ctx_t gen_ctx, MIR_insn_t insn) {
   MIR_insn_t label;
 
   if (insn->code == MIR_LABEL) return insn;
-  label = MIR_new_label (ctx);
+  label = gen_new_label (gen_ctx);
   MIR_insert_insn_before (ctx, curr_func_item, insn, label);
   add_new_bb_insn (gen_ctx, label, ((bb_insn_t) insn->data)->bb, FALSE);
   return label;
@@ -2523,6 +2552,7 @@ static MIR_reg_t get_new_reg (gen_ctx_t gen_ctx, MIR_reg_t old_reg, int sep, siz
   VARR_PUSH (char, reg_name, sep);
   sprintf (ind_str, "%lu", (unsigned long) index); /* ??? should be enough to unique */
   VARR_PUSH_ARR (char, reg_name, ind_str, strlen (ind_str) + 1);
+  gen_lock (gen_ctx);
   if (hard_reg_name == NULL) {
     new_reg = MIR_new_func_reg (ctx, func, type, VARR_ADDR (char, reg_name)) + MAX_HARD_REG;
   } else {
@@ -2530,6 +2560,7 @@ static MIR_reg_t get_new_reg (gen_ctx_t gen_ctx, MIR_reg_t old_reg, int sep, siz
                + MAX_HARD_REG);
     bitmap_set_bit_p (tied_regs, new_reg);
   }
+  gen_unlock (gen_ctx);
   update_max_var (gen_ctx, new_reg);
   return new_reg;
 }
@@ -6979,7 +7010,7 @@ static void coalesce (gen_ctx_t gen_ctx) {
     if (first_reg != VARR_GET (MIR_reg_t, first_coalesced_reg, dreg)) continue;
     if (DLIST_TAIL (bb_insn_t, bb->bb_insns) == bb_insn
         && DLIST_HEAD (bb_insn_t, bb->bb_insns) == bb_insn) { /* bb is becoming empty */
-      new_insn = MIR_new_label (ctx);
+      new_insn = gen_new_label (gen_ctx);
       MIR_insert_insn_before (ctx, curr_func_item, insn, new_insn);
       add_new_bb_insn (gen_ctx, new_insn, bb, FALSE);
       DEBUG (2, {
@@ -7586,20 +7617,27 @@ static void assign (gen_ctx_t gen_ctx) {
   for (int n = 0; n <= curr_point && n < (int) VARR_LENGTH (bitmap_t, used_locs); n++)
     if (global_hard_regs == NULL) {
       bitmap_clear (VARR_GET (bitmap_t, used_locs, n));
-      if (!simplified_p) bitmap_clear (VARR_GET (bitmap_t, busy_used_locs, n));
     } else {
       bitmap_copy (VARR_GET (bitmap_t, used_locs, n), global_hard_regs);
-      if (!simplified_p) bitmap_copy (VARR_GET (bitmap_t, busy_used_locs, n), global_hard_regs);
+    }
+  /* busy_used_locs can be shorter than used_locs if the optimize level was raised between
+     generations, so grow and reset it separately.  */
+  for (int n = 0;
+       !simplified_p && n <= curr_point && n < (int) VARR_LENGTH (bitmap_t, busy_used_locs); n++)
+    if (global_hard_regs == NULL) {
+      bitmap_clear (VARR_GET (bitmap_t, busy_used_locs, n));
+    } else {
+      bitmap_copy (VARR_GET (bitmap_t, busy_used_locs, n), global_hard_regs);
     }
   while ((int) VARR_LENGTH (bitmap_t, used_locs) <= curr_point) {
     bm = bitmap_create2 (alloc, MAX_HARD_REG + 1);
     if (global_hard_regs != NULL) bitmap_copy (bm, global_hard_regs);
     VARR_PUSH (bitmap_t, used_locs, bm);
-    if (!simplified_p) {
-      bm = bitmap_create2 (alloc, MAX_HARD_REG + 1);
-      if (global_hard_regs != NULL) bitmap_copy (bm, global_hard_regs);
-      VARR_PUSH (bitmap_t, busy_used_locs, bm);
-    }
+  }
+  while (!simplified_p && (int) VARR_LENGTH (bitmap_t, busy_used_locs) <= curr_point) {
+    bm = bitmap_create2 (alloc, MAX_HARD_REG + 1);
+    if (global_hard_regs != NULL) bitmap_copy (bm, global_hard_regs);
+    VARR_PUSH (bitmap_t, busy_used_locs, bm);
   }
   nregs = (int) VARR_LENGTH (allocno_info_t, sorted_regs);
   qsort (VARR_ADDR (allocno_info_t, sorted_regs), nregs, sizeof (allocno_info_t),
@@ -9268,18 +9306,21 @@ static void *print_and_execute_wrapper (gen_ctx_t gen_ctx, MIR_item_t called_fun
 
 static const int collect_bb_stat_p = FALSE;
 
-static void *generate_func_code (MIR_context_t ctx, MIR_item_t func_item, int machine_code_p) {
-  gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
+static void *generate_func_code (gen_ctx_t gen_ctx, MIR_item_t func_item, int machine_code_p) {
+  MIR_context_t ctx = gen_ctx->ctx;
   uint8_t *code;
   void *machine_code = NULL;
   size_t code_len = 0;
   double start_time = real_usec_time ();
   uint32_t bbs_num;
+  unsigned saved_optimize_level;
 
   gen_assert (func_item->item_type == MIR_func_item && func_item->data == NULL);
   if (func_item->u.func->machine_code != NULL) {
     gen_assert (func_item->u.func->call_addr != NULL);
+    gen_lock (gen_ctx);
     _MIR_redirect_thunk (ctx, func_item->addr, func_item->u.func->call_addr);
+    gen_unlock (gen_ctx);
     DEBUG (2, {
       fprintf (debug_file, "+++++++++++++The code for %s has been already generated\n",
                MIR_item_name (ctx, func_item));
@@ -9293,6 +9334,8 @@ static void *generate_func_code (MIR_context_t ctx, MIR_item_t func_item, int ma
     fprintf (debug_file, "+++++++++++++MIR before generator:\n");
     MIR_output_item (ctx, debug_file, func_item);
   });
+  saved_optimize_level = optimize_level;
+  if (func_item->u.func->opt_level >= 0) optimize_level = func_item->u.func->opt_level;
   curr_func_item = func_item;
   _MIR_duplicate_func_insns (ctx, func_item);
   curr_cfg = func_item->data = gen_malloc (gen_ctx, sizeof (struct func_cfg));
@@ -9412,7 +9455,9 @@ static void *generate_func_code (MIR_context_t ctx, MIR_item_t func_item, int ma
       print_CFG (gen_ctx, TRUE, FALSE, TRUE, TRUE, NULL);
     });
   }
+  gen_lock (gen_ctx); /* machinize can create builtin protos and imports in the module */
   target_machinize (gen_ctx);
+  gen_unlock (gen_ctx);
   make_io_dup_op_insns (gen_ctx);
   DEBUG (2, {
     fprintf (debug_file, "+++++++++++++MIR after machinize:\n");
@@ -9467,6 +9512,7 @@ static void *generate_func_code (MIR_context_t ctx, MIR_item_t func_item, int ma
   });
   if (machine_code_p) {
     code = target_translate (gen_ctx, &code_len);
+    gen_lock (gen_ctx);
     machine_code = func_item->u.func->call_addr = _MIR_publish_code (ctx, code, code_len);
     target_rebase (gen_ctx, func_item->u.func->call_addr);
 #if MIR_GEN_CALL_TRACE
@@ -9477,9 +9523,11 @@ static void *generate_func_code (MIR_context_t ctx, MIR_item_t func_item, int ma
       fprintf (debug_file, "code size = %lu:\n", (unsigned long) code_len);
     });
     _MIR_redirect_thunk (ctx, func_item->addr, func_item->u.func->call_addr);
+    gen_unlock (gen_ctx);
   }
   if (optimize_level != 0) destroy_loop_tree (gen_ctx, curr_cfg->root_loop_node);
   destroy_func_cfg (gen_ctx);
+  optimize_level = saved_optimize_level;
   if (collect_bb_stat_p) overall_bbs_num += bbs_num;
   if (!machine_code_p) return NULL;
   DEBUG (0, {
@@ -9498,7 +9546,7 @@ static void *generate_func_code (MIR_context_t ctx, MIR_item_t func_item, int ma
 }
 
 uintptr_t MIR_gen (MIR_context_t ctx, MIR_item_t func_item) {
-  return (uintptr_t)generate_func_code (ctx, func_item, TRUE);
+  return (uintptr_t)generate_func_code (*gen_ctx_loc (ctx), func_item, TRUE);
 }
 
 void MIR_gen_set_debug_file (MIR_context_t ctx, FILE *f) {
@@ -9523,6 +9571,8 @@ void MIR_gen_set_debug_level (MIR_context_t ctx, int level) {
 #endif
 }
 
+static void set_optimize_level (gen_ctx_t gen_ctx, unsigned int level) { optimize_level = level; }
+
 void MIR_gen_set_optimize_level (MIR_context_t ctx, unsigned int level) {
   gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
   if (gen_ctx == NULL) {
@@ -9530,6 +9580,8 @@ void MIR_gen_set_optimize_level (MIR_context_t ctx, unsigned int level) {
     exit (1);
   }
   optimize_level = level;
+  for (size_t i = 0; i < VARR_LENGTH (gen_ctx_t, gen_ctx->workers); i++)
+    set_optimize_level (VARR_GET (gen_ctx_t, gen_ctx->workers, i), level);
 }
 
 static void generate_bb_version_machine_code (gen_ctx_t gen_ctx, bb_version_t bb_version);
@@ -9633,14 +9685,17 @@ static void create_bb_stubs (gen_ctx_t gen_ctx) {
   }
 }
 
-void MIR_gen_init (MIR_context_t ctx) {
+static gen_ctx_t create_gen_ctx (MIR_context_t ctx) {
   MIR_alloc_t alloc = MIR_get_alloc (ctx);
-  gen_ctx_t gen_ctx, *gen_ctx_ptr = gen_ctx_loc (ctx);
+  gen_ctx_t gen_ctx = MIR_malloc (alloc, sizeof (struct gen_ctx));
 
-  *gen_ctx_ptr = gen_ctx = MIR_malloc (alloc, sizeof (struct gen_ctx));
   if (gen_ctx == NULL) util_error (gen_ctx, "no memory");
 
   gen_ctx->ctx = ctx;
+  gen_ctx->lock_func = NULL;
+  gen_ctx->lock_data = NULL;
+  gen_ctx->lock_depth = 0;
+  gen_ctx->workers = NULL;
   optimize_level = 2;
   gen_ctx->target_ctx = NULL;
   gen_ctx->data_flow_ctx = NULL;
@@ -9697,14 +9752,16 @@ void MIR_gen_init (MIR_context_t ctx) {
   func_used_hard_regs = bitmap_create2 (alloc, MAX_HARD_REG + 1);
   bb_wrapper = _MIR_get_bb_wrapper (ctx, gen_ctx, bb_version_generator);
   overall_bbs_num = overall_gen_bbs_num = 0;
+  return gen_ctx;
 }
 
-void MIR_gen_finish (MIR_context_t ctx) {
-  gen_ctx_t *gen_ctx_ptr = gen_ctx_loc (ctx), gen_ctx = *gen_ctx_ptr;
+void MIR_gen_init (MIR_context_t ctx) {
+  gen_ctx_t gen_ctx = *gen_ctx_loc (ctx) = create_gen_ctx (ctx);
 
-  if (gen_ctx == NULL) {
-    return;
-  }
+  VARR_CREATE (gen_ctx_t, gen_ctx->workers, MIR_get_alloc (ctx), 0);
+}
+
+static void destroy_gen_ctx (gen_ctx_t gen_ctx) {
   finish_data_flow (gen_ctx);
   finish_ssa (gen_ctx);
   finish_gvn (gen_ctx);
@@ -9743,12 +9800,64 @@ void MIR_gen_finish (MIR_context_t ctx) {
     fprintf (stderr, "Overall bbs num = %llu, generated bbs num = %llu\n", overall_bbs_num,
              overall_gen_bbs_num);
   gen_free (gen_ctx, gen_ctx);
+}
+
+void MIR_gen_finish (MIR_context_t ctx) {
+  gen_ctx_t *gen_ctx_ptr = gen_ctx_loc (ctx), gen_ctx = *gen_ctx_ptr;
+
+  if (gen_ctx == NULL) {
+    return;
+  }
+  while (VARR_LENGTH (gen_ctx_t, gen_ctx->workers) != 0)
+    destroy_gen_ctx (VARR_POP (gen_ctx_t, gen_ctx->workers));
+  VARR_DESTROY (gen_ctx_t, gen_ctx->workers);
+  destroy_gen_ctx (gen_ctx);
   *gen_ctx_ptr = NULL;
 }
 
+/* Parallel generation: each worker is an additional generator context, so different functions
+   can be generated by different threads at the same time.  Accesses to the shared MIR context
+   are serialized by LOCK_FUNC, which is called with LOCK_P true to lock and false to unlock. */
+void MIR_gen_set_lock_func (MIR_context_t ctx, void (*lock_func) (void *data, int lock_p),
+                            void *data) {
+  gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
+
+  gen_ctx->lock_func = lock_func;
+  gen_ctx->lock_data = data;
+  for (size_t i = 0; i < VARR_LENGTH (gen_ctx_t, gen_ctx->workers); i++) {
+    VARR_GET (gen_ctx_t, gen_ctx->workers, i)->lock_func = lock_func;
+    VARR_GET (gen_ctx_t, gen_ctx->workers, i)->lock_data = data;
+  }
+}
+
+void MIR_gen_set_workers_num (MIR_context_t ctx, size_t workers_num) {
+  gen_ctx_t gen_ctx = *gen_ctx_loc (ctx), worker;
+
+  while (VARR_LENGTH (gen_ctx_t, gen_ctx->workers) > workers_num)
+    destroy_gen_ctx (VARR_POP (gen_ctx_t, gen_ctx->workers));
+  while (VARR_LENGTH (gen_ctx_t, gen_ctx->workers) < workers_num) {
+    worker = create_gen_ctx (ctx);
+    set_optimize_level (worker, optimize_level);
+    worker->lock_func = gen_ctx->lock_func;
+    worker->lock_data = gen_ctx->lock_data;
+    VARR_PUSH (gen_ctx_t, gen_ctx->workers, worker);
+  }
+}
+
+uintptr_t MIR_gen_by_worker (MIR_context_t ctx, size_t worker, MIR_item_t func_item) {
+  gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
+
+  gen_assert (worker < VARR_LENGTH (gen_ctx_t, gen_ctx->workers));
+  return (uintptr_t) generate_func_code (VARR_GET (gen_ctx_t, gen_ctx->workers, worker), func_item,
+                                         TRUE);
+}
+
 void MIR_set_gen_interface (MIR_context_t ctx, MIR_item_t func_item) {
   if (func_item == NULL) { /* finish setting interfaces */
-    target_change_to_direct_calls (ctx);
+    gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
+    target_change_to_direct_calls (gen_ctx);
+    for (size_t i = 0; i < VARR_LENGTH (gen_ctx_t, gen_ctx->workers); i++)
+      target_change_to_direct_calls (VARR_GET (gen_ctx_t, gen_ctx->workers, i));
   } else {
     MIR_gen (ctx, func_item);
   }
@@ -9756,7 +9865,7 @@ void MIR_set_gen_interface (MIR_context_t ctx, MIR_item_t func_item) {
 
 /* Lazy func generation is done right away. */
 static void generate_func_and_redirect (MIR_context_t ctx, MIR_item_t func_item, int full_p) {
-  generate_func_code (ctx, func_item, full_p);
+  generate_func_code (*gen_ctx_loc (ctx), func_item, full_p);
   if (full_p) return;
   gen_ctx_t gen_ctx = *gen_ctx_loc (ctx);
   void *addr;
@@ -26,6 +26,12 @@ extern void MIR_set_lazy_gen_interface (MIR_context_t ctx, MIR_item_t func_item)
 extern void MIR_set_lazy_bb_gen_interface (MIR_context_t ctx, MIR_item_t func_item);
 extern void MIR_gen_finish (MIR_context_t ctx);
 
+/* Parallel generation: */
+extern void MIR_gen_set_lock_func (MIR_context_t ctx, void (*lock_func) (void *data, int lock_p),
+                                   void *data);
+extern void MIR_gen_set_workers_num (MIR_context_t ctx, size_t workers_num);
+extern uintptr_t MIR_gen_by_worker (MIR_context_t ctx, size_t worker, MIR_item_t func_item);
+
 #ifdef __cplusplus
 }
 #endif
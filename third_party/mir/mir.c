@@ -1427,6 +1427,7 @@ static MIR_item_t new_func_arr (MIR_context_t ctx, const char *name, size_t nres
   func->n_inlines = 0;
   func->length = 0;
   func->machine_code = func->call_addr = NULL;
+  func->opt_level = -1;
   func->first_lref = NULL;
   func_regs_init (ctx, func);
   for (size_t i = 0; i < nargs; i++) {
@@ -4089,6 +4090,8 @@ static void process_inlines (MIR_context_t ctx, MIR_item_t func_item) {
     called_func = called_func_item->u.func;
     called_func_insns_num = DLIST_LENGTH (MIR_insn_t, called_func->insns);
     if (called_func->first_lref != NULL || called_func->vararg_p || called_func->jret_p
+        /* a call of a func which can be redefined later should stay a call: */
+        || (func_insn->code == MIR_CALL && func_redef_permission_p)
         || called_func_insns_num > (func_insn->code != MIR_CALL ? MIR_MAX_INSNS_FOR_INLINE
                                                                 : MIR_MAX_INSNS_FOR_CALL_INLINE)
         || func_insns_num > MIR_MAX_CALLER_SIZE_FOR_ANY_GROWTH_INLINE) {
@@ -5595,9 +5598,12 @@ void MIR_read_with_func (MIR_context_t ctx, int (*const reader) (MIR_context_t))
                                    VARR_ADDR (MIR_var_t, proto_vars));
         VARR_TRUNC (MIR_label_t, func_labels, 0);
       } else if (strcmp (name, "endfunc") == 0) {
-        if (VARR_LENGTH (uint64_t, insn_label_string_nums) != 0)
-          MIR_get_error_func (ctx) (MIR_binary_io_error, "endfunc should have no labels");
         if (func == NULL) MIR_get_error_func (ctx) (MIR_binary_io_error, "endfunc without func");
+        /* labels at the end of the function are written right before endfunc: */
+        for (size_t j = 0; j < VARR_LENGTH (uint64_t, insn_label_string_nums); j++) {
+          lab = to_lab (ctx, VARR_GET (uint64_t, insn_label_string_nums, j));
+          MIR_append_insn (ctx, func, lab);
+        }
         MIR_finish_func (ctx);
         func = NULL;
       } else if (strcmp (name, "export") == 0) {
@@ -5803,7 +5809,7 @@ void MIR_read_with_func (MIR_context_t ctx, int (*const reader) (MIR_context_t))
     } else if (TAG_U0 <= tag && tag <= TAG_U8) { /* insn code */
       MIR_insn_code_t insn_code = attr.u;
 
-      if (insn_code >= MIR_LABEL)
+      if (insn_code >= MIR_INVALID_INSN || (insn_code >= MIR_LABEL && insn_code < MIR_CCLEAR))
         MIR_get_error_func (ctx) (MIR_binary_io_error, "wrong insn code %d", insn_code);
       if (insn_code == MIR_UNSPEC || insn_code == MIR_USE || insn_code == MIR_PHI)
         MIR_get_error_func (ctx) (MIR_binary_io_error,
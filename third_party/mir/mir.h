@@ -322,6 +322,7 @@ typedef struct MIR_func {
   void *call_addr; /* address to call the function, it can be the same as machine_code */
   void *internal;  /* internal data structure */
   size_t length;
+  int opt_level; /* optimize level used to generate the func, or -1 for the generator one */
   struct MIR_lref_data *first_lref; /* label addr data of the func: defined by module load */
 } *MIR_func_t;
 